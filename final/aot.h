@@ -0,0 +1,99 @@
+#ifndef AOT_H_
+#define AOT_H_
+
+// Runtime for C programs generated by x16aot. The generated file has one
+// function per basic block of the image and a table of all of them;
+// aot_runtime.c loads the image, dispatches through a PC to function
+// table and falls back to the interpreter for everything else.
+
+#include <stdint.h>
+#include "instruction.h"
+#include "machine.h"
+#include "x16.h"
+
+// Returned by a block function when the machine halted
+#define AOT_HALT    (-1)
+
+// State shared by the runtime and the generated code
+typedef struct {
+    x16_t* machine;
+    uint16_t* mem;                      // guest memory
+    uint16_t reg[MAX_REGISTERS];        // register file between blocks
+    uint8_t code[MAX_MEMORY / 8];       // words covered by a block function
+    uint64_t executed;                  // instructions retired
+} aot_t;
+
+// A translated basic block. Returns the next PC or AOT_HALT.
+typedef int32_t (*aot_fn_t)(aot_t* a);
+
+typedef struct {
+    uint16_t start;     // address of the first instruction
+    uint16_t length;    // number of instructions
+    aot_fn_t fn;
+} aot_block_t;
+
+// What the generated file defines
+typedef struct {
+    uint16_t origin;
+    const uint16_t* image;      // the image words, loaded at origin
+    uint32_t image_length;
+    const aot_block_t* blocks;  // sorted by start address
+    uint32_t num_blocks;
+} aot_program_t;
+
+extern const aot_program_t aot_program;
+
+// Memory write from a block. Return 1 if it changed translated code; the
+// blocks holding the address are then dropped from the dispatch table.
+int aot_write(aot_t* a, uint16_t address, uint16_t value);
+
+// Service a trap. Return -1 to halt or 0 to continue.
+int aot_trap(aot_t* a, uint16_t instruction);
+
+// Memory read. Only device pages need the machine.
+static inline uint16_t aot_read(aot_t* a, uint16_t address) {
+    return machine_is_io(a->machine, address) ?
+        machine_io_read(a->machine, address) : a->mem[address];
+}
+
+// Condition flag for a result
+#define AOT_COND(result) \
+    ((result) == 0 ? FL_ZRO : (((result) & 0x8000) ? FL_NEG : FL_POS))
+
+// Load the register file into locals at the start of a block
+#define AOT_ENTER()                                                     \
+    uint16_t r0 = a->reg[0], r1 = a->reg[1], r2 = a->reg[2],            \
+        r3 = a->reg[3], r4 = a->reg[4], r5 = a->reg[5],                 \
+        r6 = a->reg[6], r7 = a->reg[7], cond = a->reg[R_COND];          \
+    (void) r0; (void) r1; (void) r2; (void) r3;                         \
+    (void) r4; (void) r5; (void) r6; (void) r7
+
+// Store the locals back after n instructions
+#define AOT_LEAVE(n) do {                                               \
+        a->reg[0] = r0; a->reg[1] = r1; a->reg[2] = r2;                 \
+        a->reg[3] = r3; a->reg[4] = r4; a->reg[5] = r5;                 \
+        a->reg[6] = r6; a->reg[7] = r7; a->reg[R_COND] = cond;          \
+        a->executed += (n);                                             \
+    } while (0)
+
+// Leave the block after n instructions and continue at pc
+#define AOT_EXIT(n, pc) do {                                            \
+        AOT_LEAVE(n);                                                   \
+        return (uint16_t) (pc);                                         \
+    } while (0)
+
+// Store, and leave the block if it overwrote translated code
+#define AOT_WRITE(n, next, address, value) do {                         \
+        if (aot_write(a, (address), (value))) {                         \
+            AOT_EXIT(n, next);                                          \
+        }                                                               \
+    } while (0)
+
+// Trap as the last instruction of a block
+#define AOT_TRAP(n, next, instruction) do {                             \
+        AOT_LEAVE(n);                                                   \
+        a->reg[R_PC] = (next);                                          \
+        return aot_trap(a, (instruction)) != 0 ? AOT_HALT : (next);    \
+    } while (0)
+
+#endif  // AOT_H_
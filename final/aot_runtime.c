@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "aot.h"
+#include "bits.h"
+#include "control.h"
+#include "io.h"
+#include "trap.h"
+#include "x16.h"
+
+// Block functions indexed by start address. Entries are cleared when the
+// guest overwrites the code of a block.
+static aot_fn_t dispatch[MAX_MEMORY];
+
+// Copy the register file into the machine
+static void sync_out(aot_t* a, uint16_t pc) {
+    a->reg[R_PC] = pc;
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        x16_set(a->machine, (reg_t) i, a->reg[i]);
+    }
+}
+
+// Copy the register file back from the machine
+static void sync_in(aot_t* a) {
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        a->reg[i] = x16_reg(a->machine, (reg_t) i);
+    }
+}
+
+// After a store that changed the word at address, drop the blocks that
+// hold it, so the interpreter runs them from now on. Return 1 if there
+// were any.
+static int drop_blocks(aot_t* a, uint16_t address) {
+    if (!(a->code[address >> 3] & (1 << (address & 7)))) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < aot_program.num_blocks; i++) {
+        const aot_block_t* block = &aot_program.blocks[i];
+        if ((uint16_t) (address - block->start) < block->length) {
+            dispatch[block->start] = NULL;
+        }
+    }
+    return 1;
+}
+
+// Memory write from a block
+int aot_write(aot_t* a, uint16_t address, uint16_t value) {
+    uint16_t old = a->mem[address];
+    x16_memwrite(a->machine, address, value);
+    return old != value && drop_blocks(a, address);
+}
+
+// The address the instruction at pc stores to. Return false if it is not
+// a store, or an STI through a device register, which cannot be read
+// without side effects and is not a code pointer.
+static bool store_address(aot_t* a, uint16_t pc, uint16_t* address) {
+    uint16_t instruction = a->mem[pc];
+    uint16_t offset9 = sign_extend(instruction & 0x1ff, 9);
+    switch (getopcode(instruction)) {
+    case OP_ST:
+        *address = pc + 1 + offset9;
+        return true;
+
+    case OP_STI: {
+        uint16_t pointer = pc + 1 + offset9;
+        if (machine_is_io(a->machine, pointer)) {
+            return false;
+        }
+        *address = a->mem[pointer];
+        return true;
+    }
+
+    case OP_STR:
+        *address = a->reg[(instruction >> 6) & 7] +
+            sign_extend(instruction & 0x3f, 6);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Service a trap
+int aot_trap(aot_t* a, uint16_t instruction) {
+    sync_out(a, a->reg[R_PC]);
+    int rv = trap(a->machine, instruction);
+    sync_in(a);
+    return rv;
+}
+
+// Current time in seconds
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-n instructions] [-d state-file]\n", name);
+    exit(1);
+}
+
+// Write the registers, the instruction count and memory, all in host
+// order, to a file
+static void write_state(aot_t* a, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+    uint16_t reg[MAX_REGISTERS];
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        reg[i] = x16_reg(a->machine, (reg_t) i);
+    }
+    fwrite(reg, sizeof(reg), 1, file);
+    fwrite(&a->executed, sizeof(a->executed), 1, file);
+    fwrite(a->mem, sizeof(uint16_t), MAX_MEMORY, file);
+    fclose(file);
+}
+
+// Run the translated program. With -n the program stops after about that
+// many instructions and reports instructions per second to stderr. With
+// -d it writes its final state to a file, for comparing with the
+// interpreter.
+int main(int argc, char** argv) {
+    int ch;
+    uint64_t budget = 0;
+    const char* state = NULL;
+    while ((ch = getopt(argc, argv, "n:d:")) != -1) {
+        switch (ch) {
+        case 'n':
+            budget = strtoull(optarg, NULL, 0);
+            break;
+
+        case 'd':
+            state = optarg;
+            break;
+
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    aot_t* a = (aot_t*) calloc(1, sizeof(aot_t));
+    a->machine = x16_create();
+    if (a->machine == NULL) {
+        fprintf(stderr, "Cannot create a machine\n");
+        exit(1);
+    }
+    a->mem = x16_memory(a->machine, 0);
+    memcpy(x16_memory(a->machine, aot_program.origin), aot_program.image,
+           aot_program.image_length * sizeof(uint16_t));
+    for (uint32_t i = 0; i < aot_program.num_blocks; i++) {
+        const aot_block_t* block = &aot_program.blocks[i];
+        dispatch[block->start] = block->fn;
+        for (uint16_t j = 0; j < block->length; j++) {
+            uint16_t address = block->start + j;
+            a->code[address >> 3] |= 1 << (address & 7);
+        }
+    }
+    sync_in(a);
+
+    // Interactive runs get the same terminal setup as x16
+    if (budget == 0) {
+        signal(SIGINT, handle_interrupt);
+        disable_input_buffering();
+    }
+
+    double start = now();
+    int32_t pc = aot_program.origin;
+    while (budget == 0 || a->executed < budget) {
+        aot_fn_t fn = dispatch[pc];
+        if (fn != NULL) {
+            pc = fn(a);
+        } else {
+            // Not translated, or translated code that was overwritten. A
+            // store here drops blocks as one from a block does.
+            uint16_t address = 0;
+            bool store = store_address(a, pc, &address);
+            uint16_t old = a->mem[address];
+            sync_out(a, pc);
+            int rv = execute_instruction(a->machine);
+            sync_in(a);
+            if (store && a->mem[address] != old) {
+                drop_blocks(a, address);
+            }
+            a->executed++;
+            pc = rv != 0 ? AOT_HALT : a->reg[R_PC];
+        }
+        if (pc == AOT_HALT) {
+            break;
+        }
+    }
+    double elapsed = now() - start;
+    if (pc != AOT_HALT) {
+        sync_out(a, pc);
+    }
+
+    if (budget == 0) {
+        restore_input_buffering();
+    } else {
+        x16_flush(a->machine);
+        fprintf(stderr, "%-12s %-9s %12llu instructions %8.3f s %10.2f MIPS\n",
+            argv[0], "aot", (unsigned long long) a->executed, elapsed,
+            a->executed / elapsed / 1e6);
+    }
+
+    if (state != NULL) {
+        write_state(a, state);
+    }
+    x16_free(a->machine);
+    free(a);
+    return 0;
+}
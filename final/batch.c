@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "console.h"
+#include "engine.h"
+#include "image_cache.h"
+#include "pool.h"
+#include "x16.h"
+
+// Instructions a job may run when -n is not given
+#define DEFAULT_INSTRUCTIONS    100000000
+
+// Instructions in a slice when -s is not given
+#define DEFAULT_SLICE           1000000
+
+// Longest line of a job file
+#define MAX_LINE                1024
+
+// A machine to run: an image and the keys to give it
+typedef struct {
+    char* image;
+    char* keys;             // a file, or NULL for no keys
+
+    // While running
+    x16_t* machine;
+    console_t* console;
+
+    // Results
+    bool failed;            // the machine, image or keys failed
+    x16_stop_t reason;
+    uint64_t executed;
+    uint64_t slices;
+    double seconds;
+    char* output;
+    size_t output_length;
+} job_t;
+
+// Settings shared by every job
+typedef struct {
+    engine_t engine;
+    uint64_t instructions;  // 0 for no limit
+    uint64_t slice;
+    image_cache_t* images;  // loads each image once for every job
+} batch_t;
+
+static void usage() {
+    fprintf(stderr, "Usage: x16batch [-e switch|threaded|block|jit] "
+        "[-j workers] [-n instructions]\n"
+        "                [-s slice] [-o output-dir] job-file\n");
+    exit(1);
+}
+
+// Current time in seconds
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Read a whole file. Return NULL on failure.
+static char* read_file(const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    size_t size = 4096;
+    char* data = (char*) malloc(size);
+    size_t n;
+    *length = 0;
+    while ((n = fread(data + *length, 1, size - *length, file)) > 0) {
+        *length += n;
+        if (*length == size) {
+            size *= 2;
+            data = (char*) realloc(data, size);
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+// Read the job file: a job per line, an image and an optional key file.
+// Blank lines and lines starting with # are skipped.
+static job_t* read_jobs(const char* path, size_t* count) {
+    FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+    size_t size = 64;
+    job_t* jobs = (job_t*) malloc(size * sizeof(job_t));
+    char line[MAX_LINE];
+    char image[MAX_LINE];
+    char keys[MAX_LINE];
+    *count = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        int fields = sscanf(line, "%s %s", image, keys);
+        if (fields < 1 || image[0] == '#') {
+            continue;
+        }
+        if (*count == size) {
+            size *= 2;
+            jobs = (job_t*) realloc(jobs, size * sizeof(job_t));
+        }
+        job_t* job = &jobs[(*count)++];
+        memset(job, 0, sizeof(*job));
+        job->image = strdup(image);
+        job->keys = fields == 2 ? strdup(keys) : NULL;
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    return jobs;
+}
+
+// Create the job's machine. Return false if it could not be created or
+// loaded.
+static bool start(job_t* job, batch_t* batch) {
+    char* keys = NULL;
+    size_t length = 0;
+    if (job->keys != NULL &&
+        (keys = read_file(job->keys, &length)) == NULL) {
+        return false;
+    }
+    job->machine = x16_create();
+    if (job->machine == NULL) {
+        free(keys);
+        return false;
+    }
+    job->console = console_script_create(keys != NULL ? keys : "", length);
+    free(keys);
+    x16_set_console(job->machine, job->console);
+    x16_set_input_wait(job->machine, true);
+    x16_set_idle_sleep(job->machine, false);
+    return image_cache_read(batch->images, job->machine, job->image) == 0;
+}
+
+// Keep the job's output and free its machine
+static void finish(job_t* job) {
+    if (job->machine == NULL) {
+        return;
+    }
+    x16_flush(job->machine);
+    size_t length;
+    const char* output = console_memory_output(job->console, &length);
+    job->output = (char*) malloc(length > 0 ? length : 1);
+    memcpy(job->output, output, length);
+    job->output_length = length;
+    x16_free(job->machine);
+    job->machine = NULL;
+}
+
+// Run a slice of a job. It is done when the machine stops, or when the
+// keys run out (X16_STOP_INPUT) or it used up its instructions.
+static bool run_slice(void* task, int worker, void* context) {
+    job_t* job = (job_t*) task;
+    batch_t* batch = (batch_t*) context;
+    double begin = now();
+    if (job->slices == 0 && !start(job, batch)) {
+        job->failed = true;
+        finish(job);
+        return true;
+    }
+
+    uint64_t budget = batch->slice;
+    if (batch->instructions != 0 &&
+        batch->instructions - job->executed < budget) {
+        budget = batch->instructions - job->executed;
+    }
+    uint64_t executed = 0;
+    int rv = engine_run(job->machine, batch->engine, budget, &executed);
+    job->executed += executed;
+    job->slices++;
+    job->seconds += now() - begin;
+
+    job->reason = rv == 0 ? X16_STOP_BUDGET : x16_stop_reason(job->machine);
+    bool done = rv != 0 || job->executed == batch->instructions;
+    if (done) {
+        finish(job);
+    }
+    return done;
+}
+
+static const char* reason_name(const job_t* job) {
+    if (job->failed) {
+        return "failed";
+    }
+    switch (job->reason) {
+    case X16_STOP_HALT:
+        return "halt";
+    case X16_STOP_BUDGET:
+        return "budget";
+    case X16_STOP_INPUT:
+        return "input";
+    case X16_STOP_BREAKPOINT:
+        return "breakpoint";
+    case X16_STOP_ILLEGAL:
+        return "illegal";
+    }
+    return "-";
+}
+
+// Write each job's output to output-dir/<job>.out
+static void write_outputs(const job_t* jobs, size_t count, const char* dir) {
+    char path[MAX_LINE + 32];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%zu.out", dir, i);
+        FILE* file = fopen(path, "wb");
+        if (file == NULL) {
+            perror(path);
+            exit(1);
+        }
+        fwrite(jobs[i].output, 1, jobs[i].output_length, file);
+        fclose(file);
+    }
+}
+
+// Run every job in a job file on a pool of threads, in slices so that a
+// long job does not hold up the others. Each job gets its keys from a
+// file and keeps its output in memory. A line per job goes to stdout, a
+// summary to stderr.
+int main(int argc, char** argv) {
+    int ch;
+    batch_t batch = {engine_default(), DEFAULT_INSTRUCTIONS, DEFAULT_SLICE,
+                     NULL};
+    int workers = pool_default_workers();
+    const char* output_dir = NULL;
+    while ((ch = getopt(argc, argv, "e:j:n:s:o:")) != -1) {
+        switch (ch) {
+        case 'e':
+            if (engine_parse(optarg, &batch.engine) != 0) {
+                fprintf(stderr, "Unknown engine: %s\n", optarg);
+                usage();
+            }
+            break;
+
+        case 'j':
+            workers = atoi(optarg);
+            break;
+
+        case 'n':
+            batch.instructions = strtoull(optarg, NULL, 0);
+            break;
+
+        case 's':
+            batch.slice = strtoull(optarg, NULL, 0);
+            break;
+
+        case 'o':
+            output_dir = optarg;
+            break;
+
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1 || workers < 1 || batch.slice == 0) {
+        usage();
+    }
+
+    size_t count;
+    job_t* jobs = read_jobs(argv[0], &count);
+    void** tasks = (void**) malloc((count > 0 ? count : 1) * sizeof(void*));
+    for (size_t i = 0; i < count; i++) {
+        tasks[i] = &jobs[i];
+    }
+
+    batch.images = image_cache_create(NULL);
+    pool_stats_t stats;
+    double begin = now();
+    pool_run(tasks, count, workers, run_slice, &batch, &stats);
+    double elapsed = now() - begin;
+
+    uint64_t total = 0;
+    int failed = 0;
+    printf("%-5s %-20s %-20s %-10s %12s %7s %8s %8s\n", "job", "image",
+        "keys", "stop", "instructions", "slices", "seconds", "output");
+    for (size_t i = 0; i < count; i++) {
+        job_t* job = &jobs[i];
+        printf("%-5zu %-20s %-20s %-10s %12llu %7llu %8.3f %8zu\n", i,
+            job->image, job->keys != NULL ? job->keys : "-",
+            reason_name(job), (unsigned long long) job->executed,
+            (unsigned long long) job->slices, job->seconds,
+            job->output_length);
+        total += job->executed;
+        failed += job->failed;
+    }
+    if (output_dir != NULL) {
+        write_outputs(jobs, count, output_dir);
+    }
+    image_cache_stats_t images;
+    image_cache_stats(batch.images, &images);
+    fprintf(stderr, "%zu jobs, %d failed, %llu instructions in %.3f s on "
+        "%d workers, %.2f MIPS\n%llu slices, %llu steals\n"
+        "%llu images, %llu loads shared, %llu copied\n", count, failed,
+        (unsigned long long) total, elapsed, workers,
+        total / elapsed / 1e6, (unsigned long long) stats.slices,
+        (unsigned long long) stats.steals,
+        (unsigned long long) images.images,
+        (unsigned long long) images.mapped,
+        (unsigned long long) images.copied);
+    image_cache_free(batch.images);
+
+    for (size_t i = 0; i < count; i++) {
+        free(jobs[i].image);
+        free(jobs[i].keys);
+        free(jobs[i].output);
+    }
+    free(jobs);
+    free(tasks);
+    return failed != 0 ? 2 : 0;
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "engine.h"
+#include "image.h"
+#include "instruction.h"
+#include "lockstep.h"
+#include "x16.h"
+
+// Instructions to run when -n is not given
+#define DEFAULT_INSTRUCTIONS    50000000
+
+static void usage() {
+    fprintf(stderr, "Usage: xbench [-e switch|threaded|block|jit] "
+        "[-n instructions] [-k key-file] [-L lanes]\n"
+        "              image-file|-b\n");
+    exit(1);
+}
+
+// Load a loop that does no I/O at DEFAULT_CODESTART. It keeps adding up
+// and bumping a word of memory, with every instruction but the branches
+// setting the condition codes.
+static void load_builtin(x16_t* machine) {
+    int pc = DEFAULT_CODESTART;
+    x16_memwrite(machine, pc++, emit_and_imm(R_R0, R_R0, 0));
+    x16_memwrite(machine, pc++, emit_lea(R_R2, 11));              // data
+    // outer:
+    x16_memwrite(machine, pc++, emit_and_imm(R_R1, R_R1, 0));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, 15));
+    // inner:
+    x16_memwrite(machine, pc++, emit_ldr(R_R3, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_add_reg(R_R0, R_R0, R_R3));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R3, R_R3, 1));
+    x16_memwrite(machine, pc++, emit_str(R_R3, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_not(R_R4, R_R0));
+    x16_memwrite(machine, pc++, emit_and_reg(R_R4, R_R4, R_R3));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, -1));
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -8)); // inner
+    x16_memwrite(machine, pc++, emit_br(true, true, true, -11));  // outer
+    x16_memwrite(machine, pc++, emit_value(0));                   // data
+}
+
+// Give the machine a memory console with the keys in path
+static void read_keys(x16_t* machine, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+    size_t length = 0;
+    size_t size = 4096;
+    char* keys = (char*) malloc(size);
+    size_t n;
+    while ((n = fread(keys + length, 1, size - length, file)) > 0) {
+        length += n;
+        if (length == size) {
+            size *= 2;
+            keys = (char*) realloc(keys, size);
+        }
+    }
+    fclose(file);
+    x16_set_console(machine, console_memory_create(keys, length));
+    free(keys);
+}
+
+// Current time in seconds
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Create a machine to measure
+static x16_t* create(const char* image, const char* keys) {
+    x16_t* machine = x16_create();
+    if (machine == NULL) {
+        fprintf(stderr, "Cannot create a machine\n");
+        exit(1);
+    }
+    x16_set_idle_sleep(machine, false);         // measure every poll
+    if (keys != NULL) {
+        read_keys(machine, keys);
+    }
+    if (image == NULL) {
+        load_builtin(machine);
+    } else if (read_image(machine, image) != 0) {
+        fprintf(stderr, "Failed to read image: %s\n", image);
+        exit(1);
+    }
+    return machine;
+}
+
+// Run lanes copies of the machine in lockstep and report the
+// instructions per second of all of them together
+static void run_lockstep(const char* name, const char* image,
+                         const char* keys, int lanes,
+                         uint64_t instructions) {
+    x16_t* machines[LOCKSTEP_LANES];
+    for (int i = 0; i < lanes; i++) {
+        machines[i] = create(image, keys);
+    }
+    lockstep_t* group = lockstep_create(machines, lanes);
+    x16_stop_info_t info[LOCKSTEP_LANES];
+
+    double start = now();
+    lockstep_run(group, instructions, info);
+    double elapsed = now() - start;
+
+    uint64_t executed = 0;
+    bool halted = false;
+    for (int i = 0; i < lanes; i++) {
+        x16_flush(machines[i]);
+        executed += info[i].executed;
+        halted |= info[i].reason != X16_STOP_BUDGET;
+    }
+    lockstep_stats_t stats;
+    lockstep_stats(group, &stats);
+    fprintf(stderr, "%-12s %-9s %12llu instructions %8.3f s %10.2f MIPS%s\n"
+        "%d lanes, %s, %llu steps, %llu diverged, %llu scalar\n",
+        name, "lockstep", (unsigned long long) executed, elapsed,
+        executed / elapsed / 1e6, halted ? " (halted)" : "", lanes,
+        lockstep_avx2(group) ? "avx2" : "generic",
+        (unsigned long long) stats.steps,
+        (unsigned long long) stats.diverged,
+        (unsigned long long) stats.scalar);
+
+    lockstep_free(group);
+    for (int i = 0; i < lanes; i++) {
+        x16_free(machines[i]);
+    }
+}
+
+// Run an image for a fixed number of instructions and report the
+// instructions per second to stderr. Guest output goes to stdout and
+// guest input comes from stdin, so redirect both. With -k the keys come
+// from a file and the output is kept in memory, so there is no terminal
+// or pipe. With -b a built-in loop runs instead of an image, which
+// measures the engine without host I/O. With -L that many copies run in
+// lockstep (see lockstep.h), each for the number of instructions.
+int main(int argc, char** argv) {
+    int ch;
+    engine_t engine = engine_default();
+    uint64_t instructions = DEFAULT_INSTRUCTIONS;
+    bool builtin = false;
+    const char* keys = NULL;
+    int lanes = 0;
+    while ((ch = getopt(argc, argv, "be:k:L:n:")) != -1) {
+        switch (ch) {
+        case 'b':
+            builtin = true;
+            break;
+
+        case 'e':
+            if (engine_parse(optarg, &engine) != 0) {
+                fprintf(stderr, "Unknown engine: %s\n", optarg);
+                usage();
+            }
+            break;
+
+        case 'k':
+            keys = optarg;
+            break;
+
+        case 'L':
+            lanes = atoi(optarg);
+            if (lanes < 1 || lanes > LOCKSTEP_LANES) {
+                fprintf(stderr, "Lanes must be 1 to %d\n", LOCKSTEP_LANES);
+                usage();
+            }
+            break;
+
+        case 'n':
+            instructions = strtoull(optarg, NULL, 0);
+            break;
+
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != (builtin ? 0 : 1)) {
+        usage();
+    }
+
+    const char* name = builtin ? "builtin" : argv[0];
+    const char* image = builtin ? NULL : argv[0];
+    if (lanes > 0) {
+        run_lockstep(name, image, keys, lanes, instructions);
+        return 0;
+    }
+    x16_t* machine = create(image, keys);
+
+    uint64_t executed = 0;
+    double start = now();
+    int rv = engine_run(machine, engine, instructions, &executed);
+    double elapsed = now() - start;
+    x16_flush(machine);
+
+    fprintf(stderr, "%-12s %-9s %12llu instructions %8.3f s %10.2f MIPS%s\n",
+        name, engine_name(engine), (unsigned long long) executed,
+        elapsed, executed / elapsed / 1e6, rv != 0 ? " (halted)" : "");
+
+    x16_free(machine);
+    return 0;
+}
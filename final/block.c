@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "block.h"
+#include "control.h"
+#include "instruction.h"
+#include "jit.h"
+#include "machine.h"
+#include "predecode.h"
+#include "trap.h"
+#include "x16.h"
+
+// Create an empty block cache
+block_cache_t* block_cache_create(void) {
+    block_cache_t* cache = (block_cache_t*) calloc(1, sizeof(block_cache_t));
+    return cache;
+}
+
+// Free the blocks that were invalidated
+static void reap_retired(block_cache_t* cache) {
+    while (cache->retired != NULL) {
+        block_t* block = cache->retired;
+        cache->retired = block->next;
+        free(block);
+    }
+}
+
+// Drop every translated block
+void block_cache_flush(block_cache_t* cache) {
+    for (int i = 0; i < MAX_MEMORY; i++) {
+        free(cache->blocks[i]);
+        cache->blocks[i] = NULL;
+    }
+    reap_retired(cache);
+    memset(cache->code, 0, sizeof(cache->code));
+    cache->invalidated = true;
+    jit_reset(cache->jit);
+}
+
+// Free a block cache and all of its blocks
+void block_cache_free(block_cache_t* cache) {
+    if (cache == NULL) {
+        return;
+    }
+    block_cache_flush(cache);
+    jit_free(cache->jit);
+    free(cache);
+}
+
+// Invalidate every block that contains the given address
+void block_invalidate(block_cache_t* cache, uint16_t address) {
+    // Only blocks starting at most MAX_BLOCK_LENGTH - 1 words before the
+    // address can contain it
+    for (int i = 0; i < MAX_BLOCK_LENGTH; i++) {
+        uint16_t start = address - i;
+        block_t* block = cache->blocks[start];
+        if (block != NULL && (uint16_t) (address - start) < block->length) {
+            cache->blocks[start] = NULL;
+            block->next = cache->retired;
+            cache->retired = block;
+            cache->invalidated = true;
+            cache->invalidations++;
+        }
+    }
+}
+
+// Translate one instruction into a micro-op. Return true if the
+// instruction ends the block.
+static bool translate(uop_t* op, uint16_t instruction, uint16_t next_pc) {
+    const decoded_t* d = predecoded(instruction);
+    op->dst = d->dst;
+    op->src1 = d->src1;
+    op->src2 = d->src2;
+    op->value = d->value;
+    op->next_pc = next_pc;
+
+    switch (d->opcode) {
+    case OP_ADD:
+        op->kind = d->imm ? UOP_ADD_IMM : UOP_ADD_REG;
+        return false;
+
+    case OP_AND:
+        op->kind = d->imm ? UOP_AND_IMM : UOP_AND_REG;
+        return false;
+
+    case OP_NOT:
+        op->kind = UOP_NOT;
+        return false;
+
+    case OP_LD:
+        op->kind = UOP_LD;
+        op->value = next_pc + d->value;
+        return false;
+
+    case OP_LDI:
+        op->kind = UOP_LDI;
+        op->value = next_pc + d->value;
+        return false;
+
+    case OP_LDR:
+        op->kind = UOP_LDR;
+        return false;
+
+    case OP_LEA:
+        op->kind = UOP_LEA;
+        op->value = next_pc + d->value;
+        return false;
+
+    case OP_ST:
+        op->kind = UOP_ST;
+        op->value = next_pc + d->value;
+        return false;
+
+    case OP_STI:
+        op->kind = UOP_STI;
+        op->value = next_pc + d->value;
+        return false;
+
+    case OP_STR:
+        op->kind = UOP_STR;
+        return false;
+
+    case OP_BR:
+        op->kind = UOP_BR;
+        op->src1 = d->nzp;
+        op->value = next_pc + d->value;
+        return true;
+
+    case OP_JMP:
+        op->kind = UOP_JMP;
+        return true;
+
+    case OP_JSR:
+        if (d->nzp) {
+            op->kind = UOP_JSR;
+            op->value = next_pc + d->value;
+        } else {
+            op->kind = UOP_JSRR;
+        }
+        return true;
+
+    case OP_TRAP:
+        op->kind = UOP_TRAP;
+        op->value = instruction;
+        return true;
+
+    default:
+        op->kind = UOP_ILLEGAL;
+        return true;
+    }
+}
+
+// The fused pairs
+static const struct {
+    uint8_t first;
+    uint8_t second;
+    uint8_t fused;
+} fusions[] = {
+    {UOP_ADD_IMM, UOP_BR, UOP_ADD_IMM_BR},
+    {UOP_ADD_REG, UOP_BR, UOP_ADD_REG_BR},
+    {UOP_LDI, UOP_BR, UOP_LDI_BR},
+    {UOP_LDR, UOP_ADD_REG, UOP_LDR_ADD_REG},
+    {UOP_LD, UOP_TRAP, UOP_LD_TRAP},
+};
+
+// Give the first op of every fusable pair its fused kind
+static void fuse(uop_t* ops, int length) {
+    for (int i = 0; i + 1 < length; i++) {
+        for (size_t j = 0; j < sizeof(fusions) / sizeof(fusions[0]); j++) {
+            if (ops[i].kind == fusions[j].first &&
+                ops[i + 1].kind == fusions[j].second) {
+                ops[i].kind = fusions[j].fused;
+                i++;
+                break;
+            }
+        }
+    }
+}
+
+// Build a block of at most max_length instructions starting at the given
+// address, without adding it to the cache
+block_t* block_build(x16_t* machine, uint16_t start, int max_length) {
+    uop_t ops[MAX_BLOCK_LENGTH];
+    int length = 0;
+
+    uint16_t pc = start;
+    for (;;) {
+        uint16_t instruction = machine->memory[pc];
+        bool last = translate(&ops[length], instruction, pc + 1);
+        length++;
+        pc++;
+        // Device pages are never translated
+        if (last || length == max_length || machine_is_io(machine, pc)) {
+            break;
+        }
+    }
+
+#ifndef X16_NO_FUSION
+    fuse(ops, length);
+#endif
+
+    block_t* block = (block_t*) malloc(sizeof(block_t) +
+                                       length * sizeof(uop_t));
+    block->next = NULL;
+    block->native = NULL;
+    block->hits = 0;
+    block->start = start;
+    block->length = length;
+    memcpy(block->ops, ops, length * sizeof(uop_t));
+    return block;
+}
+
+// Translate the block that starts at the given address
+block_t* block_translate(x16_t* machine, uint16_t start) {
+    block_cache_t* cache = x16_block_cache(machine);
+    block_t* block = block_build(machine, start, MAX_BLOCK_LENGTH);
+
+    for (int i = 0; i < block->length; i++) {
+        uint16_t pc = start + i;
+        cache->code[pc >> 3] |= 1 << (pc & 7);
+    }
+
+    cache->blocks[start] = block;
+    cache->translations++;
+    return block;
+}
+
+// Condition flag for a result
+#define COND_OF(result) \
+    ((result) == 0 ? FL_ZRO : (((result) & 0x8000) ? FL_NEG : FL_POS))
+
+// Memory read. Only device pages need the machine, which also gets the
+// PC so a device can tell where it is read from.
+#define MEMREAD(address)                                    \
+    (machine_is_io(machine, (address)) ?                    \
+        (machine->cpu.registers[R_PC] = op->next_pc,        \
+         machine_io_read(machine, (address))) : mem[(address)])
+
+// Copy the local register file back into the machine
+#define SYNC_OUT() do {                                     \
+        for (int i = 0; i < MAX_REGISTERS; i++) {           \
+            cpu_set(&machine->cpu, (reg_t) i, reg[i]);      \
+        }                                                   \
+    } while (0)
+
+// Reload the local register file from the machine
+#define SYNC_IN() do {                                      \
+        for (int i = 0; i < MAX_REGISTERS; i++) {           \
+            reg[i] = cpu_reg(&machine->cpu, (reg_t) i);     \
+        }                                                   \
+    } while (0)
+
+// Interpret a block starting at micro-op first
+int block_interpret(x16_t* machine, const block_t* block, int first,
+                    uint16_t* reg, int* rv) {
+    block_cache_t* cache = x16_block_cache(machine);
+    uint16_t* mem = machine->memory;
+    uint16_t address, result;
+
+    const uop_t* op = block->ops + first;
+    const uop_t* last = block->ops + block->length - 1;
+    for (;; op++) {
+        switch (op->kind) {
+        case UOP_ADD_REG:
+            result = reg[op->src1] + reg[op->src2];
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            break;
+
+        case UOP_ADD_IMM:
+            result = reg[op->src1] + op->value;
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            break;
+
+        case UOP_AND_REG:
+            result = reg[op->src1] & reg[op->src2];
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            break;
+
+        case UOP_AND_IMM:
+            result = reg[op->src1] & op->value;
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            break;
+
+        case UOP_NOT:
+            result = ~reg[op->src1];
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            break;
+
+        case UOP_LD:
+            result = MEMREAD(op->value);
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            break;
+
+        case UOP_LDI:
+            address = MEMREAD(op->value);
+            result = MEMREAD(address);
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            break;
+
+        case UOP_LDR:
+            address = reg[op->src1] + op->value;
+            result = MEMREAD(address);
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            break;
+
+        case UOP_LEA:
+            result = op->value;
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            break;
+
+        case UOP_ST:
+            x16_memwrite(machine, op->value, reg[op->dst]);
+            break;
+
+        case UOP_STI:
+            address = MEMREAD(op->value);
+            x16_memwrite(machine, address, reg[op->dst]);
+            break;
+
+        case UOP_STR:
+            address = reg[op->src1] + op->value;
+            x16_memwrite(machine, address, reg[op->dst]);
+            break;
+
+        case UOP_ADD_IMM_BR:
+            result = reg[op->src1] + op->value;
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            op++;
+            goto branch;
+
+        case UOP_ADD_REG_BR:
+            result = reg[op->src1] + reg[op->src2];
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            op++;
+            goto branch;
+
+        case UOP_LDI_BR:
+            address = MEMREAD(op->value);
+            result = MEMREAD(address);
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            op++;
+            goto branch;
+
+        case UOP_BR:
+        branch:
+            reg[R_PC] = (op->src1 & reg[R_COND]) ? op->value : op->next_pc;
+            goto done;
+
+        case UOP_LDR_ADD_REG:
+            address = reg[op->src1] + op->value;
+            reg[op->dst] = MEMREAD(address);
+            op++;
+            result = reg[op->src1] + reg[op->src2];
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            break;
+
+        case UOP_JMP:
+            reg[R_PC] = reg[op->src1];
+            goto done;
+
+        case UOP_JSR:
+            reg[R_R7] = op->next_pc;
+            reg[R_PC] = op->value;
+            goto done;
+
+        case UOP_JSRR:
+            // R7 is written first, so JSRR R7 jumps to the return address
+            reg[R_R7] = op->next_pc;
+            reg[R_PC] = reg[op->src1];
+            goto done;
+
+        case UOP_LD_TRAP:
+            result = MEMREAD(op->value);
+            reg[op->dst] = result;
+            reg[R_COND] = COND_OF(result);
+            op++;
+            // fall through
+
+        case UOP_TRAP:
+            reg[R_PC] = op->next_pc;
+            SYNC_OUT();
+            *rv = trap(machine, op->value);
+            SYNC_IN();
+            goto done;
+
+        case UOP_ILLEGAL:
+        default:
+            // RTI, which engine_run() executes, and the reserved opcode.
+            // Leave PC on the instruction.
+            reg[R_PC] = op->next_pc - 1;
+            x16_stop(machine, X16_STOP_ILLEGAL);
+            *rv = -1;
+            goto done;
+        }
+
+        // A store hit translated code, or a device that ends the run: the
+        // rest of the block may be stale, so continue from the next
+        // instruction.
+        if (op == last || cache->invalidated) {
+            reg[R_PC] = op->next_pc;
+            goto done;
+        }
+    }
+
+done:
+    return op - (block->ops + first) + 1;
+}
+
+// Run one block, natively if it has been compiled. Return the number of
+// instructions executed.
+static int run_block(x16_t* machine, block_cache_t* cache, block_t* block,
+                     bool jit, uint16_t* reg, int* rv) {
+    cache->invalidated = false;
+    if (!jit) {
+        return block_interpret(machine, block, 0, reg, rv);
+    }
+
+    if (block->native == NULL && ++block->hits >= JIT_THRESHOLD) {
+        jit_compile(machine, block);
+    }
+    if (block->native == NULL) {
+        return block_interpret(machine, block, 0, reg, rv);
+    }
+
+    // Native code stops early for traps, device reads and stores into
+    // translated code
+    int done = jit_run(machine, block, reg);
+    if (done < block->length) {
+        if (cache->invalidated) {
+            reg[R_PC] = block->ops[done - 1].next_pc;
+        } else {
+            done += block_interpret(machine, block, done, reg, rv);
+        }
+    }
+    return done;
+}
+
+// Execute instructions with translated blocks
+int block_run(x16_t* machine, uint64_t max_instructions, uint64_t* executed,
+              bool jit) {
+    block_cache_t* cache = x16_block_cache(machine);
+    uint64_t budget = max_instructions ? max_instructions : UINT64_MAX;
+    uint64_t count = 0;
+    uint16_t reg[MAX_REGISTERS];
+    int rv = 0;
+
+    SYNC_IN();
+    while (rv == 0 && count < budget && !machine->yield) {
+        // Between blocks nothing is executing, so dropped blocks and
+        // (when the code buffer filled up) the whole cache can go
+        if (jit && jit_full(machine)) {
+            block_cache_flush(cache);
+        }
+        reap_retired(cache);
+
+        uint16_t pc = reg[R_PC];
+        block_t* block = cache->blocks[pc];
+        if (block == NULL && !machine_is_io(machine, pc)) {
+            block = block_translate(machine, pc);
+        }
+
+        // Single step device addresses and the tail of the budget
+        if (block == NULL || budget - count < block->length) {
+            SYNC_OUT();
+            rv = execute_instruction(machine);
+            SYNC_IN();
+            count++;
+            continue;
+        }
+
+        count += run_block(machine, cache, block, jit, reg, &rv);
+    }
+
+    reap_retired(cache);
+    SYNC_OUT();
+    if (executed != NULL) {
+        *executed = count;
+    }
+    return rv;
+}
+
+// Execute instructions with the block engine
+int execute_blocks(x16_t* machine, uint64_t max_instructions,
+                   uint64_t* executed) {
+    return block_run(machine, max_instructions, executed, false);
+}
@@ -0,0 +1,157 @@
+#ifndef BLOCK_H_
+#define BLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "x16.h"
+
+// Longest run of instructions translated into one block
+#define MAX_BLOCK_LENGTH    64
+
+// Micro-op kinds. PC relative addresses and branch targets are resolved
+// when the block is translated.
+typedef enum {
+    UOP_ADD_REG = 0,
+    UOP_ADD_IMM,
+    UOP_AND_REG,
+    UOP_AND_IMM,
+    UOP_NOT,
+    UOP_LD,             // value is the absolute address
+    UOP_LDI,            // value is the absolute address of the pointer
+    UOP_LDR,
+    UOP_LEA,            // value is the absolute address
+    UOP_ST,             // value is the absolute address
+    UOP_STI,            // value is the absolute address of the pointer
+    UOP_STR,
+    UOP_BR,             // value is the target, src1 the condition mask
+    UOP_JMP,
+    UOP_JSR,            // value is the target
+    UOP_JSRR,
+    UOP_TRAP,           // value is the raw instruction
+    UOP_ILLEGAL,        // RTI and RES
+
+    // Fused pairs, chosen from the bigrams xgrams finds in the traces of
+    // the bundled games. The first op of a pair gets the fused kind and
+    // runs both; the second keeps its own kind, so a block can also be
+    // entered between the two.
+    UOP_ADD_IMM_BR,     // loop counters: add r1, r1, $-1 ; brp
+    UOP_ADD_REG_BR,
+    UOP_LDI_BR,         // polling a device register
+    UOP_LDR_ADD_REG,
+    UOP_LD_TRAP,        // ld r0, char ; putc
+} uop_kind_t;
+
+// The kind of the first op of a fused pair, or the kind itself
+static inline uop_kind_t uop_unfused(uint8_t kind) {
+    switch (kind) {
+    case UOP_ADD_IMM_BR:
+        return UOP_ADD_IMM;
+    case UOP_ADD_REG_BR:
+        return UOP_ADD_REG;
+    case UOP_LDI_BR:
+        return UOP_LDI;
+    case UOP_LDR_ADD_REG:
+        return UOP_LDR;
+    case UOP_LD_TRAP:
+        return UOP_LD;
+    default:
+        return (uop_kind_t) kind;
+    }
+}
+
+// A pre-decoded instruction
+typedef struct {
+    uint8_t kind;       // uop_kind_t
+    uint8_t dst;        // DR, or SR for stores
+    uint8_t src1;       // SR1 or BaseR
+    uint8_t src2;       // SR2
+    uint16_t value;     // immediate, offset or absolute address
+    uint16_t next_pc;   // address of the following instruction
+} uop_t;
+
+// A straight-line run of instructions that ends at a BR, JMP, JSR, TRAP
+// or after MAX_BLOCK_LENGTH instructions.
+typedef struct block {
+    struct block* next; // next retired block waiting to be freed
+    void* native;       // compiled code from the JIT, or NULL
+    uint32_t hits;      // times the block ran before it was compiled
+    uint16_t start;     // PC of the first instruction
+    uint16_t length;    // number of micro-ops
+    uop_t ops[];
+} block_t;
+
+// Translated blocks of one machine, indexed by start PC
+typedef struct block_cache {
+    block_t* blocks[MAX_MEMORY];
+
+    // One bit per word of memory that is part of a translated block.
+    // Bits are only cleared when the whole cache is flushed.
+    uint8_t code[MAX_MEMORY / 8];
+
+    // Set when a memory write invalidates a block, so that the block
+    // being executed can stop before running stale code.
+    bool invalidated;
+
+    // Invalidated blocks. They may still be executing, so they are only
+    // freed once the engine is between blocks.
+    block_t* retired;
+
+    // Native code for compiled blocks, NULL until the JIT first runs
+    struct jit* jit;
+
+    // Statistics
+    uint64_t translations;
+    uint64_t invalidations;
+} block_cache_t;
+
+// Create an empty block cache
+block_cache_t* block_cache_create(void);
+
+// Free a block cache and all of its blocks
+void block_cache_free(block_cache_t* cache);
+
+// Drop every translated block
+void block_cache_flush(block_cache_t* cache);
+
+// Invalidate every block that contains the given address
+void block_invalidate(block_cache_t* cache, uint16_t address);
+
+// Called for every memory write. Invalidates the blocks that hold the
+// address, if any.
+static inline void block_memwrite(block_cache_t* cache, uint16_t address) {
+    if (cache->code[address >> 3] & (1 << (address & 7))) {
+        block_invalidate(cache, address);
+    }
+}
+
+// Build a block of at most max_length instructions starting at the given
+// address, without adding it to the cache. Free it with free(). Pairs of
+// ops are fused unless built with -DX16_NO_FUSION.
+block_t* block_build(x16_t* machine, uint16_t start, int max_length);
+
+// Translate the block that starts at the given address and add it to the
+// cache of the machine
+block_t* block_translate(x16_t* machine, uint16_t start);
+
+// Interpret a block starting at micro-op first, with the register file in
+// reg. A TRAP stores its return value in rv. Return the number of
+// instructions executed.
+int block_interpret(x16_t* machine, const block_t* block, int first,
+                    uint16_t* reg, int* rv);
+
+// Execute instructions with translated blocks until HALT or until
+// max_instructions have been executed (0 means no limit), compiling hot
+// blocks to native code when jit is true. The number of instructions
+// executed is stored in executed if it is not NULL. Return -1 for HALT
+// or 0 when the budget ran out.
+int block_run(x16_t* machine, uint64_t max_instructions, uint64_t* executed,
+              bool jit);
+
+// Execute instructions with the block engine until HALT or until
+// max_instructions have been executed (0 means no limit). The number of
+// instructions executed is stored in executed if it is not NULL.
+// Return -1 for HALT or 0 when the budget ran out.
+int execute_blocks(x16_t* machine, uint64_t max_instructions,
+                   uint64_t* executed);
+
+#endif  // BLOCK_H_
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "console.h"
+#include "input.h"
+#include "output.h"
+
+// ------------------------------ TTY backend
+
+typedef struct {
+    console_t console;
+    int in_fd;
+    int out_fd;
+    input_t* input;         // NULL until the first key is wanted
+    output_t* output;       // NULL until the first write
+} tty_console_t;
+
+// Get the reader thread, starting it on first use
+static input_t* tty_input(console_t* console) {
+    tty_console_t* tty = (tty_console_t*) console;
+    if (tty->input == NULL) {
+        tty->input = input_create(tty->in_fd);
+        if (tty->input == NULL) {
+            perror("Keyboard thread");
+            abort();
+        }
+    }
+    return tty->input;
+}
+
+static int tty_poll(console_t* console) {
+    int key = input_poll(tty_input(console));
+    return key == INPUT_EMPTY ? CONSOLE_EMPTY : key;
+}
+
+static int tty_getc(console_t* console) {
+    return input_getc(tty_input(console));
+}
+
+static bool tty_ready(console_t* console) {
+    return input_ready(tty_input(console));
+}
+
+static bool tty_sleep(console_t* console, uint64_t timeout_ns) {
+    return input_sleep(tty_input(console), timeout_ns);
+}
+
+static void tty_write(console_t* console, const char* data, size_t length) {
+    tty_console_t* tty = (tty_console_t*) console;
+    if (tty->output == NULL) {
+        tty->output = output_create(tty->out_fd);
+        if (tty->output == NULL) {
+            perror("Console thread");
+            abort();
+        }
+    }
+    output_write(tty->output, data, length);
+}
+
+static void tty_flush(console_t* console) {
+    tty_console_t* tty = (tty_console_t*) console;
+    if (tty->output != NULL) {
+        output_flush(tty->output);
+    }
+}
+
+static void tty_free(console_t* console) {
+    tty_console_t* tty = (tty_console_t*) console;
+    input_free(tty->input);
+    output_free(tty->output);
+    free(tty);
+}
+
+static const console_ops_t tty_ops = {
+    tty_poll, tty_getc, tty_ready, tty_sleep, tty_write, tty_flush, tty_free,
+};
+
+// Keys from in_fd and output to out_fd
+console_t* console_tty_create(int in_fd, int out_fd) {
+    tty_console_t* tty = (tty_console_t*) calloc(1, sizeof(tty_console_t));
+    tty->console.ops = &tty_ops;
+    tty->in_fd = in_fd;
+    tty->out_fd = out_fd;
+    return &tty->console;
+}
+
+// ------------------------------ Memory backend
+
+typedef struct {
+    console_t console;
+    char* input;
+    size_t input_length;
+    size_t next;            // next key in input
+    char* output;
+    size_t output_length;
+    size_t output_size;
+} memory_console_t;
+
+static int memory_poll(console_t* console) {
+    memory_console_t* memory = (memory_console_t*) console;
+    if (memory->next == memory->input_length) {
+        return EOF;
+    }
+    return (unsigned char) memory->input[memory->next++];
+}
+
+static bool memory_ready(console_t* console) {
+    return true;
+}
+
+static bool memory_sleep(console_t* console, uint64_t timeout_ns) {
+    return true;
+}
+
+static void memory_write(console_t* console, const char* data,
+                         size_t length) {
+    memory_console_t* memory = (memory_console_t*) console;
+    if (memory->output_length + length > memory->output_size) {
+        size_t size = memory->output_size != 0 ? memory->output_size : 4096;
+        while (size < memory->output_length + length) {
+            size *= 2;
+        }
+        memory->output = (char*) realloc(memory->output, size);
+        memory->output_size = size;
+    }
+    memcpy(memory->output + memory->output_length, data, length);
+    memory->output_length += length;
+}
+
+static void memory_flush(console_t* console) {
+}
+
+static void memory_free(console_t* console) {
+    memory_console_t* memory = (memory_console_t*) console;
+    free(memory->input);
+    free(memory->output);
+    free(memory);
+}
+
+static const console_ops_t memory_ops = {
+    memory_poll, memory_poll, memory_ready, memory_sleep, memory_write,
+    memory_flush, memory_free,
+};
+
+// Keys from a copy of input, output kept in memory
+console_t* console_memory_create(const char* input, size_t length) {
+    memory_console_t* memory =
+        (memory_console_t*) calloc(1, sizeof(memory_console_t));
+    memory->console.ops = &memory_ops;
+    memory->input = (char*) malloc(length > 0 ? length : 1);
+    memcpy(memory->input, input, length);
+    memory->input_length = length;
+    return &memory->console;
+}
+
+// The output written to a memory console so far
+const char* console_memory_output(console_t* console, size_t* length) {
+    memory_console_t* memory = (memory_console_t*) console;
+    *length = memory->output_length;
+    return memory->output != NULL ? memory->output : "";
+}
+
+// ------------------------------ Script backend
+
+// A memory console whose input never ends, it only stops coming
+
+static int script_poll(console_t* console) {
+    memory_console_t* memory = (memory_console_t*) console;
+    if (memory->next == memory->input_length) {
+        return CONSOLE_EMPTY;
+    }
+    return (unsigned char) memory->input[memory->next++];
+}
+
+static bool script_ready(console_t* console) {
+    memory_console_t* memory = (memory_console_t*) console;
+    return memory->next < memory->input_length;
+}
+
+static bool script_sleep(console_t* console, uint64_t timeout_ns) {
+    return script_ready(console);
+}
+
+static const console_ops_t script_ops = {
+    script_poll, memory_poll, script_ready, script_sleep, memory_write,
+    memory_flush, memory_free,
+};
+
+// Keys from a copy of input, then none, output kept in memory
+console_t* console_script_create(const char* input, size_t length) {
+    console_t* console = console_memory_create(input, length);
+    console->ops = &script_ops;
+    return console;
+}
+
+// ------------------------------ Null backend
+
+static int null_poll(console_t* console) {
+    return EOF;
+}
+
+static bool null_ready(console_t* console) {
+    return true;
+}
+
+static bool null_sleep(console_t* console, uint64_t timeout_ns) {
+    return true;
+}
+
+static void null_write(console_t* console, const char* data, size_t length) {
+}
+
+static void null_flush(console_t* console) {
+}
+
+static void null_free(console_t* console) {
+    free(console);
+}
+
+static const console_ops_t null_ops = {
+    null_poll, null_poll, null_ready, null_sleep, null_write, null_flush,
+    null_free,
+};
+
+// No input and output thrown away
+console_t* console_null_create(void) {
+    console_t* console = (console_t*) malloc(sizeof(console_t));
+    console->ops = &null_ops;
+    return console;
+}
+
+// Free a console, writing out what it buffered
+void console_free(console_t* console) {
+    if (console != NULL) {
+        console->ops->flush(console);
+        console->ops->free(console);
+    }
+}
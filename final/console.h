@@ -0,0 +1,79 @@
+#ifndef CONSOLE_H_
+#define CONSOLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Where a machine's keyboard input comes from and its console output
+// goes. A machine uses a TTY console on stdin and stdout unless it is
+// given another one with x16_set_console().
+
+// Returned by the poll operation when no key is waiting
+#define CONSOLE_EMPTY   (-2)
+
+typedef struct console console_t;
+
+// The operations of a console backend
+typedef struct {
+    // Take the next key without blocking. Return the key, CONSOLE_EMPTY,
+    // or EOF once the input has ended.
+    int (*poll)(console_t* console);
+
+    // Take the next key, waiting for one. Return the key or EOF.
+    int (*getc)(console_t* console);
+
+    // True when poll would not return CONSOLE_EMPTY
+    bool (*ready)(console_t* console);
+
+    // Wait until ready or until timeout_ns nanoseconds have passed.
+    // Return ready.
+    bool (*sleep)(console_t* console, uint64_t timeout_ns);
+
+    // Write output. It may be buffered until flush.
+    void (*write)(console_t* console, const char* data, size_t length);
+    void (*flush)(console_t* console);
+
+    void (*free)(console_t* console);
+} console_ops_t;
+
+// A console. Backends embed this as their first member.
+struct console {
+    const console_ops_t* ops;
+};
+
+// Keys from in_fd, read ahead by a thread, and output to out_fd,
+// buffered (see input.h and output.h). Both threads start on first use.
+console_t* console_tty_create(int in_fd, int out_fd);
+
+// Keys from a copy of length bytes of input, then EOF. Output is kept in
+// memory, see console_memory_output().
+console_t* console_memory_create(const char* input, size_t length);
+
+// Keys from a copy of length bytes of input, like a memory console, but
+// then no key is ever ready instead of EOF. A machine that waits for
+// input (x16_set_input_wait) stops when the keys run out, rather than
+// reading EOF from GETC.
+console_t* console_script_create(const char* input, size_t length);
+
+// The output written to a memory or script console so far and its length
+const char* console_memory_output(console_t* console, size_t* length);
+
+// No input, every poll and read gets EOF. Output is thrown away.
+console_t* console_null_create(void);
+
+// Write a byte
+static inline void console_putc(console_t* console, char c) {
+    console->ops->write(console, &c, 1);
+}
+
+// Write length bytes
+static inline void console_write(console_t* console, const char* data,
+                                 size_t length) {
+    console->ops->write(console, data, length);
+}
+
+// Free a console, writing out what it buffered. NULL is ignored.
+void console_free(console_t* console);
+
+#endif  // CONSOLE_H_
@@ -146,8 +146,15 @@ char* decode(uint16_t instruction) {
         }
         break;
 
+    case OP_RTI:
+        if (instruction == emit_rti()) {
+            asprintf(&buf, "rti");
+        } else {
+            asprintf(&buf, "val    0x%x", (unsigned int) instruction);
+        }
+        break;
+
     // case OP_RES:
-    // case OP_RTI:
     default:
         // Consider everything else a value
         asprintf(&buf, "val    0x%x", (unsigned int) instruction);
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <string.h>
+#include "block.h"
+#include "control.h"
+#include "feature.h"
+#include "instruction.h"
+#include "jit.h"
+#include "machine.h"
+#include "engine.h"
+#include "threaded.h"
+
+// Engine names, in engine_t order
+static const char* engine_names[] = {
+    "switch",
+    "threaded",
+    "block",
+    "jit",
+};
+
+#define NUM_ENGINES (sizeof(engine_names) / sizeof(engine_names[0]))
+
+// Parse an engine name
+int engine_parse(const char* name, engine_t* engine) {
+    for (size_t i = 0; i < NUM_ENGINES; i++) {
+        if (strcmp(name, engine_names[i]) == 0) {
+            if (i == ENGINE_THREADED && !X16_HAVE_THREADED) {
+                return -1;
+            }
+            if (i == ENGINE_JIT && !X16_HAVE_JIT) {
+                return -1;
+            }
+            *engine = (engine_t) i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// The name of an engine
+const char* engine_name(engine_t engine) {
+    return engine_names[engine];
+}
+
+// The fastest interpreter in this build. The JIT is only the default
+// when it is forced on.
+engine_t engine_default(void) {
+#if defined(X16_FORCE_JIT) && X16_HAVE_JIT
+    return ENGINE_JIT;
+#endif
+    return X16_HAVE_THREADED ? ENGINE_THREADED : ENGINE_SWITCH;
+}
+
+// Name of the switch loop built for a feature set
+#define SWITCH_VARIANT(features)    SWITCH_VARIANT_(features)
+#define SWITCH_VARIANT_(features)   run_switch_##features
+
+#define FEATURES 0
+#include "switch_core.h"
+#undef FEATURES
+#define FEATURES 1
+#include "switch_core.h"
+#undef FEATURES
+#define FEATURES 2
+#include "switch_core.h"
+#undef FEATURES
+#define FEATURES 3
+#include "switch_core.h"
+#undef FEATURES
+#define FEATURES 4
+#include "switch_core.h"
+#undef FEATURES
+#define FEATURES 5
+#include "switch_core.h"
+#undef FEATURES
+#define FEATURES 6
+#include "switch_core.h"
+#undef FEATURES
+#define FEATURES 7
+#include "switch_core.h"
+#undef FEATURES
+
+// The switch loops, indexed by feature set
+static int (*const switch_variants[NUM_FEATURE_SETS])(x16_t*, uint64_t,
+                                                       uint64_t*) = {
+    run_switch_0, run_switch_1, run_switch_2, run_switch_3,
+    run_switch_4, run_switch_5, run_switch_6, run_switch_7,
+};
+
+// Run the engine once
+static int run_engine(x16_t* machine, engine_t engine,
+                      uint64_t max_instructions, uint64_t* executed) {
+    // Blocks run to their end, so instrumentation needs single stepping
+    int features = features_needed(machine);
+    if ((engine == ENGINE_BLOCK || engine == ENGINE_JIT) && features != 0) {
+        engine = ENGINE_SWITCH;
+    }
+
+    uint64_t count = 0;
+    int rv;
+    x16_stop(machine, X16_STOP_HALT);
+    switch (engine) {
+#if X16_HAVE_THREADED
+    case ENGINE_THREADED:
+        rv = execute_threaded(machine, max_instructions, &count);
+        break;
+#endif
+
+    case ENGINE_BLOCK:
+        rv = execute_blocks(machine, max_instructions, &count);
+        break;
+
+    case ENGINE_JIT:
+        rv = execute_jit(machine, max_instructions, &count);
+        break;
+
+    case ENGINE_SWITCH:
+    default:
+        rv = switch_variants[features](machine, max_instructions, &count);
+        break;
+    }
+
+    // The engines count an instruction that stopped the machine without
+    // running, as an illegal opcode or a trap waiting for input
+    x16_stop_t reason = x16_stop_reason(machine);
+    if (rv != 0 && (reason == X16_STOP_ILLEGAL || reason == X16_STOP_INPUT)) {
+        count--;
+    }
+    machine->cpu.executed += count;
+    *executed = count;
+    return rv;
+}
+
+// Execute instructions with the given engine. Once the guest uses
+// interrupts, run the engine from one event to the next (see
+// interrupt.h).
+int engine_run(x16_t* machine, engine_t engine, uint64_t max_instructions,
+               uint64_t* executed) {
+    uint64_t total = 0;
+    int rv;
+    for (;;) {
+        uint64_t budget = max_instructions != 0 ?
+            max_instructions - total : 0;
+        if (machine->interrupts != NULL) {
+            uint64_t skipped = interrupt_dispatch(machine, budget);
+            total += skipped;
+            if (max_instructions != 0 && total == max_instructions) {
+                rv = 0;
+                break;
+            }
+            budget = interrupt_budget(machine,
+                                      budget != 0 ? budget - skipped : 0);
+        }
+
+        uint64_t count;
+        rv = run_engine(machine, engine, budget, &count);
+        total += count;
+        machine->yield = false;
+        if (rv != 0) {
+            if (!interrupt_rti(machine)) {
+                break;
+            }
+            total++;
+            rv = 0;
+        }
+        // Without interrupts only the budget ends a run that did not stop
+        if (machine->interrupts == NULL ||
+            (max_instructions != 0 && total == max_instructions)) {
+            break;
+        }
+    }
+    if (executed != NULL) {
+        *executed = total;
+    }
+    return rv;
+}
@@ -0,0 +1,34 @@
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+#include <stdint.h>
+#include "x16.h"
+
+// The interpreter engines that can run a machine
+typedef enum {
+    ENGINE_SWITCH = 0,      // execute_instruction, one call per instruction
+    ENGINE_THREADED,        // direct-threaded dispatch (computed goto)
+    ENGINE_BLOCK,           // cached translated basic blocks
+    ENGINE_JIT,             // blocks, with hot ones compiled to x86-64
+} engine_t;
+
+// Parse an engine name. Return 0 on success or -1 if the name is unknown
+// or the engine is not built into this binary.
+int engine_parse(const char* name, engine_t* engine);
+
+// The name of an engine
+const char* engine_name(engine_t engine);
+
+// The engine used when none is asked for
+engine_t engine_default(void);
+
+// Execute instructions with the given engine until the machine stops or
+// until max_instructions have been executed (0 means no limit). The number
+// of instructions executed is stored in executed if it is not NULL.
+// Return -1 when the machine stopped, see x16_stop_reason(), or 0 when
+// the budget ran out. Runs that need instrumentation (see feature.h)
+// use the switch engine in place of the block engines.
+int engine_run(x16_t* machine, engine_t engine, uint64_t max_instructions,
+               uint64_t* executed);
+
+#endif  // ENGINE_H_
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+#include "event.h"
+
+// Set up an empty queue
+void event_queue_init(event_queue_t* queue) {
+    queue->events = NULL;
+    queue->count = 0;
+    queue->size = 0;
+}
+
+// Free the events of a queue
+void event_queue_free(event_queue_t* queue) {
+    free(queue->events);
+    event_queue_init(queue);
+}
+
+// Copy the events of a queue
+void event_queue_copy(event_queue_t* to, const event_queue_t* from) {
+    event_queue_init(to);
+    if (from->count == 0) {
+        return;
+    }
+    to->events = (event_t*) malloc(from->count * sizeof(event_t));
+    memcpy(to->events, from->events, from->count * sizeof(event_t));
+    to->count = from->count;
+    to->size = from->count;
+}
+
+// Move the event at i up until its parent is due no later
+static void sift_up(event_t* events, size_t i) {
+    event_t event = events[i];
+    while (i > 0 && events[(i - 1) / 2].at > event.at) {
+        events[i] = events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    events[i] = event;
+}
+
+// Move the event at i down until its children are due no earlier
+static void sift_down(event_t* events, size_t count, size_t i) {
+    event_t event = events[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && events[child + 1].at < events[child].at) {
+            child++;
+        }
+        if (events[child].at >= event.at) {
+            break;
+        }
+        events[i] = events[child];
+        i = child;
+    }
+    events[i] = event;
+}
+
+// Add an event
+void event_push(event_queue_t* queue, uint64_t at, int kind) {
+    if (queue->count == queue->size) {
+        queue->size = queue->size != 0 ? queue->size * 2 : 8;
+        queue->events = (event_t*) realloc(queue->events,
+                                           queue->size * sizeof(event_t));
+    }
+    queue->events[queue->count] = (event_t) {at, kind};
+    sift_up(queue->events, queue->count++);
+}
+
+// Remove the first event
+event_t event_pop(event_queue_t* queue) {
+    event_t first = queue->events[0];
+    queue->events[0] = queue->events[--queue->count];
+    if (queue->count > 0) {
+        sift_down(queue->events, queue->count, 0);
+    }
+    return first;
+}
+
+// Remove every event of a kind
+void event_cancel(event_queue_t* queue, int kind) {
+    size_t kept = 0;
+    for (size_t i = 0; i < queue->count; i++) {
+        if (queue->events[i].kind != kind) {
+            queue->events[kept++] = queue->events[i];
+        }
+    }
+    queue->count = kept;
+    for (size_t i = kept / 2; i-- > 0;) {
+        sift_down(queue->events, kept, i);
+    }
+}
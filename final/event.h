@@ -0,0 +1,49 @@
+#ifndef EVENT_H_
+#define EVENT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A queue of events ordered by the instruction count they are due at,
+// kept as a binary min-heap
+
+// Returned by event_next() when the queue is empty
+#define EVENT_NEVER     UINT64_MAX
+
+// An event of some kind due when the machine has executed at instructions
+typedef struct {
+    uint64_t at;
+    int kind;
+} event_t;
+
+typedef struct {
+    event_t* events;
+    size_t count;
+    size_t size;
+} event_queue_t;
+
+// Set up an empty queue
+void event_queue_init(event_queue_t* queue);
+
+// Free the events of a queue
+void event_queue_free(event_queue_t* queue);
+
+// Set up the queue to with a copy of the events of from
+void event_queue_copy(event_queue_t* to, const event_queue_t* from);
+
+// Add an event
+void event_push(event_queue_t* queue, uint64_t at, int kind);
+
+// Remove the first event, which must exist, and return it
+event_t event_pop(event_queue_t* queue);
+
+// Remove every event of a kind
+void event_cancel(event_queue_t* queue, int kind);
+
+// When the first event is due, or EVENT_NEVER
+static inline uint64_t event_next(const event_queue_t* queue) {
+    return queue->count != 0 ? queue->events[0].at : EVENT_NEVER;
+}
+
+#endif  // EVENT_H_
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include "engine.h"
+#include "governor.h"
+#include "instruction.h"
+#include "io.h"
+#include "machine.h"
+#include "x16.h"
+
+// Clock rate when -c is not given
+#define DEFAULT_RATE    1000000
+
+// Iterations of the delay loop between moves of the ball
+#define DELAY           5000
+
+static void usage() {
+    fprintf(stderr, "Usage: xfbdemo [-e switch|threaded|block|jit] "
+        "[-c rate] [-n instructions]\n");
+    exit(1);
+}
+
+// Load a program at DEFAULT_CODESTART that bounces a ball around the
+// framebuffer until a key is pressed. Only the two cells the ball leaves
+// and enters change per move.
+static void load_demo(x16_t* machine) {
+    int pc = DEFAULT_CODESTART;
+    x16_memwrite(machine, pc++, emit_ld(R_R5, 40));               // fb
+    x16_memwrite(machine, pc++, emit_and_imm(R_R1, R_R1, 0));     // col
+    x16_memwrite(machine, pc++, emit_and_imm(R_R2, R_R2, 0));     // row
+    x16_memwrite(machine, pc++, emit_and_imm(R_R3, R_R3, 0));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R3, R_R3, 1));     // dcol
+    x16_memwrite(machine, pc++, emit_and_imm(R_R4, R_R4, 0));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R4, R_R4, 1));     // drow
+    // loop: draw the ball and wait
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 34));               // ball
+    x16_memwrite(machine, pc++, emit_str(R_R0, R_R5, 0));
+    x16_memwrite(machine, pc++, emit_ld(R_R6, 34));               // delay
+    x16_memwrite(machine, pc++, emit_add_imm(R_R6, R_R6, -1));
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -2));
+    // stop on a key, else erase the ball and move it a column
+    x16_memwrite(machine, pc++, emit_ldi(R_R0, 32));              // kbsr
+    x16_memwrite(machine, pc++, emit_br(true, false, false, 26)); // done
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 28));               // space
+    x16_memwrite(machine, pc++, emit_str(R_R0, R_R5, 0));
+    x16_memwrite(machine, pc++, emit_add_reg(R_R1, R_R1, R_R3));
+    x16_memwrite(machine, pc++, emit_add_reg(R_R5, R_R5, R_R3));
+    // bounce off the first and last column
+    x16_memwrite(machine, pc++, emit_add_imm(R_R0, R_R1, 0));
+    x16_memwrite(machine, pc++, emit_br(false, true, false, 3));  // negc
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 25));               // -79
+    x16_memwrite(machine, pc++, emit_add_reg(R_R0, R_R0, R_R1));
+    x16_memwrite(machine, pc++, emit_br(true, false, true, 2));   // rows
+    // negc:
+    x16_memwrite(machine, pc++, emit_not(R_R3, R_R3));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R3, R_R3, 1));
+    // rows: move a row
+    x16_memwrite(machine, pc++, emit_add_reg(R_R2, R_R2, R_R4));
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 21));               // step
+    x16_memwrite(machine, pc++, emit_add_reg(R_R5, R_R5, R_R0));
+    // bounce off the first and last row
+    x16_memwrite(machine, pc++, emit_add_imm(R_R0, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_br(false, true, false, 3));  // negr
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 16));               // -24
+    x16_memwrite(machine, pc++, emit_add_reg(R_R0, R_R0, R_R2));
+    x16_memwrite(machine, pc++, emit_br(true, false, true, -26)); // loop
+    // negr:
+    x16_memwrite(machine, pc++, emit_not(R_R4, R_R4));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R4, R_R4, 1));
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 12));               // step
+    x16_memwrite(machine, pc++, emit_not(R_R0, R_R0));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R0, R_R0, 1));
+    x16_memwrite(machine, pc++, emit_st(R_R0, 9));                // step
+    x16_memwrite(machine, pc++, emit_br(true, true, true, -33));  // loop
+    // done:
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, emit_value(MR_FB));               // fb
+    x16_memwrite(machine, pc++, emit_value('O'));                 // ball
+    x16_memwrite(machine, pc++, emit_value(' '));                 // space
+    x16_memwrite(machine, pc++, emit_value(DELAY));               // delay
+    x16_memwrite(machine, pc++, emit_value(MR_KBSR));             // kbsr
+    x16_memwrite(machine, pc++, emit_value(1 - FB_COLS));         // -79
+    x16_memwrite(machine, pc++, emit_value(1 - FB_ROWS));         // -24
+    x16_memwrite(machine, pc++, emit_value(FB_COLS));             // step
+}
+
+// Bounce a ball around the framebuffer at a fixed clock rate until a key
+// is pressed, then report how much the renderer sent compared with
+// redrawing every cell in each frame
+int main(int argc, char** argv) {
+    int ch;
+    engine_t engine = engine_default();
+    uint64_t hz = DEFAULT_RATE;
+    uint64_t instructions = 0;
+    while ((ch = getopt(argc, argv, "e:c:n:")) != -1) {
+        switch (ch) {
+        case 'e':
+            if (engine_parse(optarg, &engine) != 0) {
+                fprintf(stderr, "Unknown engine: %s\n", optarg);
+                usage();
+            }
+            break;
+
+        case 'c':
+            if (governor_parse(optarg, &hz) != 0) {
+                fprintf(stderr, "Bad clock rate: %s\n", optarg);
+                usage();
+            }
+            break;
+
+        case 'n':
+            instructions = strtoull(optarg, NULL, 0);
+            break;
+
+        default:
+            usage();
+        }
+    }
+    if (optind != argc) {
+        usage();
+    }
+
+    x16_t* machine = x16_create();
+    if (machine == NULL) {
+        fprintf(stderr, "Cannot create a machine\n");
+        exit(1);
+    }
+    if (x16_map_framebuffer(machine) != 0) {
+        fprintf(stderr, "Cannot map the framebuffer\n");
+        exit(1);
+    }
+    load_demo(machine);
+
+    signal(SIGINT, handle_interrupt);
+    disable_input_buffering();
+    governor_t governor;
+    governor_init(&governor, hz);
+    x16_set_idle_sleep(machine, false);
+    governor_run(&governor, machine, engine, instructions, NULL);
+    restore_input_buffering();
+
+    x16_flush(machine);
+    framebuffer_stats_t stats = framebuffer_stats(machine->framebuffer);
+    x16_free(machine);
+    fprintf(stderr, "%llu frames, %llu cells, %llu bytes sent; "
+        "%llu bytes to redraw every cell\n",
+        (unsigned long long) stats.frames, (unsigned long long) stats.cells,
+        (unsigned long long) stats.bytes,
+        (unsigned long long) stats.frames * FB_ROWS * FB_COLS);
+    return 0;
+}
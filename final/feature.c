@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "decode.h"
+#include "feature.h"
+#include "x16.h"
+
+// Opcode names, in opcode_t order
+static const char* opcode_names[16] = {
+    "br", "add", "ld", "st", "jsr", "and", "ldr", "str",
+    "rti", "not", "ldi", "sti", "jmp", "res", "lea", "trap"
+};
+
+// The features a run needs
+int features_needed(x16_t* machine) {
+    int features = 0;
+    if (LOG) {
+        features |= FEATURE_TRACE;
+    }
+    if (x16_breakpoints(machine) != NULL) {
+        features |= FEATURE_BREAKPOINTS;
+    }
+    if (PROFILE) {
+        features |= FEATURE_PROFILE;
+    }
+    return features;
+}
+
+// Write one instruction to the trace
+void feature_trace(uint16_t pc, uint16_t instruction) {
+    char* text = decode(instruction);
+    fprintf(LOGFP, "0x%x: %s\n", pc, text);
+    free(text);
+}
+
+// Print the instruction counts by opcode
+void feature_print_profile(FILE* fp) {
+    uint64_t total = 0;
+    for (int i = 0; i < 16; i++) {
+        total += PROFILE_COUNTS[i];
+    }
+    fprintf(fp, "%llu instructions\n", (unsigned long long) total);
+    for (int i = 0; i < 16; i++) {
+        if (PROFILE_COUNTS[i] != 0) {
+            fprintf(fp, "%-6s %12llu %6.2f%%\n", opcode_names[i],
+                (unsigned long long) PROFILE_COUNTS[i],
+                100.0 * PROFILE_COUNTS[i] / total);
+        }
+    }
+}
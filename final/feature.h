@@ -0,0 +1,29 @@
+#ifndef FEATURE_H_
+#define FEATURE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "x16.h"
+
+// Instrumentation the interpreters can be built with. The switch and
+// threaded engines are compiled once for every combination and the
+// variant a run needs is picked when it starts, so the default run with
+// no features pays nothing for them.
+#define FEATURE_TRACE       1   // write each instruction to LOGFP (x16 -l)
+#define FEATURE_BREAKPOINTS 2   // stop at x16_breakpoints()
+#define FEATURE_PROFILE     4   // count instructions by opcode (x16 -p)
+
+// Number of feature combinations
+#define NUM_FEATURE_SETS    8
+
+// The features a run of the machine needs: tracing when LOG is set,
+// breakpoints when the machine has any, profiling when PROFILE is set
+int features_needed(x16_t* machine);
+
+// Write one instruction to the trace in LOGFP
+void feature_trace(uint16_t pc, uint16_t instruction);
+
+// Print the instructions counted in PROFILE_COUNTS
+void feature_print_profile(FILE* fp);
+
+#endif  // FEATURE_H_
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "framebuffer.h"
+#include "machine.h"
+
+// Number of cells
+#define FB_CELLS        (FB_ROWS * FB_COLS)
+
+// Unchanged cells up to this long between two changed ones are redrawn
+// rather than skipped with a cursor move, which takes more bytes
+#define FB_MAX_GAP      4
+
+struct framebuffer {
+    // The cells as the guest wrote them
+    uint16_t cells[FB_CELLS];
+
+    // The characters on the terminal, valid once started is set
+    char shown[FB_CELLS];
+    bool started;
+
+    // Rows with a cell that may differ from shown
+    bool dirty_row[FB_ROWS];
+    bool dirty;
+
+    // Time of the last frame and writes since the last check for one
+    uint64_t last_frame_ns;
+    unsigned writes;
+
+    framebuffer_stats_t stats;
+
+    // A frame being put together, at most every cell with a cursor move
+    char frame[FB_CELLS * 10 + 16];
+};
+
+// The monotonic clock in nanoseconds
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// The character a cell shows
+static char glyph(uint16_t cell) {
+    char c = (char) (cell & 0xff);
+    return c >= ' ' && c < 127 ? c : ' ';
+}
+
+// Read a cell
+static uint16_t fb_read(x16_t* machine, void* device, uint16_t address) {
+    framebuffer_t* fb = (framebuffer_t*) device;
+    uint16_t index = address - MR_FB;
+    return index < FB_CELLS ? fb->cells[index] : 0;
+}
+
+// Write a cell
+static void fb_write(x16_t* machine, void* device, uint16_t address,
+                     uint16_t val) {
+    framebuffer_t* fb = (framebuffer_t*) device;
+    uint16_t index = address - MR_FB;
+    if (index >= FB_CELLS || fb->cells[index] == val) {
+        return;
+    }
+    fb->cells[index] = val;
+    fb->dirty_row[index / FB_COLS] = true;
+    fb->dirty = true;
+
+    // A guest that draws without ever looking for input still gets frames
+    if (++fb->writes == FB_CHECK_WRITES) {
+        fb->writes = 0;
+        framebuffer_render(fb, machine_console(machine), false);
+    }
+}
+
+// Map a framebuffer into the machine
+framebuffer_t* framebuffer_create(x16_t* machine) {
+    for (int page = 0; page < FB_PAGES; page++) {
+        if (machine->io_page[FB_PAGE + page] != 0) {
+            return NULL;
+        }
+    }
+    framebuffer_t* fb = (framebuffer_t*) calloc(1, sizeof(framebuffer_t));
+    for (int page = 0; page < FB_PAGES; page++) {
+        if (x16_map_device(machine, FB_PAGE + page, fb_read, fb_write,
+                           fb) != 0) {
+            // The pages mapped so far still point at fb
+            abort();
+        }
+    }
+    return fb;
+}
+
+// Leave the cursor below the frame and free the framebuffer
+void framebuffer_free(framebuffer_t* fb, console_t* console) {
+    if (fb == NULL) {
+        return;
+    }
+    if (fb->started && console != NULL) {
+        char text[32];
+        int n = snprintf(text, sizeof(text), "\x1b[%d;1H\x1b[?25h",
+                         FB_ROWS + 1);
+        console_write(console, text, n);
+    }
+    free(fb);
+}
+
+// Draw the changed cells to output
+void framebuffer_render(framebuffer_t* fb, console_t* console,
+                        bool force) {
+    if (!fb->dirty) {
+        return;
+    }
+    uint64_t now = now_ns();
+    if (!force && now - fb->last_frame_ns < 1000000000 / FB_FPS) {
+        return;
+    }
+    fb->last_frame_ns = now;
+    fb->dirty = false;
+    fb->stats.frames++;
+
+    char* frame = fb->frame;
+    size_t n = 0;
+    if (!fb->started) {
+        // Clear the screen and hide the cursor
+        memcpy(frame, "\x1b[2J\x1b[?25l", 10);
+        n = 10;
+        memset(fb->shown, ' ', sizeof(fb->shown));
+        fb->started = true;
+    }
+
+    for (int row = 0; row < FB_ROWS; row++) {
+        if (!fb->dirty_row[row]) {
+            continue;
+        }
+        fb->dirty_row[row] = false;
+        const uint16_t* cells = &fb->cells[row * FB_COLS];
+        char* shown = &fb->shown[row * FB_COLS];
+
+        // Column the cursor is at, or -1 when it is not on this row
+        int at = -1;
+        for (int col = 0; col < FB_COLS; col++) {
+            char c = glyph(cells[col]);
+            if (c == shown[col]) {
+                continue;
+            }
+            if (at >= 0 && col > at && col - at <= FB_MAX_GAP) {
+                // Redraw the short run of unchanged cells
+                while (at < col) {
+                    frame[n++] = shown[at++];
+                }
+            } else if (at != col) {
+                n += snprintf(frame + n, sizeof(fb->frame) - n,
+                              "\x1b[%d;%dH", row + 1, col + 1);
+            }
+            frame[n++] = c;
+            shown[col] = c;
+            at = col + 1;
+            fb->stats.cells++;
+        }
+    }
+    fb->stats.bytes += n;
+    console_write(console, frame, n);
+}
+
+// What the renderer sent so far
+framebuffer_stats_t framebuffer_stats(framebuffer_t* fb) {
+    return fb->stats;
+}
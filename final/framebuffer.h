@@ -0,0 +1,43 @@
+#ifndef FRAMEBUFFER_H_
+#define FRAMEBUFFER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "console.h"
+#include "x16.h"
+
+// The character cell framebuffer device at MR_FB. Writes only record the
+// cell and mark its row dirty. framebuffer_render() compares dirty rows
+// with what the terminal shows and sends cursor moves and the changed
+// characters.
+
+// Most frames drawn per second
+#define FB_FPS              30
+
+// Writes between checks of whether a frame is due
+#define FB_CHECK_WRITES     256
+
+// What the renderer sent
+typedef struct {
+    uint64_t frames;        // frames drawn
+    uint64_t cells;         // cells drawn
+    uint64_t bytes;         // bytes sent to the terminal
+} framebuffer_stats_t;
+
+typedef struct framebuffer framebuffer_t;
+
+// Map a framebuffer into the machine. Return NULL if the pages are taken.
+framebuffer_t* framebuffer_create(x16_t* machine);
+
+// Leave the cursor below the frame on console, if it is not NULL, and
+// free the framebuffer
+void framebuffer_free(framebuffer_t* fb, console_t* console);
+
+// Draw the changed cells to console. Unless force is set, only draw if
+// 1 / FB_FPS seconds have passed since the last frame.
+void framebuffer_render(framebuffer_t* fb, console_t* console, bool force);
+
+// What the renderer sent so far
+framebuffer_stats_t framebuffer_stats(framebuffer_t* fb);
+
+#endif  // FRAMEBUFFER_H_
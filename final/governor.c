@@ -0,0 +1,158 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <time.h>
+#include "governor.h"
+
+// The monotonic clock in nanoseconds
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Parse a clock rate
+int governor_parse(const char* text, uint64_t* hz) {
+    char* end;
+    double value = strtod(text, &end);
+    if (end == text || !(value > 0)) {
+        return -1;
+    }
+    while (isspace((unsigned char) *end)) {
+        end++;
+    }
+
+    double scale = 1;
+    switch (tolower((unsigned char) *end)) {
+    case 'k':
+        scale = 1e3;
+        end++;
+        break;
+    case 'm':
+        scale = 1e6;
+        end++;
+        break;
+    case 'g':
+        scale = 1e9;
+        end++;
+        break;
+    }
+    if (*end != '\0' && strcasecmp(end, "hz") != 0) {
+        return -1;
+    }
+    value *= scale;
+    if (value < 1 || value > 1e9) {
+        return -1;
+    }
+    *hz = (uint64_t) value;
+    return 0;
+}
+
+// Set up a governor for hz instructions per second
+void governor_init(governor_t* governor, uint64_t hz) {
+    governor->hz = hz;
+    governor->batch = hz / (1000000000 / GOVERNOR_SLICE_NS);
+    if (governor->batch == 0) {
+        governor->batch = 1;
+    }
+    governor->start_ns = 0;
+    governor->scheduled = 0;
+    governor->stats = (governor_stats_t) {0};
+}
+
+// Wait for the deadline of the instructions run so far on the schedule
+static void pace(governor_t* governor) {
+    governor_stats_t* stats = &governor->stats;
+    uint64_t hz = governor->hz;
+    uint64_t scheduled = governor->scheduled;
+    uint64_t deadline = governor->start_ns +
+        scheduled / hz * 1000000000 + scheduled % hz * 1000000000 / hz;
+
+    uint64_t now = now_ns();
+    if (now > deadline) {
+        stats->late++;
+        if (now - deadline > GOVERNOR_MAX_LAG_NS) {
+            stats->resyncs++;
+            governor->start_ns = now;
+            governor->scheduled = 0;
+            return;
+        }
+    } else {
+        if (deadline - now > GOVERNOR_SPIN_NS) {
+            uint64_t wake = deadline - GOVERNOR_SPIN_NS;
+            struct timespec ts = {
+                (time_t) (wake / 1000000000), (long) (wake % 1000000000)
+            };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            uint64_t woke = now_ns();
+            stats->sleep_ns += woke - now;
+            now = woke;
+        }
+        uint64_t spun = now;
+        while (now < deadline) {
+            now = now_ns();
+        }
+        stats->spin_ns += now - spun;
+    }
+
+    uint64_t drift = now - deadline;
+    stats->paced++;
+    stats->drift_ns += drift;
+    if (drift > stats->drift_max_ns) {
+        stats->drift_max_ns = drift;
+    }
+}
+
+// Run the machine paced to the governor's rate
+int governor_run(governor_t* governor, x16_t* machine, engine_t engine,
+                 uint64_t max_instructions, uint64_t* executed) {
+    governor_stats_t* stats = &governor->stats;
+    uint64_t start = now_ns();
+    uint64_t total = 0;
+    int rv = 0;
+    governor->start_ns = start;
+    governor->scheduled = 0;
+
+    for (;;) {
+        uint64_t batch = governor->batch;
+        if (max_instructions != 0 && max_instructions - total < batch) {
+            batch = max_instructions - total;
+        }
+        uint64_t count;
+        rv = engine_run(machine, engine, batch, &count);
+        total += count;
+        governor->scheduled += count;
+        stats->batches++;
+        if (rv != 0 || total == max_instructions) {
+            break;
+        }
+        pace(governor);
+    }
+
+    stats->executed += total;
+    stats->elapsed_ns += now_ns() - start;
+    if (executed != NULL) {
+        *executed = total;
+    }
+    return rv;
+}
+
+// Print the rate achieved and the drift from the schedule
+void governor_print(const governor_t* governor, FILE* fp) {
+    const governor_stats_t* stats = &governor->stats;
+    double elapsed = stats->elapsed_ns / 1e9;
+    fprintf(fp, "%llu instructions in %.3f s, %.0f Hz (target %llu Hz)\n",
+        (unsigned long long) stats->executed, elapsed,
+        elapsed > 0 ? stats->executed / elapsed : 0.0,
+        (unsigned long long) governor->hz);
+    fprintf(fp, "%llu batches of %llu, %llu late, %llu resynced\n",
+        (unsigned long long) stats->batches,
+        (unsigned long long) governor->batch,
+        (unsigned long long) stats->late,
+        (unsigned long long) stats->resyncs);
+    fprintf(fp, "drift mean %.1f us, max %.1f us\n",
+        stats->paced > 0 ? stats->drift_ns / 1e3 / stats->paced : 0.0,
+        stats->drift_max_ns / 1e3);
+    fprintf(fp, "slept %.3f s, spun %.3f s\n",
+        stats->sleep_ns / 1e9, stats->spin_ns / 1e9);
+}
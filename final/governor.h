@@ -0,0 +1,63 @@
+#ifndef GOVERNOR_H_
+#define GOVERNOR_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "engine.h"
+#include "x16.h"
+
+// Runs a machine at a fixed emulated clock rate (x16 -c). Instructions
+// run in batches of one time slice each. After a batch the governor
+// sleeps until shortly before the batch's deadline and spins the rest of
+// the way, since a sleep alone can overshoot by a scheduler tick.
+
+// Nanoseconds of emulated time per batch
+#define GOVERNOR_SLICE_NS   1000000
+
+// The last stretch before a deadline is spun rather than slept
+#define GOVERNOR_SPIN_NS    100000
+
+// A run this far behind its schedule, such as one blocked on GETC,
+// starts a new schedule instead of running flat out to catch up
+#define GOVERNOR_MAX_LAG_NS 50000000
+
+// What the governor measured
+typedef struct {
+    uint64_t executed;      // instructions run
+    uint64_t batches;       // batches run
+    uint64_t late;          // batches that ended after their deadline
+    uint64_t resyncs;       // schedules dropped after a stall
+    uint64_t paced;         // batches followed by a wait for the deadline
+    uint64_t elapsed_ns;    // wall time of the runs
+    uint64_t sleep_ns;      // time slept pacing
+    uint64_t spin_ns;       // time spun pacing
+    uint64_t drift_ns;      // sum of |start of batch - its deadline|
+    uint64_t drift_max_ns;  // largest of them
+} governor_stats_t;
+
+// A clock rate governor
+typedef struct {
+    uint64_t hz;            // emulated instructions per second
+    uint64_t batch;         // instructions per batch
+    uint64_t start_ns;      // start of the current schedule
+    uint64_t scheduled;     // instructions run on the current schedule
+    governor_stats_t stats;
+} governor_t;
+
+// Parse a clock rate such as "2MHz", "500kHz", "1.5M" or "800000", up to
+// 1GHz. Return 0 and store the rate in hz, or -1 if the text is not a
+// rate.
+int governor_parse(const char* text, uint64_t* hz);
+
+// Set up a governor for hz instructions per second
+void governor_init(governor_t* governor, uint64_t hz);
+
+// Run the machine like engine_run(), paced to the governor's rate. The
+// schedule starts when the call does.
+int governor_run(governor_t* governor, x16_t* machine, engine_t engine,
+                 uint64_t max_instructions, uint64_t* executed);
+
+// Print the rate achieved and the drift from the schedule
+void governor_print(const governor_t* governor, FILE* fp);
+
+#endif  // GOVERNOR_H_
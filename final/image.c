@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include "image.h"
+#include "x16.h"
+
+
+// Read Image File. Return 0 on success or -1 for failure
+int read_image_file(x16_t* machine, FILE* fp) {
+    // The origin tells us where in memory to place the image
+    uint16_t origin;
+    if (fread(&origin, sizeof(origin), 1, fp) <= 0) {
+        return -1;
+    }
+    // Swap to host format
+    origin = ntohs(origin);
+
+    // we know the maximum file size so we only need one fread
+    uint16_t max_read = UINT16_MAX - origin;
+    uint16_t* p = x16_memory(machine, origin);
+    size_t read = fread(p, sizeof(uint16_t), max_read, fp);
+    if (read <= 0) {
+        return -1;    // nothing read, or some error in fread
+    }
+
+    // swap each 16 bit value to host format
+    while (read-- > 0) {
+        *p = ntohs(*p);
+        ++p;
+    }
+
+    return 0;
+}
+
+// Read Image into memory. Return 0 on success or -1 for failure.
+int read_image(x16_t* machine, const char* image_path) {
+    FILE* fp = fopen(image_path, "rb");
+    if (fp == NULL) {
+        return -1;
+    }
+    int rv = read_image_file(machine, fp);
+    fclose(fp);
+    return rv;
+}
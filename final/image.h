@@ -0,0 +1,16 @@
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include <stdio.h>
+#include "x16.h"
+
+// Read an image file into memory. The file starts with the big endian
+// origin, followed by big endian words that are placed at the origin.
+// Return 0 on success or -1 for failure
+int read_image_file(x16_t* machine, FILE* fp);
+
+// Read the image at the given path into memory. Return 0 on success or
+// -1 for failure.
+int read_image(x16_t* machine, const char* image_path);
+
+#endif  // IMAGE_H_
@@ -0,0 +1,283 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "block.h"
+#include "image_cache.h"
+#include "machine.h"
+#include "x16.h"
+
+// An image read into the cache
+typedef struct image_entry {
+    struct image_entry* next;
+    uint64_t hash;
+    uint8_t* data;              // the image file
+    size_t length;
+
+    uint16_t origin;
+    uint32_t count;             // words of the image
+    uint32_t start;             // first word of the file, on a host page
+    uint32_t words;             // words in the file
+    int fd;                     // the file, or -1 if it could not be made
+} image_entry_t;
+
+struct image_cache {
+    pthread_mutex_t lock;
+    char* dir;
+    image_entry_t* entries;
+    image_cache_stats_t stats;
+};
+
+// Create a cache, with files in dir or unlinked if it is NULL
+image_cache_t* image_cache_create(const char* dir) {
+    image_cache_t* cache = (image_cache_t*) calloc(1, sizeof(image_cache_t));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->dir = dir != NULL ? strdup(dir) : NULL;
+    return cache;
+}
+
+// Free a cache and close its files
+void image_cache_free(image_cache_t* cache) {
+    if (cache == NULL) {
+        return;
+    }
+    while (cache->entries != NULL) {
+        image_entry_t* entry = cache->entries;
+        cache->entries = entry->next;
+        if (entry->fd >= 0) {
+            close(entry->fd);
+        }
+        free(entry->data);
+        free(entry);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->dir);
+    free(cache);
+}
+
+// Read a whole file. Return NULL on failure.
+static uint8_t* read_file(const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    size_t size = 4096;
+    uint8_t* data = (uint8_t*) malloc(size);
+    size_t n;
+    *length = 0;
+    while ((n = fread(data + *length, 1, size - *length, file)) > 0) {
+        *length += n;
+        if (*length == size) {
+            size *= 2;
+            data = (uint8_t*) realloc(data, size);
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+// FNV-1a
+static uint64_t hash_bytes(const uint8_t* data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Word i of the image, in host format
+static uint16_t image_word(const image_entry_t* entry, uint32_t i) {
+    const uint8_t* p = entry->data + 2 + i * 2;
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+// Write the file of an entry: the host pages the image covers, zero but
+// for the image. Return the file, or -1.
+static int make_file(image_cache_t* cache, const image_entry_t* entry) {
+    char path[4096];
+    char temp[4096];
+    if (cache->dir != NULL) {
+        snprintf(path, sizeof(path), "%s/%016" PRIx64 ".mem", cache->dir,
+                 entry->hash);
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 &&
+            st.st_size == (off_t) entry->words * 2) {
+            return fd;                  // made by another process
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        snprintf(temp, sizeof(temp), "%s/.image-XXXXXX", cache->dir);
+    } else {
+        const char* dir = getenv("TMPDIR");
+        snprintf(temp, sizeof(temp), "%s/x16-image-XXXXXX",
+                 dir != NULL ? dir : "/tmp");
+    }
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+        return -1;
+    }
+    if (cache->dir != NULL) {
+        fchmod(fd, 0644);               // for every user of the directory
+    }
+
+    uint16_t* words = (uint16_t*) calloc(entry->words, sizeof(uint16_t));
+    for (uint32_t i = 0; i < entry->count; i++) {
+        words[entry->origin - entry->start + i] = image_word(entry, i);
+    }
+    size_t bytes = entry->words * sizeof(uint16_t);
+    bool written = write(fd, words, bytes) == (ssize_t) bytes;
+    free(words);
+
+    // A file in the directory only appears once it is whole
+    if (!written || (cache->dir != NULL ? rename(temp, path) : unlink(temp))
+        != 0) {
+        unlink(temp);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Find the entry for an image, reading it into the cache if it is new.
+// Takes data. Return NULL if it is not an image.
+static image_entry_t* find(image_cache_t* cache, uint8_t* data,
+                           size_t length) {
+    uint64_t hash = hash_bytes(data, length);
+    pthread_mutex_lock(&cache->lock);
+    image_entry_t* entry;
+    for (entry = cache->entries; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->data, data, length) == 0) {
+            free(data);
+            pthread_mutex_unlock(&cache->lock);
+            return entry;
+        }
+    }
+
+    // The origin, then as many words as fit below the top of memory, as
+    // read_image_file() takes them
+    uint32_t count = length >= 2 ? (length - 2) / 2 : 0;
+    uint16_t origin = length >= 2 ? (uint16_t) (data[0] << 8 | data[1]) : 0;
+    if (count > (uint32_t) (UINT16_MAX - origin)) {
+        count = UINT16_MAX - origin;
+    }
+    if (count == 0) {
+        free(data);
+        pthread_mutex_unlock(&cache->lock);
+        return NULL;
+    }
+
+    uint32_t page_words = sysconf(_SC_PAGESIZE) / sizeof(uint16_t);
+    entry = (image_entry_t*) calloc(1, sizeof(image_entry_t));
+    entry->hash = hash;
+    entry->data = data;
+    entry->length = length;
+    entry->origin = origin;
+    entry->count = count;
+    entry->start = origin / page_words * page_words;
+    entry->words = (origin + count + page_words - 1) / page_words *
+        page_words - entry->start;
+    entry->fd = make_file(cache, entry);
+    entry->next = cache->entries;
+    cache->entries = entry;
+    cache->stats.images++;
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+// Map the file of an entry over the machine's memory. Return false if
+// the pages hold devices or words the file does not.
+static bool map(x16_t* machine, const image_entry_t* entry) {
+    if (entry->fd < 0) {
+        return false;
+    }
+    uint32_t end = entry->start + entry->words;
+    for (uint32_t address = entry->start; address < end;
+         address += MEM_PAGE_SIZE) {
+        if (machine_is_io(machine, address)) {
+            return false;
+        }
+    }
+    for (uint32_t address = entry->start; address < end; address++) {
+        bool image = address >= entry->origin &&
+            address < entry->origin + entry->count;
+        if (!image && machine->memory[address] != 0) {
+            return false;
+        }
+    }
+
+    uint16_t* memory = machine->memory + entry->start;
+    size_t bytes = entry->words * sizeof(uint16_t);
+    if (mmap(memory, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, entry->fd, 0) == MAP_FAILED) {
+        // The old pages may be gone. The rest of them were zero.
+        if (mmap(memory, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) ==
+            MAP_FAILED) {
+            abort();
+        }
+        return false;
+    }
+
+    // Tell snapshots and translated blocks the memory changed
+    for (uint32_t address = entry->start; address < end; address++) {
+        machine->dirty[address >> MEM_PAGE_SHIFT] = 1;
+        if (machine->blocks != NULL) {
+            block_memwrite(machine->blocks, address);
+        }
+    }
+    return true;
+}
+
+// Read an image into memory, sharing its pages when it can
+int image_cache_read(image_cache_t* cache, x16_t* machine,
+                     const char* image_path) {
+    size_t length;
+    uint8_t* data = read_file(image_path, &length);
+    if (data == NULL) {
+        return -1;
+    }
+    image_entry_t* entry = find(cache, data, length);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    bool mapped = map(machine, entry);
+    // Copy the image if it could not be mapped, or if a file in the
+    // directory does not hold it
+    for (uint32_t i = 0; i < entry->count; i++) {
+        uint16_t address = entry->origin + i;
+        uint16_t word = image_word(entry, i);
+        if (machine->memory[address] != word) {
+            machine->memory[address] = word;
+            machine->dirty[address >> MEM_PAGE_SHIFT] = 1;
+            if (machine->blocks != NULL) {
+                block_memwrite(machine->blocks, address);
+            }
+            mapped = false;
+        }
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (mapped) {
+        cache->stats.mapped++;
+    } else {
+        cache->stats.copied++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
+
+// The counts of a cache
+void image_cache_stats(image_cache_t* cache, image_cache_stats_t* stats) {
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
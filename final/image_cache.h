@@ -0,0 +1,43 @@
+#ifndef IMAGE_CACHE_H_
+#define IMAGE_CACHE_H_
+
+#include <stdint.h>
+#include "x16.h"
+
+// A cache of images that machines share. Each image is read once, keyed
+// by a hash of its contents, and laid out in a file the size of the host
+// pages it covers. Machines that load it map that file over their memory
+// privately, so they share those pages with every other machine running
+// the image until they write to one and get their own copy of it.
+//
+// A machine gets a copy of the image as read_image() would give instead
+// when the image shares a host page with a device, or with words the
+// machine has already written, or when the file cannot be made.
+
+typedef struct image_cache image_cache_t;
+
+// What a cache did
+typedef struct {
+    uint64_t images;            // different images read
+    uint64_t mapped;            // loads that mapped shared pages
+    uint64_t copied;            // loads that copied the image
+} image_cache_stats_t;
+
+// Create a cache. With a directory the files are kept there and shared
+// with every process using the same directory; with NULL they are
+// unlinked temporary files shared within this process. Safe to use from
+// many threads.
+image_cache_t* image_cache_create(const char* dir);
+
+// Free a cache. Machines that mapped its images keep them.
+void image_cache_free(image_cache_t* cache);
+
+// Read the image at the given path into memory, as read_image() does.
+// Return 0 on success or -1 for failure.
+int image_cache_read(image_cache_t* cache, x16_t* machine,
+                     const char* image_path);
+
+// The counts of a cache
+void image_cache_stats(image_cache_t* cache, image_cache_stats_t* stats);
+
+#endif  // IMAGE_CACHE_H_
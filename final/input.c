@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "input.h"
+
+// Size of the ring, a power of two
+#define INPUT_RING_SIZE     1024
+
+// A full ring is refilled once this much of it is free, so piped input
+// does not wake the thread for every key
+#define INPUT_REFILL        (INPUT_RING_SIZE / 2)
+
+struct input {
+    int fd;
+
+    // Written to make the thread leave poll() and exit
+    int wake[2];
+    pthread_t thread;
+    atomic_bool stop;
+
+    // The ring. head is only written by the consumer and tail only by the
+    // thread; both count up and wrap at 2^32.
+    uint8_t ring[INPUT_RING_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_bool eof;
+
+    // Slow paths: the consumer waits for a key in input_getc(), the
+    // thread waits for INPUT_REFILL bytes of room when the ring is full.
+    // The waiting flags let the other side skip the lock when nobody
+    // waits.
+    pthread_mutex_t lock;
+    pthread_cond_t data;
+    pthread_cond_t space;
+    atomic_bool consumer_waiting;
+    atomic_bool producer_waiting;
+};
+
+// Wake the side waiting on cond, if it is waiting
+static void notify(input_t* input, atomic_bool* waiting,
+                   pthread_cond_t* cond) {
+    if (atomic_load(waiting)) {
+        pthread_mutex_lock(&input->lock);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&input->lock);
+    }
+}
+
+// Wait until the ring has room. Return false when the reader is stopping.
+static bool wait_for_space(input_t* input) {
+    pthread_mutex_lock(&input->lock);
+    atomic_store(&input->producer_waiting, true);
+    while (!atomic_load(&input->stop) &&
+           atomic_load(&input->tail) - atomic_load(&input->head) >
+           INPUT_RING_SIZE - INPUT_REFILL) {
+        pthread_cond_wait(&input->space, &input->lock);
+    }
+    atomic_store(&input->producer_waiting, false);
+    pthread_mutex_unlock(&input->lock);
+    return !atomic_load(&input->stop);
+}
+
+// The reader thread
+static void* reader(void* arg) {
+    input_t* input = (input_t*) arg;
+    struct pollfd fds[2] = {
+        {input->fd, POLLIN, 0},
+        {input->wake[0], POLLIN, 0},
+    };
+
+    while (!atomic_load(&input->stop)) {
+        if (poll(fds, 2, -1) < 0 || fds[1].revents != 0) {
+            break;
+        }
+        if (fds[0].revents == 0) {
+            continue;
+        }
+
+        unsigned tail = atomic_load_explicit(&input->tail,
+                                             memory_order_relaxed);
+        unsigned room = INPUT_RING_SIZE - (tail - atomic_load(&input->head));
+        if (room == 0) {
+            if (!wait_for_space(input)) {
+                break;
+            }
+            continue;
+        }
+
+        // Read into the free part of the ring up to its end
+        unsigned at = tail % INPUT_RING_SIZE;
+        unsigned count = INPUT_RING_SIZE - at < room ?
+            INPUT_RING_SIZE - at : room;
+        ssize_t n = read(input->fd, &input->ring[at], count);
+        if (n <= 0) {
+            atomic_store(&input->eof, true);
+            notify(input, &input->consumer_waiting, &input->data);
+            break;
+        }
+        atomic_store(&input->tail, tail + (unsigned) n);
+        notify(input, &input->consumer_waiting, &input->data);
+    }
+    return NULL;
+}
+
+// Start reading fd on a new thread
+input_t* input_create(int fd) {
+    input_t* input = (input_t*) calloc(1, sizeof(input_t));
+    input->fd = fd;
+    if (pipe(input->wake) != 0) {
+        free(input);
+        return NULL;
+    }
+    pthread_mutex_init(&input->lock, NULL);
+    pthread_cond_init(&input->data, NULL);
+    pthread_cond_init(&input->space, NULL);
+
+    // Signals such as SIGINT go to the emulator thread, not the reader
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rv = pthread_create(&input->thread, NULL, reader, input);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rv != 0) {
+        close(input->wake[0]);
+        close(input->wake[1]);
+        free(input);
+        return NULL;
+    }
+    return input;
+}
+
+// Stop the thread and free the reader
+void input_free(input_t* input) {
+    if (input == NULL) {
+        return;
+    }
+    atomic_store(&input->stop, true);
+    if (write(input->wake[1], "", 1) != 1) {
+        perror("input");
+    }
+    pthread_mutex_lock(&input->lock);
+    pthread_cond_signal(&input->space);
+    pthread_mutex_unlock(&input->lock);
+    pthread_join(input->thread, NULL);
+
+    close(input->wake[0]);
+    close(input->wake[1]);
+    pthread_mutex_destroy(&input->lock);
+    pthread_cond_destroy(&input->data);
+    pthread_cond_destroy(&input->space);
+    free(input);
+}
+
+// Take the next key without blocking
+int input_poll(input_t* input) {
+    unsigned head = atomic_load_explicit(&input->head, memory_order_relaxed);
+    if (head == atomic_load(&input->tail)) {
+        return atomic_load(&input->eof) &&
+            head == atomic_load(&input->tail) ? EOF : INPUT_EMPTY;
+    }
+    int key = input->ring[head % INPUT_RING_SIZE];
+    atomic_store(&input->head, head + 1);
+    if (atomic_load(&input->tail) - (head + 1) ==
+        INPUT_RING_SIZE - INPUT_REFILL) {
+        notify(input, &input->producer_waiting, &input->space);
+    }
+    return key;
+}
+
+// Take the next key, waiting for one
+int input_getc(input_t* input) {
+    int key = input_poll(input);
+    if (key != INPUT_EMPTY) {
+        return key;
+    }
+    pthread_mutex_lock(&input->lock);
+    atomic_store(&input->consumer_waiting, true);
+    while (atomic_load(&input->head) == atomic_load(&input->tail) &&
+           !atomic_load(&input->eof)) {
+        pthread_cond_wait(&input->data, &input->lock);
+    }
+    atomic_store(&input->consumer_waiting, false);
+    pthread_mutex_unlock(&input->lock);
+    return input_poll(input);
+}
+
+// True when a key or the end of input is waiting
+bool input_ready(input_t* input) {
+    return atomic_load(&input->head) != atomic_load(&input->tail) ||
+        atomic_load(&input->eof);
+}
+
+// Wait until a key or the end of input is waiting, or the timeout passes
+bool input_sleep(input_t* input, uint64_t timeout_ns) {
+    if (input_ready(input)) {
+        return true;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t ns = deadline.tv_nsec + timeout_ns;
+    deadline.tv_sec += ns / 1000000000;
+    deadline.tv_nsec = ns % 1000000000;
+
+    pthread_mutex_lock(&input->lock);
+    atomic_store(&input->consumer_waiting, true);
+    while (!input_ready(input) &&
+           pthread_cond_timedwait(&input->data, &input->lock,
+                                  &deadline) == 0) {
+    }
+    atomic_store(&input->consumer_waiting, false);
+    pthread_mutex_unlock(&input->lock);
+    return input_ready(input);
+}
@@ -0,0 +1,39 @@
+#ifndef INPUT_H_
+#define INPUT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Keyboard input read ahead by a thread. The thread blocks in poll() on
+// the file descriptor and pushes what it reads into a single producer,
+// single consumer ring. The emulator only looks at the ring, so polling
+// MR_KBSR costs no system call.
+
+// Returned by input_poll() when no key is waiting
+#define INPUT_EMPTY     (-2)
+
+// An input reader
+typedef struct input input_t;
+
+// Start reading fd on a new thread. Return NULL if the thread cannot be
+// started.
+input_t* input_create(int fd);
+
+// Stop the thread and free the reader. Keys still in the ring are lost.
+void input_free(input_t* input);
+
+// Take the next key without blocking. Return the key, INPUT_EMPTY, or
+// EOF once the input has ended and every key was taken.
+int input_poll(input_t* input);
+
+// Take the next key, waiting for one. Return the key or EOF.
+int input_getc(input_t* input);
+
+// True when input_poll() would not return INPUT_EMPTY
+bool input_ready(input_t* input);
+
+// Wait until input_ready() or until timeout_ns nanoseconds have passed.
+// Return input_ready().
+bool input_sleep(input_t* input, uint64_t timeout_ns);
+
+#endif  // INPUT_H_
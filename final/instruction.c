@@ -101,6 +101,11 @@ uint16_t emit_not(reg_t dst, uint16_t src) {
     return (OP_NOT << 12) | (dst << 9) | (src << 6) | 0x3f;
 }
 
+// Emit an RTI instruction
+uint16_t emit_rti(void) {
+    return OP_RTI << 12;
+}
+
 // Emit a ST instruction
 uint16_t emit_st(reg_t src, uint16_t offset) {
     return (OP_ST << 12) | (src << 9) | (offset & 0x1ff);
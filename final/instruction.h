@@ -15,7 +15,7 @@ typedef enum {
     OP_AND,             // bitwise and
     OP_LDR,             // load register
     OP_STR,             // store register
-    OP_RTI,             // unused
+    OP_RTI,             // return from interrupt
     OP_NOT,             // bitwise not
     OP_LDI,             // load indirect
     OP_STI,             // store indirect
@@ -89,6 +89,9 @@ uint16_t emit_lea(reg_t dst, uint16_t offset);
 // Emit a NOT instruction
 uint16_t emit_not(reg_t dst, uint16_t src);
 
+// Emit an RTI instruction
+uint16_t emit_rti(void);
+
 // Emit a ST instruction
 uint16_t emit_st(reg_t src, uint16_t offset);
 
@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include "instruction.h"
+#include "interrupt.h"
+#include "machine.h"
+
+// Sources of interrupts, the bits of pending
+#define SOURCE_KEYBOARD     1
+#define SOURCE_TIMER        2
+
+// The controller of a machine, created on first use
+static interrupts_t* controller(x16_t* machine) {
+    if (machine->interrupts == NULL) {
+        interrupts_t* interrupts =
+            (interrupts_t*) calloc(1, sizeof(interrupts_t));
+        event_queue_init(&interrupts->events);
+        machine->interrupts = interrupts;
+    }
+    return machine->interrupts;
+}
+
+// Free the controller
+void interrupt_free(interrupts_t* interrupts) {
+    if (interrupts != NULL) {
+        event_queue_free(&interrupts->events);
+        free(interrupts);
+    }
+}
+
+// Copy the controller
+interrupts_t* interrupt_copy(const interrupts_t* interrupts) {
+    if (interrupts == NULL) {
+        return NULL;
+    }
+    interrupts_t* copy = (interrupts_t*) malloc(sizeof(interrupts_t));
+    *copy = *interrupts;
+    event_queue_copy(&copy->events, &interrupts->events);
+    return copy;
+}
+
+// End the run after the store being executed. Blocks end after it as they
+// do after a store into translated code.
+static void yield(x16_t* machine) {
+    machine->yield = true;
+    if (machine->blocks != NULL) {
+        machine->blocks->invalidated = true;
+    }
+}
+
+// Read a timer register. Reading MR_TMR clears TMR_FIRED.
+uint16_t interrupt_timer_read(x16_t* machine, uint16_t address) {
+    interrupts_t* interrupts = machine->interrupts;
+    if (interrupts == NULL) {
+        return 0;
+    }
+    if (address == MR_TMI) {
+        return interrupts->interval;
+    }
+    uint16_t tmr = interrupts->tmr;
+    interrupts->tmr &= ~TMR_FIRED;
+    return tmr;
+}
+
+// Write a timer register. A new interval starts counting after the store.
+void interrupt_timer_write(x16_t* machine, uint16_t address,
+                           uint16_t value) {
+    interrupts_t* interrupts = controller(machine);
+    if (address == MR_TMI) {
+        interrupts->interval = value;
+        interrupts->timer_changed = true;
+        yield(machine);
+        return;
+    }
+    interrupts->tmr = (interrupts->tmr & TMR_FIRED) | (value & TMR_IE);
+    if (!(value & TMR_IE)) {
+        interrupts->pending &= ~SOURCE_TIMER;
+    }
+}
+
+// The guest changed KBSR_IE. Setting it checks for a key right after the
+// store.
+void interrupt_keyboard_changed(x16_t* machine) {
+    interrupts_t* interrupts = controller(machine);
+    interrupts->keyboard_changed = true;
+    yield(machine);
+    if (!machine->kbsr_ie) {
+        interrupts->pending &= ~SOURCE_KEYBOARD;
+    }
+}
+
+// Queue the events for the stores since the last dispatch
+static void apply_changes(x16_t* machine, interrupts_t* interrupts,
+                          uint64_t now) {
+    if (interrupts->timer_changed) {
+        interrupts->timer_changed = false;
+        event_cancel(&interrupts->events, EVENT_TIMER);
+        if (interrupts->interval != 0) {
+            event_push(&interrupts->events, now + interrupts->interval,
+                       EVENT_TIMER);
+        }
+    }
+    if (interrupts->keyboard_changed) {
+        interrupts->keyboard_changed = false;
+        if (machine->kbsr_ie && !interrupts->keyboard_checking) {
+            event_push(&interrupts->events, now, EVENT_KEYBOARD);
+            interrupts->keyboard_checking = true;
+        }
+    }
+}
+
+// Fire an event that is due
+static void fire(x16_t* machine, interrupts_t* interrupts, event_t event) {
+    switch (event.kind) {
+    case EVENT_TIMER:
+        interrupts->tmr |= TMR_FIRED;
+        if (interrupts->tmr & TMR_IE) {
+            interrupts->pending |= SOURCE_TIMER;
+        }
+        event_push(&interrupts->events, event.at + interrupts->interval,
+                   EVENT_TIMER);
+        break;
+
+    case EVENT_KEYBOARD:
+        if (!machine->kbsr_ie) {
+            interrupts->keyboard_checking = false;
+            break;
+        }
+        // Latch a key in the keyboard registers until the guest reads
+        // MR_KBDR
+        if (!machine->key_latched) {
+            console_t* console = machine_console(machine);
+            int key = console->ops->poll(console);
+            if (key != CONSOLE_EMPTY) {
+                machine->memory[MR_KBSR] = KBSR_READY;
+                machine->memory[MR_KBDR] = (uint16_t) key;
+                machine->key_latched = true;
+                interrupts->pending |= SOURCE_KEYBOARD;
+            }
+        }
+        event_push(&interrupts->events, event.at + KEYBOARD_CHECK,
+                   EVENT_KEYBOARD);
+        break;
+    }
+}
+
+// Enter the handler of an interrupt. Push the PSR and PC on the
+// supervisor stack, switching to it from user mode.
+static void enter(x16_t* machine, uint8_t vector, uint8_t priority) {
+    x16_cpu_t* cpu = &machine->cpu;
+    uint16_t psr = x16_psr(machine);
+    if (!machine->supervisor) {
+        machine->saved_usp = cpu_reg(cpu, R_R6);
+        cpu_set(cpu, R_R6, machine->saved_ssp);
+        machine->supervisor = true;
+    }
+    uint16_t sp = cpu_reg(cpu, R_R6);
+    machine_memwrite(machine, --sp, psr);
+    machine_memwrite(machine, --sp, cpu_pc(cpu));
+    cpu_set(cpu, R_R6, sp);
+    machine->priority = priority;
+    cpu_set(cpu, R_PC, machine_memread(machine, IVT_BASE + vector));
+    machine->interrupts->taken++;
+}
+
+// Take the most urgent pending interrupt above the running priority
+static void take(x16_t* machine, interrupts_t* interrupts) {
+    if ((interrupts->pending & SOURCE_TIMER) &&
+        PL_TIMER > machine->priority) {
+        interrupts->pending &= ~SOURCE_TIMER;
+        enter(machine, INT_TIMER, PL_TIMER);
+    } else if ((interrupts->pending & SOURCE_KEYBOARD) &&
+               PL_KEYBOARD > machine->priority) {
+        interrupts->pending &= ~SOURCE_KEYBOARD;
+        enter(machine, INT_KEYBOARD, PL_KEYBOARD);
+    }
+}
+
+// True when PC is on a branch to itself that is taken
+static bool waiting(x16_t* machine) {
+    x16_cpu_t* cpu = &machine->cpu;
+    uint16_t pc = cpu_pc(cpu);
+    if (machine_is_io(machine, pc) || machine->breakpoints != NULL) {
+        return false;
+    }
+    uint16_t instruction = machine->memory[pc];
+    return getopcode(instruction) == OP_BR &&
+        getbits(instruction, 0, 9) == 0x1ff &&
+        (getbits(instruction, 9, 3) & cpu_cond(cpu)) != 0;
+}
+
+// Sleep the host while the guest waits for nothing but a key
+static void sleep_for_key(x16_t* machine, interrupts_t* interrupts) {
+    if (!machine->idle_sleep || interrupts->interval != 0 ||
+        machine->key_latched) {
+        return;
+    }
+    console_t* console = machine_console(machine);
+    console->ops->sleep(console, INTERRUPT_SLEEP_NS);
+}
+
+// Fire due events and take a pending interrupt
+uint64_t interrupt_dispatch(x16_t* machine, uint64_t max_instructions) {
+    interrupts_t* interrupts = machine->interrupts;
+    x16_cpu_t* cpu = &machine->cpu;
+    uint64_t skipped = 0;
+    for (;;) {
+        uint64_t now = cpu->executed;
+        apply_changes(machine, interrupts, now);
+        while (event_next(&interrupts->events) <= now) {
+            fire(machine, interrupts, event_pop(&interrupts->events));
+        }
+        take(machine, interrupts);
+
+        uint64_t next = event_next(&interrupts->events);
+        if (next == EVENT_NEVER || !waiting(machine)) {
+            break;
+        }
+        uint64_t skip = next - now;
+        if (max_instructions != 0 && skip > max_instructions - skipped) {
+            skip = max_instructions - skipped;
+        }
+        if (interrupts->events.events[0].kind == EVENT_KEYBOARD) {
+            sleep_for_key(machine, interrupts);
+        }
+        cpu->executed += skip;
+        skipped += skip;
+        interrupts->skipped += skip;
+        if (skipped == max_instructions) {
+            break;
+        }
+    }
+    return skipped;
+}
+
+// End the next run at the next event
+uint64_t interrupt_budget(x16_t* machine, uint64_t budget) {
+    uint64_t next = event_next(&machine->interrupts->events);
+    if (next == EVENT_NEVER) {
+        return budget;
+    }
+    uint64_t until = next - machine->cpu.executed;
+    return budget == 0 || until < budget ? until : budget;
+}
+
+// Execute an RTI the run stopped on. It pops PC and the PSR and returns
+// to user mode, and its stack, if the PSR says so.
+bool interrupt_rti(x16_t* machine) {
+    x16_cpu_t* cpu = &machine->cpu;
+    if (machine->stop != X16_STOP_ILLEGAL || !machine->supervisor ||
+        getopcode(machine_memread(machine, cpu_pc(cpu))) != OP_RTI) {
+        return false;
+    }
+    uint16_t sp = cpu_reg(cpu, R_R6);
+    uint16_t pc = machine_memread(machine, sp++);
+    uint16_t psr = machine_memread(machine, sp++);
+    cpu_set(cpu, R_PC, pc);
+    // The guest may have changed the PSR on the stack. Only restore one
+    // flag, as the branches expect.
+    uint16_t cond = psr & (FL_NEG | FL_ZRO | FL_POS);
+    if (cond != FL_NEG && cond != FL_ZRO && cond != FL_POS) {
+        cond = FL_ZRO;
+    }
+    cpu_set(cpu, R_COND, cond);
+    machine->priority = (psr >> PSR_PRIORITY_SHIFT) & 7;
+    if (psr & PSR_USER) {
+        machine->saved_ssp = sp;
+        sp = machine->saved_usp;
+        machine->supervisor = false;
+    }
+    cpu_set(cpu, R_R6, sp);
+    cpu->executed++;
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef INTERRUPT_H_
+#define INTERRUPT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "event.h"
+#include "x16.h"
+
+// The interrupt controller and the interval timer. They are created the
+// first time the guest sets KBSR_IE or programs the timer; until then a
+// machine runs as it always has.
+//
+// Timer expiries and checks for a key are events in a queue ordered by
+// instruction count. engine_run() runs the engine up to the next event,
+// fires what is due and takes a pending interrupt, so the engines know
+// nothing of interrupts and an interrupt arrives at the same count with
+// every engine. A store to MR_KBSR or MR_TMI ends the run after it (see
+// machine->yield) so the change takes effect at an exact count too. RTI
+// stops every engine as an illegal opcode, and engine_run() executes it.
+
+// Instructions between checks for a key while KBSR_IE is set
+#define KEYBOARD_CHECK      10000
+
+// Longest host sleep while the guest waits in a loop for a key
+#define INTERRUPT_SLEEP_NS  10000000
+
+// Kinds of events
+enum {
+    EVENT_TIMER,
+    EVENT_KEYBOARD,
+};
+
+// The state of the controller
+typedef struct interrupts {
+    event_queue_t events;
+    uint32_t pending;           // a bit per source, see interrupt.c
+
+    // A store to MR_TMI or MR_KBSR that takes effect at the next dispatch
+    bool timer_changed;
+    bool keyboard_changed;
+    bool keyboard_checking;     // an EVENT_KEYBOARD is queued
+
+    uint16_t interval;          // MR_TMI
+    uint16_t tmr;               // MR_TMR
+
+    uint64_t taken;             // interrupts taken
+    uint64_t skipped;           // instructions skipped in idle loops
+} interrupts_t;
+
+// Free the controller. NULL is ignored.
+void interrupt_free(interrupts_t* interrupts);
+
+// A copy of the controller, or NULL for NULL
+interrupts_t* interrupt_copy(const interrupts_t* interrupts);
+
+// Read and write the timer registers
+uint16_t interrupt_timer_read(x16_t* machine, uint16_t address);
+void interrupt_timer_write(x16_t* machine, uint16_t address,
+                           uint16_t value);
+
+// The guest changed KBSR_IE
+void interrupt_keyboard_changed(x16_t* machine);
+
+// Fire the events that are due and take the most urgent pending interrupt
+// the running code's priority allows. A guest in a branch to itself only
+// waits for an event, so the instructions up to the next event are
+// counted as executed without running them, up to max_instructions (0
+// for no limit). Return how many.
+uint64_t interrupt_dispatch(x16_t* machine, uint64_t max_instructions);
+
+// Lower budget, the instructions the next run may execute (0 for no
+// limit), so the run ends at the next event
+uint64_t interrupt_budget(x16_t* machine, uint64_t budget);
+
+// Execute the RTI at PC if the run stopped on it in supervisor mode.
+// Return true if it did.
+bool interrupt_rti(x16_t* machine);
+
+#endif  // INTERRUPT_H_
@@ -0,0 +1,668 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "block.h"
+#include "instruction.h"
+#include "jit.h"
+#include "machine.h"
+#include "x16.h"
+
+#if X16_HAVE_JIT
+
+// x86-64 register numbers
+enum {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Register allocation inside a block: guest R0-R7 live in r8d-r15d, the
+// condition register in ebp and the base of guest memory in rbx. PC is a
+// constant for every instruction of a block, so it is only materialized
+// in eax when the block exits. The register file pointer and the machine
+// are kept on the stack.
+#define GUEST(r)        (R8 + (r))
+#define HOST_COND       RBP
+#define HOST_MEM        RBX
+#define SLOT_REGS       0
+#define SLOT_MACHINE    8
+#define FRAME_SIZE      24
+
+// Upper bound of the code emitted for one block
+#define MAX_PROLOGUE    128
+#define MAX_OP_CODE     256
+
+// Native block entry point
+typedef int (*native_t)(uint16_t* reg, x16_t* machine, uint16_t* mem);
+
+// Code emitter
+typedef struct {
+    uint8_t* p;
+    const uint8_t* io_page;     // device page table of the machine
+} emitter_t;
+
+static void emit8(emitter_t* e, uint8_t b) {
+    *e->p++ = b;
+}
+
+static void emit32(emitter_t* e, uint32_t v) {
+    memcpy(e->p, &v, sizeof(v));
+    e->p += sizeof(v);
+}
+
+static void emit64(emitter_t* e, uint64_t v) {
+    memcpy(e->p, &v, sizeof(v));
+    e->p += sizeof(v);
+}
+
+// REX prefix, only emitted when needed
+static void rex(emitter_t* e, int w, int reg, int index, int rm) {
+    uint8_t b = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1)
+        | (rm >> 3);
+    if (b != 0x40) {
+        emit8(e, b);
+    }
+}
+
+static void modrm(emitter_t* e, int mod, int reg, int rm) {
+    emit8(e, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+// mov dst32, imm32
+static void mov_imm(emitter_t* e, int dst, uint32_t imm) {
+    rex(e, 0, 0, 0, dst);
+    emit8(e, 0xb8 + (dst & 7));
+    emit32(e, imm);
+}
+
+// mov dst32, src32
+static void mov_reg(emitter_t* e, int dst, int src) {
+    rex(e, 0, src, 0, dst);
+    emit8(e, 0x89);
+    modrm(e, 3, src, dst);
+}
+
+// movzx dst32, src16
+static void movzx_reg(emitter_t* e, int dst, int src) {
+    rex(e, 0, dst, 0, src);
+    emit8(e, 0x0f);
+    emit8(e, 0xb7);
+    modrm(e, 3, dst, src);
+}
+
+// add/and dst32, src32
+#define ALU_ADD 0x01
+#define ALU_AND 0x21
+static void alu_reg(emitter_t* e, int op, int dst, int src) {
+    rex(e, 0, src, 0, dst);
+    emit8(e, op);
+    modrm(e, 3, src, dst);
+}
+
+// add/and/cmp dst32, imm32
+#define ALUI_ADD 0
+#define ALUI_AND 4
+#define ALUI_CMP 7
+static void alu_imm(emitter_t* e, int ext, int dst, uint32_t imm) {
+    rex(e, 0, 0, 0, dst);
+    emit8(e, 0x81);
+    modrm(e, 3, ext, dst);
+    emit32(e, imm);
+}
+
+// not dst32
+static void not_reg(emitter_t* e, int dst) {
+    rex(e, 0, 0, 0, dst);
+    emit8(e, 0xf7);
+    modrm(e, 3, 2, dst);
+}
+
+// movzx dst32, word [rbx + disp32]
+static void load_abs(emitter_t* e, int dst, uint16_t address) {
+    rex(e, 0, dst, 0, HOST_MEM);
+    emit8(e, 0x0f);
+    emit8(e, 0xb7);
+    modrm(e, 2, dst, HOST_MEM);
+    emit32(e, (uint32_t) address * 2);
+}
+
+// movzx dst32, word [rbx + rax*2]
+static void load_rax(emitter_t* e, int dst) {
+    rex(e, 0, dst, RAX, HOST_MEM);
+    emit8(e, 0x0f);
+    emit8(e, 0xb7);
+    modrm(e, 0, dst, 4);
+    emit8(e, 0x40 | (RAX << 3) | HOST_MEM);
+}
+
+// movzx dst32, word [rdi + disp8]
+static void load_regfile(emitter_t* e, int dst, int disp) {
+    rex(e, 0, dst, 0, RDI);
+    emit8(e, 0x0f);
+    emit8(e, 0xb7);
+    modrm(e, 1, dst, RDI);
+    emit8(e, disp);
+}
+
+// mov word [rdi + disp8], src16
+static void store_regfile(emitter_t* e, int disp, int src) {
+    emit8(e, 0x66);
+    rex(e, 0, src, 0, RDI);
+    emit8(e, 0x89);
+    modrm(e, 1, src, RDI);
+    emit8(e, disp);
+}
+
+// mov dst64, [rsp + disp8]
+static void load_slot(emitter_t* e, int dst, int disp) {
+    rex(e, 1, dst, 0, RSP);
+    emit8(e, 0x8b);
+    modrm(e, 1, dst, RSP);
+    emit8(e, 0x24);
+    emit8(e, disp);
+}
+
+// mov [rsp + disp8], src64
+static void store_slot(emitter_t* e, int disp, int src) {
+    rex(e, 1, src, 0, RSP);
+    emit8(e, 0x89);
+    modrm(e, 1, src, RSP);
+    emit8(e, 0x24);
+    emit8(e, disp);
+}
+
+static void push(emitter_t* e, int r) {
+    rex(e, 0, 0, 0, r);
+    emit8(e, 0x50 + (r & 7));
+}
+
+static void pop(emitter_t* e, int r) {
+    rex(e, 0, 0, 0, r);
+    emit8(e, 0x58 + (r & 7));
+}
+
+// jcc rel32 with the offset patched later. Return the offset location.
+#define CC_E    0x4
+#define CC_NE   0x5
+static uint8_t* jcc(emitter_t* e, int cc) {
+    emit8(e, 0x0f);
+    emit8(e, 0x80 + cc);
+    uint8_t* at = e->p;
+    emit32(e, 0);
+    return at;
+}
+
+// Point a jump emitted by jcc at the current location
+static void patch(emitter_t* e, uint8_t* at) {
+    int32_t rel = (int32_t) (e->p - (at + 4));
+    memcpy(at, &rel, sizeof(rel));
+}
+
+// Set the condition register from the 16 bit value in a register
+static void set_cond(emitter_t* e, int r) {
+    // test r16, r16
+    emit8(e, 0x66);
+    rex(e, 0, r, 0, r);
+    emit8(e, 0x85);
+    modrm(e, 3, r, r);
+    mov_imm(e, HOST_COND, FL_ZRO);
+    emit8(e, 0x74);         // jz over the next two
+    emit8(e, 12);
+    mov_imm(e, HOST_COND, FL_NEG);
+    emit8(e, 0x78);         // js over the last
+    emit8(e, 5);
+    mov_imm(e, HOST_COND, FL_POS);
+}
+
+// Save the callee saved registers, load the guest registers
+static void prologue(emitter_t* e) {
+    push(e, RBX);
+    push(e, RBP);
+    push(e, R12);
+    push(e, R13);
+    push(e, R14);
+    push(e, R15);
+    // sub rsp, FRAME_SIZE keeps the stack 16 byte aligned for calls
+    emit8(e, 0x48);
+    emit8(e, 0x83);
+    emit8(e, 0xec);
+    emit8(e, FRAME_SIZE);
+    store_slot(e, SLOT_REGS, RDI);
+    store_slot(e, SLOT_MACHINE, RSI);
+    // mov rbx, rdx
+    emit8(e, 0x48);
+    emit8(e, 0x89);
+    modrm(e, 3, RDX, RBX);
+    for (int i = 0; i < 8; i++) {
+        load_regfile(e, GUEST(i), 2 * i);
+    }
+    load_regfile(e, HOST_COND, 2 * R_COND);
+}
+
+// Store the guest registers (and PC from eax if set_pc) and return the
+// number of instructions executed
+static void epilogue(emitter_t* e, bool set_pc, int executed) {
+    load_slot(e, RDI, SLOT_REGS);
+    for (int i = 0; i < 8; i++) {
+        store_regfile(e, 2 * i, GUEST(i));
+    }
+    store_regfile(e, 2 * R_COND, HOST_COND);
+    if (set_pc) {
+        store_regfile(e, 2 * R_PC, RAX);
+    }
+    mov_imm(e, RAX, executed);
+    // add rsp, FRAME_SIZE
+    emit8(e, 0x48);
+    emit8(e, 0x83);
+    emit8(e, 0xc4);
+    emit8(e, FRAME_SIZE);
+    pop(e, R15);
+    pop(e, R14);
+    pop(e, R13);
+    pop(e, R12);
+    pop(e, RBP);
+    pop(e, RBX);
+    emit8(e, 0xc3);     // ret
+}
+
+// True when a constant address is on a device page
+static bool is_device(emitter_t* e, uint16_t address) {
+    return e->io_page[address >> MEM_PAGE_SHIFT] != 0;
+}
+
+// Leave the block when eax holds an address on a device page, so the
+// interpreter performs the read
+static void exit_if_device(emitter_t* e, int executed) {
+    // mov ecx, eax; shr ecx, MEM_PAGE_SHIFT
+    mov_reg(e, RCX, RAX);
+    emit8(e, 0xc1);
+    modrm(e, 3, 5, RCX);
+    emit8(e, MEM_PAGE_SHIFT);
+    // mov rdx, io_page; cmp byte [rdx + rcx], 0
+    emit8(e, 0x48);
+    emit8(e, 0xba);
+    emit64(e, (uint64_t) (uintptr_t) e->io_page);
+    emit8(e, 0x80);
+    modrm(e, 0, 7, 4);
+    emit8(e, (RCX << 3) | RDX);
+    emit8(e, 0);
+    uint8_t* ok = jcc(e, CC_E);
+    epilogue(e, false, executed);
+    patch(e, ok);
+}
+
+// Memory write from native code. Return true if it invalidated
+// translated code.
+static int jit_store(x16_t* machine, uint32_t address, uint32_t value) {
+    x16_memwrite(machine, address, value);
+    return x16_block_cache(machine)->invalidated;
+}
+
+// Call jit_store with the address in esi and the value in edx. Leave the
+// block after op i if the store invalidated translated code.
+static void emit_store(emitter_t* e, int i) {
+    push(e, R8);
+    push(e, R9);
+    push(e, R10);
+    push(e, R11);
+    load_slot(e, RDI, SLOT_MACHINE + 32);
+    // mov rax, jit_store; call rax
+    emit8(e, 0x48);
+    emit8(e, 0xb8);
+    emit64(e, (uint64_t) (uintptr_t) jit_store);
+    emit8(e, 0xff);
+    emit8(e, 0xd0);
+    pop(e, R11);
+    pop(e, R10);
+    pop(e, R9);
+    pop(e, R8);
+    // test eax, eax
+    emit8(e, 0x85);
+    emit8(e, 0xc0);
+    uint8_t* ok = jcc(e, CC_E);
+    epilogue(e, false, i + 1);
+    patch(e, ok);
+}
+
+// Emit one micro-op. Return false if the block ends here. Fused pairs
+// are compiled one op at a time; native code gains nothing from them.
+static bool emit_op(emitter_t* e, const uop_t* op, int i) {
+    uop_kind_t kind = uop_unfused(op->kind);
+    switch (kind) {
+    case UOP_ADD_REG:
+    case UOP_ADD_IMM:
+        mov_reg(e, RAX, GUEST(op->src1));
+        if (kind == UOP_ADD_REG) {
+            alu_reg(e, ALU_ADD, RAX, GUEST(op->src2));
+        } else {
+            alu_imm(e, ALUI_ADD, RAX, op->value);
+        }
+        movzx_reg(e, GUEST(op->dst), RAX);
+        set_cond(e, GUEST(op->dst));
+        return true;
+
+    case UOP_AND_REG:
+    case UOP_AND_IMM:
+        mov_reg(e, RAX, GUEST(op->src1));
+        if (kind == UOP_AND_REG) {
+            alu_reg(e, ALU_AND, RAX, GUEST(op->src2));
+        } else {
+            alu_imm(e, ALUI_AND, RAX, op->value);
+        }
+        mov_reg(e, GUEST(op->dst), RAX);
+        set_cond(e, GUEST(op->dst));
+        return true;
+
+    case UOP_NOT:
+        mov_reg(e, RAX, GUEST(op->src1));
+        not_reg(e, RAX);
+        movzx_reg(e, GUEST(op->dst), RAX);
+        set_cond(e, GUEST(op->dst));
+        return true;
+
+    case UOP_LD:
+        if (is_device(e, op->value)) {
+            epilogue(e, false, i);
+            return false;
+        }
+        load_abs(e, GUEST(op->dst), op->value);
+        set_cond(e, GUEST(op->dst));
+        return true;
+
+    case UOP_LDI:
+        if (is_device(e, op->value)) {
+            epilogue(e, false, i);
+            return false;
+        }
+        load_abs(e, RAX, op->value);
+        exit_if_device(e, i);
+        load_rax(e, GUEST(op->dst));
+        set_cond(e, GUEST(op->dst));
+        return true;
+
+    case UOP_LDR:
+        mov_reg(e, RAX, GUEST(op->src1));
+        alu_imm(e, ALUI_ADD, RAX, op->value);
+        movzx_reg(e, RAX, RAX);
+        exit_if_device(e, i);
+        load_rax(e, GUEST(op->dst));
+        set_cond(e, GUEST(op->dst));
+        return true;
+
+    case UOP_LEA:
+        mov_imm(e, GUEST(op->dst), op->value);
+        mov_imm(e, HOST_COND, op->value == 0 ? FL_ZRO :
+            (op->value & 0x8000) ? FL_NEG : FL_POS);
+        return true;
+
+    case UOP_ST:
+        mov_imm(e, RSI, op->value);
+        mov_reg(e, RDX, GUEST(op->dst));
+        emit_store(e, i);
+        return true;
+
+    case UOP_STI:
+        if (is_device(e, op->value)) {
+            epilogue(e, false, i);
+            return false;
+        }
+        load_abs(e, RSI, op->value);
+        mov_reg(e, RDX, GUEST(op->dst));
+        emit_store(e, i);
+        return true;
+
+    case UOP_STR:
+        mov_reg(e, RSI, GUEST(op->src1));
+        alu_imm(e, ALUI_ADD, RSI, op->value);
+        movzx_reg(e, RSI, RSI);
+        mov_reg(e, RDX, GUEST(op->dst));
+        emit_store(e, i);
+        return true;
+
+    case UOP_BR:
+        mov_imm(e, RAX, op->next_pc);
+        mov_imm(e, RCX, op->value);
+        // test ebp, mask; cmovnz eax, ecx
+        emit8(e, 0xf7);
+        emit8(e, 0xc5);
+        emit32(e, op->src1);
+        emit8(e, 0x0f);
+        emit8(e, 0x45);
+        emit8(e, 0xc1);
+        epilogue(e, true, i + 1);
+        return false;
+
+    case UOP_JMP:
+        mov_reg(e, RAX, GUEST(op->src1));
+        epilogue(e, true, i + 1);
+        return false;
+
+    case UOP_JSR:
+        mov_imm(e, GUEST(R_R7), op->next_pc);
+        mov_imm(e, RAX, op->value);
+        epilogue(e, true, i + 1);
+        return false;
+
+    case UOP_JSRR:
+        // R7 is written first, so JSRR R7 jumps to the return address
+        mov_imm(e, GUEST(R_R7), op->next_pc);
+        mov_reg(e, RAX, GUEST(op->src1));
+        epilogue(e, true, i + 1);
+        return false;
+
+    case UOP_TRAP:
+    case UOP_ILLEGAL:
+    default:
+        // Traps and bad opcodes are left to the interpreter
+        epilogue(e, false, i);
+        return false;
+    }
+}
+
+// Map a file of JIT_BUFFER_SIZE bytes twice: writable for the emitter
+// and executable for running. No page is ever both, and compiling needs
+// no mprotect(). Return -1 on failure.
+static int map_buffer(jit_t* jit) {
+#ifdef __linux__
+    int fd = memfd_create("x16-jit", MFD_CLOEXEC);
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/x16-jit-%d-%p", (int) getpid(),
+             (void*) jit);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    shm_unlink(name);
+#endif
+    if (fd < 0) {
+        return -1;
+    }
+    void* buffer = MAP_FAILED;
+    void* code = MAP_FAILED;
+    if (ftruncate(fd, JIT_BUFFER_SIZE) == 0) {
+        buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+        code = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC,
+                    MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (buffer == MAP_FAILED || code == MAP_FAILED) {
+        if (buffer != MAP_FAILED) {
+            munmap(buffer, JIT_BUFFER_SIZE);
+        }
+        if (code != MAP_FAILED) {
+            munmap(code, JIT_BUFFER_SIZE);
+        }
+        return -1;
+    }
+    jit->buffer = (uint8_t*) buffer;
+    jit->code = (uint8_t*) code;
+    return 0;
+}
+
+// Get the JIT of a machine, creating the code buffer on first use
+static jit_t* get_jit(x16_t* machine) {
+    block_cache_t* cache = x16_block_cache(machine);
+    if (cache->jit == NULL) {
+        jit_t* jit = (jit_t*) calloc(1, sizeof(jit_t));
+        if (map_buffer(jit) != 0) {
+            free(jit);
+            return NULL;
+        }
+        cache->jit = jit;
+    }
+    return cache->jit;
+}
+
+// Emit a block at the end of the buffer. Return its entry point, or NULL
+// if it does not fit.
+static void* emit_block(x16_t* machine, jit_t* jit, const block_t* block) {
+    size_t need = MAX_PROLOGUE + (size_t) block->length * MAX_OP_CODE;
+    if (jit->used + need > JIT_BUFFER_SIZE) {
+        jit->full = true;
+        return NULL;
+    }
+
+    // Emit through the writable view. Jumps are relative within the
+    // block and calls absolute, so the code runs from the other view.
+    emitter_t e;
+    e.p = jit->buffer + jit->used;
+    uint8_t* entry = jit->code + jit->used;
+    e.io_page = machine->io_page;
+    prologue(&e);
+    int i;
+    for (i = 0; i < block->length; i++) {
+        if (!emit_op(&e, &block->ops[i], i)) {
+            break;
+        }
+    }
+    if (i == block->length) {
+        // The block was cut at its maximum length
+        mov_imm(&e, RAX, block->ops[i - 1].next_pc);
+        epilogue(&e, true, i);
+    }
+    jit->used = e.p - jit->buffer;
+    jit->compiled++;
+    return entry;
+}
+
+// Compile a block to native code
+void jit_compile(x16_t* machine, block_t* block) {
+    jit_t* jit = get_jit(machine);
+    if (jit == NULL || jit->full) {
+        return;
+    }
+    block->native = emit_block(machine, jit, block);
+}
+
+// Run the native code of a block
+int jit_run(x16_t* machine, const block_t* block, uint16_t* reg) {
+    native_t native = (native_t) block->native;
+    return native(reg, machine, machine->memory);
+}
+
+// Execute the single instruction at PC through the code generator. The
+// code is emitted at the end of the buffer and then dropped again.
+int jit_execute_one(x16_t* machine) {
+    block_cache_t* cache = x16_block_cache(machine);
+    jit_t* jit = get_jit(machine);
+    if (jit != NULL && jit->full) {
+        block_cache_flush(cache);
+    }
+
+    uint16_t reg[MAX_REGISTERS];
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        reg[i] = cpu_reg(&machine->cpu, (reg_t) i);
+    }
+
+    block_t* block = block_build(machine, reg[R_PC], 1);
+    size_t used = jit != NULL ? jit->used : 0;
+    block->native = jit != NULL ? emit_block(machine, jit, block) : NULL;
+
+    int rv = 0;
+    int done = 0;
+    cache->invalidated = false;
+    if (block->native != NULL) {
+        done = jit_run(machine, block, reg);
+        jit->used = used;
+    }
+    if (done == 0) {
+        block_interpret(machine, block, 0, reg, &rv);
+    } else if (cache->invalidated) {
+        reg[R_PC] = block->ops[0].next_pc;
+    }
+
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        cpu_set(&machine->cpu, (reg_t) i, reg[i]);
+    }
+    free(block);
+    return rv;
+}
+
+// True when the code buffer is full
+bool jit_full(x16_t* machine) {
+    block_cache_t* cache = x16_block_cache(machine);
+    return cache->jit != NULL && cache->jit->full;
+}
+
+// Drop all native code
+void jit_reset(jit_t* jit) {
+    if (jit != NULL) {
+        jit->used = 0;
+        jit->full = false;
+    }
+}
+
+// Free the code buffer
+void jit_free(jit_t* jit) {
+    if (jit != NULL) {
+        munmap(jit->buffer, JIT_BUFFER_SIZE);
+        munmap(jit->code, JIT_BUFFER_SIZE);
+        free(jit);
+    }
+}
+
+#else   // X16_HAVE_JIT
+
+// Without a code generator blocks are only interpreted
+
+void jit_compile(x16_t* machine, block_t* block) {
+}
+
+int jit_run(x16_t* machine, const block_t* block, uint16_t* reg) {
+    return 0;
+}
+
+int jit_execute_one(x16_t* machine) {
+    uint16_t reg[MAX_REGISTERS];
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        reg[i] = cpu_reg(&machine->cpu, (reg_t) i);
+    }
+    block_t* block = block_build(machine, reg[R_PC], 1);
+    int rv = 0;
+    block_interpret(machine, block, 0, reg, &rv);
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        cpu_set(&machine->cpu, (reg_t) i, reg[i]);
+    }
+    free(block);
+    return rv;
+}
+
+bool jit_full(x16_t* machine) {
+    return false;
+}
+
+void jit_reset(jit_t* jit) {
+}
+
+void jit_free(jit_t* jit) {
+}
+
+#endif  // X16_HAVE_JIT
+
+// Execute instructions with the block engine, compiling hot blocks
+int execute_jit(x16_t* machine, uint64_t max_instructions,
+                uint64_t* executed) {
+    return block_run(machine, max_instructions, executed, true);
+}
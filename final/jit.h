@@ -0,0 +1,72 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "block.h"
+#include "x16.h"
+
+// Native code generation needs an x86-64 host. Build with -DX16_NO_JIT
+// to leave it out.
+#if defined(__x86_64__) && !defined(X16_NO_JIT)
+#define X16_HAVE_JIT    1
+#else
+#define X16_HAVE_JIT    0
+#endif
+
+// A block is compiled once it has run this many times. Building with
+// -DX16_FORCE_JIT compiles every block the first time it runs and makes
+// execute_instruction go through the JIT too, so that the whole test
+// suite exercises the code generator.
+#ifdef X16_FORCE_JIT
+#define JIT_THRESHOLD   1
+#else
+#define JIT_THRESHOLD   32
+#endif
+
+// Size of the executable code buffer of each machine
+#define JIT_BUFFER_SIZE (4 * 1024 * 1024)
+
+// Native code of one machine
+typedef struct jit {
+    uint8_t* buffer;    // code buffer, mapped writable
+    uint8_t* code;      // the same buffer, mapped executable
+    size_t used;        // bytes of the buffer holding code
+    bool full;          // a block did not fit, flush before compiling more
+    uint64_t compiled;  // blocks compiled
+} jit_t;
+
+// Compile a block to native code. The block's native pointer stays NULL
+// if the buffer is full or the JIT is not available.
+void jit_compile(x16_t* machine, block_t* block);
+
+// Run the native code of a block with the register file in reg. Return
+// the number of instructions executed. The code stops before a TRAP, an
+// illegal opcode or a read of a device register so the interpreter can
+// finish the block, and after a store that invalidated translated code.
+// PC in reg is only updated when the whole block ran.
+int jit_run(x16_t* machine, const block_t* block, uint16_t* reg);
+
+// True when the code buffer is full and the block cache must be flushed
+bool jit_full(x16_t* machine);
+
+// Drop all native code
+void jit_reset(jit_t* jit);
+
+// Free the code buffer
+void jit_free(jit_t* jit);
+
+// Execute instructions with the block engine, compiling hot blocks to
+// native code, until HALT or until max_instructions have been executed
+// (0 means no limit). The number of instructions executed is stored in
+// executed if it is not NULL. Return -1 for HALT or 0 when the budget
+// ran out.
+int execute_jit(x16_t* machine, uint64_t max_instructions,
+                uint64_t* executed);
+
+// Execute the single instruction at PC through the code generator. Used
+// by execute_instruction when built with -DX16_FORCE_JIT.
+int jit_execute_one(x16_t* machine);
+
+#endif  // JIT_H_
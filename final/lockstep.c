@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+#if X16_HAVE_AVX2 || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "control.h"
+#include "engine.h"
+#include "feature.h"
+#include "instruction.h"
+#include "lockstep.h"
+#include "machine.h"
+#include "predecode.h"
+
+// A vector with a 16 bit lane per machine, and the mask a comparison of
+// two of them gives: all ones in the lanes where it holds
+typedef uint16_t lanes_t __attribute__((vector_size(2 * LOCKSTEP_LANES)));
+typedef int16_t lanes_mask_t __attribute__((vector_size(2 * LOCKSTEP_LANES)));
+
+// The most instructions a lane runs between the group's checks of the
+// budget, so the counts fit in a lane
+#define LOCKSTEP_CHUNK  0x7fff
+
+struct lockstep {
+    // The registers, a vector each. R_COND is always up to date.
+    lanes_t reg[MAX_REGISTERS];
+
+    // Instructions each lane ran in this chunk, and how many it may run
+    lanes_t ran;
+    lanes_t limit;
+
+    int count;
+    uint32_t all;               // a bit for each machine
+    x16_t* machines[LOCKSTEP_LANES];
+    uint16_t* memory[LOCKSTEP_LANES];
+
+    // Lanes that stopped this run, and lanes that left the group to run
+    // the rest of it on their own
+    uint32_t stopped;
+    uint32_t alone;
+
+    // Pages with a device in any lane, and a bit per word that may not
+    // be the same in every lane
+    uint8_t io_page[MEM_PAGES];
+    uint8_t differs[MAX_MEMORY / 8];
+
+    bool avx2;
+    lockstep_stats_t stats;
+};
+
+// Lane i has bit i
+static const lanes_t LANE_BITS = {
+    0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+    0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000,
+};
+
+// A value in every lane
+#define SPLAT(x)    ((lanes_t) {} + (uint16_t) (x))
+
+// The mask of the lanes with their bit set in bits
+#define LANE_MASK(bits)     ((LANE_BITS & (uint16_t) (bits)) != 0)
+
+// new in the lanes of mask, old in the others
+#define BLEND(old, new, mask) \
+    (((new) & (lanes_t) (mask)) | ((old) & ~(lanes_t) (mask)))
+
+// The condition flags of the results in every lane
+#define COND_OF_LANES(result) \
+    ((((lanes_t) ((result) == 0)) & FL_ZRO) | \
+     (((lanes_t) ((lanes_mask_t) (result) < 0)) & FL_NEG) | \
+     (((lanes_t) (((result) != 0) & ((lanes_mask_t) (result) > 0))) & FL_POS))
+
+// True when the address is on a device page in any lane
+static inline bool is_io(const lockstep_t* group, uint16_t address) {
+    return group->io_page[address >> MEM_PAGE_SHIFT] != 0;
+}
+
+// True when the word at the address may not be the same in every lane
+static inline bool differs(const lockstep_t* group, uint16_t address) {
+    return group->differs[address >> 3] & (1 << (address & 7));
+}
+
+static inline void mark(lockstep_t* group, uint16_t address) {
+    group->differs[address >> 3] |= 1 << (address & 7);
+}
+
+// Mark the word a lane's next instruction stores to, if it is a store.
+// Return false when the address is not known before it runs: the
+// instruction is on a device page, or it is an STI through one.
+static bool mark_store(lockstep_t* group, int lane) {
+    uint16_t pc = group->reg[R_PC][lane];
+    if (is_io(group, pc)) {
+        return false;
+    }
+    const uint16_t* memory = group->memory[lane];
+    const decoded_t* d = predecoded(memory[pc]);
+    uint16_t next = pc + 1;
+    uint16_t address;
+    switch (d->opcode) {
+    case OP_ST:
+        mark(group, next + d->value);
+        break;
+
+    case OP_STI:
+        address = next + d->value;
+        if (is_io(group, address)) {
+            return false;
+        }
+        mark(group, memory[address]);
+        break;
+
+    case OP_STR:
+        mark(group, group->reg[d->src1][lane] + d->value);
+        break;
+    }
+    return true;
+}
+
+// Run the next instruction of each lane in lanes with
+// execute_instruction. Clear the lanes from counted if the instruction
+// did not run. Return the lanes that left the group: those that stopped,
+// and those that go on alone because they enabled interrupts, ran RTI or
+// an illegal opcode (which engine_run() sorts out) or hit a store
+// mark_store() cannot follow.
+static uint32_t scalar_step(lockstep_t* group, uint32_t lanes,
+                            uint32_t* counted) {
+    uint32_t left = 0;
+    for (uint32_t rest = lanes; rest != 0; rest &= rest - 1) {
+        int lane = __builtin_ctz(rest);
+        uint32_t bit = 1u << lane;
+        if (!mark_store(group, lane)) {
+            *counted &= ~bit;
+            group->alone |= bit;
+            left |= bit;
+            continue;
+        }
+
+        x16_t* machine = group->machines[lane];
+        x16_cpu_t* cpu = &machine->cpu;
+        for (int i = 0; i < MAX_REGISTERS; i++) {
+            cpu_set(cpu, (reg_t) i, group->reg[i][lane]);
+        }
+        int rv = execute_instruction(machine);
+        for (int i = 0; i < MAX_REGISTERS; i++) {
+            // Most instructions change a register or two, and writing a
+            // lane stalls the next vector read of the register
+            uint16_t value = cpu_reg(cpu, (reg_t) i);
+            if (group->reg[i][lane] != value) {
+                group->reg[i][lane] = value;
+            }
+        }
+        group->stats.scalar++;
+
+        if (rv != 0) {
+            x16_stop_t reason = x16_stop_reason(machine);
+            if (reason == X16_STOP_ILLEGAL) {
+                *counted &= ~bit;
+                x16_stop(machine, X16_STOP_HALT);
+                group->alone |= bit;
+            } else {
+                if (reason == X16_STOP_INPUT) {
+                    *counted &= ~bit;
+                }
+                group->stopped |= bit;
+            }
+            left |= bit;
+        } else if (machine->yield) {
+            // engine_run() looks for the interrupt when the lane goes on
+            machine->yield = false;
+            group->alone |= bit;
+            left |= bit;
+        }
+    }
+    return left;
+}
+
+// What step() did with the lanes at a PC
+#define STEP_TOGETHER   0       // ran, and they are all at the same PC
+#define STEP_APART      1       // ran, and they went different ways
+#define STEP_SCALAR     2       // they must run one at a time
+
+// The vector code, once for AVX2 and once for any host
+#if X16_HAVE_AVX2
+#define LOCKSTEP_AVX2           1
+#define LOCKSTEP_TARGET         __attribute__((target("avx2,bmi2")))
+#define LOCKSTEP_VARIANT(name)  name##_avx2
+#include "lockstep_core.h"
+#undef LOCKSTEP_AVX2
+#undef LOCKSTEP_TARGET
+#undef LOCKSTEP_VARIANT
+#endif
+
+#define LOCKSTEP_AVX2           0
+#define LOCKSTEP_TARGET
+#define LOCKSTEP_VARIANT(name)  name##_generic
+#include "lockstep_core.h"
+#undef LOCKSTEP_AVX2
+#undef LOCKSTEP_TARGET
+#undef LOCKSTEP_VARIANT
+
+// Group machines to run in lockstep
+lockstep_t* lockstep_create(x16_t** machines, int count) {
+    if (count < 1 || count > LOCKSTEP_LANES) {
+        return NULL;
+    }
+    lockstep_t* group = (lockstep_t*) aligned_alloc(CACHE_LINE,
+        (sizeof(lockstep_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+    memset(group, 0, sizeof(lockstep_t));
+    group->count = count;
+    group->all = (1u << count) - 1;
+    memcpy(group->machines, machines, count * sizeof(x16_t*));
+#if X16_HAVE_AVX2
+    group->avx2 = __builtin_cpu_supports("avx2") &&
+        __builtin_cpu_supports("bmi2");
+#endif
+    return group;
+}
+
+// Free a group
+void lockstep_free(lockstep_t* group) {
+    free(group);
+}
+
+// Find the words and device pages that are not the same in every lane
+static void compare_lanes(lockstep_t* group) {
+    memset(group->io_page, 0, sizeof(group->io_page));
+    memset(group->differs, 0, sizeof(group->differs));
+    const uint16_t* first = group->memory[0];
+    for (int lane = 0; lane < group->count; lane++) {
+        x16_t* machine = group->machines[lane];
+        for (int page = 0; page < MEM_PAGES; page++) {
+            group->io_page[page] |= machine->io_page[page];
+        }
+        const uint16_t* memory = group->memory[lane];
+        for (int page = 0; lane > 0 && page < MEM_PAGES; page++) {
+            int start = page * MEM_PAGE_SIZE;
+            if (memcmp(first + start, memory + start,
+                       MEM_PAGE_SIZE * sizeof(uint16_t)) == 0) {
+                continue;
+            }
+            for (int address = start; address < start + MEM_PAGE_SIZE;
+                 address++) {
+                if (first[address] != memory[address]) {
+                    mark(group, address);
+                }
+            }
+        }
+    }
+}
+
+// Run the lanes in running until each has stopped, left or used up its
+// limit
+static void run_chunk(lockstep_t* group, uint32_t running) {
+#if X16_HAVE_AVX2
+    if (group->avx2) {
+        run_chunk_avx2(group, running);
+        return;
+    }
+#endif
+    run_chunk_generic(group, running);
+}
+
+// Run the machines of a group
+void lockstep_run(lockstep_t* group, uint64_t max_instructions,
+                  x16_stop_info_t* info) {
+    uint64_t executed[LOCKSTEP_LANES] = {0};
+    group->stopped = 0;
+    group->alone = 0;
+    for (int lane = 0; lane < group->count; lane++) {
+        x16_t* machine = group->machines[lane];
+        x16_cpu_t* cpu = &machine->cpu;
+        group->memory[lane] = machine->memory;
+        for (int i = 0; i < MAX_REGISTERS; i++) {
+            group->reg[i][lane] = cpu_reg(cpu, (reg_t) i);
+        }
+        x16_stop(machine, X16_STOP_HALT);
+        if (machine->interrupts != NULL || features_needed(machine) != 0) {
+            group->alone |= 1u << lane;
+        }
+    }
+    compare_lanes(group);
+
+    uint32_t active = group->all & ~group->alone;
+    while (active != 0) {
+        for (int lane = 0; lane < group->count; lane++) {
+            uint64_t left = max_instructions - executed[lane];
+            group->limit[lane] = max_instructions == 0 ||
+                left > LOCKSTEP_CHUNK ? LOCKSTEP_CHUNK : left;
+        }
+        group->ran = SPLAT(0);
+        run_chunk(group, active);
+
+        for (int lane = 0; lane < group->count; lane++) {
+            executed[lane] += group->ran[lane];
+            if (max_instructions != 0 && executed[lane] == max_instructions) {
+                active &= ~(1u << lane);
+            }
+        }
+        active &= ~(group->stopped | group->alone);
+    }
+
+    for (int lane = 0; lane < group->count; lane++) {
+        uint32_t bit = 1u << lane;
+        x16_t* machine = group->machines[lane];
+        x16_cpu_t* cpu = &machine->cpu;
+        for (int i = 0; i < MAX_REGISTERS; i++) {
+            cpu_set(cpu, (reg_t) i, group->reg[i][lane]);
+        }
+        cpu->executed += executed[lane];
+        group->stats.executed += executed[lane];
+        int rv = (group->stopped & bit) ? -1 : 0;
+
+        // The rest of the run on its own
+        if ((group->alone & bit) &&
+            (max_instructions == 0 || executed[lane] < max_instructions)) {
+            uint64_t more;
+            rv = engine_run(machine, engine_default(),
+                            max_instructions != 0 ?
+                            max_instructions - executed[lane] : 0, &more);
+            executed[lane] += more;
+        }
+
+        info[lane].reason = rv == 0 ? X16_STOP_BUDGET :
+            x16_stop_reason(machine);
+        info[lane].executed = executed[lane];
+        info[lane].pc = cpu_pc(cpu);
+    }
+}
+
+// The counts of a group
+void lockstep_stats(lockstep_t* group, lockstep_stats_t* stats) {
+    *stats = group->stats;
+}
+
+// True when the group runs the AVX2 version
+bool lockstep_avx2(lockstep_t* group) {
+    return group->avx2;
+}
@@ -0,0 +1,65 @@
+#ifndef LOCKSTEP_H_
+#define LOCKSTEP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "x16.h"
+
+// Run up to LOCKSTEP_LANES machines together, one per lane of a vector.
+// Each register of every machine is held in a vector with a lane per
+// machine (structure of arrays), and one instruction is executed for all
+// the lanes whose PC is lowest. Machines running the same image stay on
+// the same PC and run every instruction as one vector operation. When
+// they branch apart the lowest goes first, which brings them back
+// together where their paths meet.
+//
+// Traps, device registers and code that is not the same in every lane
+// run each lane through execute_instruction. Every machine ends a run in
+// the state engine_run() would leave it in, instruction for instruction.
+//
+// The vector code is built for AVX2 on x86-64 hosts that have it, and
+// with the compiler's generic vectors elsewhere. Build with
+// -DX16_NO_AVX2 to leave the AVX2 version out.
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(X16_NO_AVX2)
+#define X16_HAVE_AVX2   1
+#else
+#define X16_HAVE_AVX2   0
+#endif
+
+// Machines in a group, 16 bit lanes of a 256 bit vector
+#define LOCKSTEP_LANES  16
+
+typedef struct lockstep lockstep_t;
+
+// What a group has done over all of its runs
+typedef struct {
+    uint64_t steps;             // instructions run for a set of lanes
+    uint64_t diverged;          // steps that left out some running lanes
+    uint64_t scalar;            // lane instructions run one lane at a time
+    uint64_t executed;          // lane instructions in all
+} lockstep_stats_t;
+
+// Group count machines, 1 to LOCKSTEP_LANES. The machines still belong
+// to the caller and must outlive the group. Return NULL if count is out
+// of range.
+lockstep_t* lockstep_create(x16_t** machines, int count);
+
+// Free a group, not its machines
+void lockstep_free(lockstep_t* group);
+
+// Run every machine of the group until it stops or has executed
+// max_instructions (0 means no limit), and fill in info for each, as
+// x16_run() does. Machines that use interrupts or instrumentation (see
+// feature.h), and one that enables interrupts during the run, run the
+// rest of the way on their own with the default engine.
+void lockstep_run(lockstep_t* group, uint64_t max_instructions,
+                  x16_stop_info_t* info);
+
+// The counts of a group
+void lockstep_stats(lockstep_t* group, lockstep_stats_t* stats);
+
+// True when the group runs the AVX2 version
+bool lockstep_avx2(lockstep_t* group);
+
+#endif  // LOCKSTEP_H_
@@ -0,0 +1,292 @@
+// The vector loop of the lockstep engine. lockstep.c includes this file
+// once for AVX2 and once for any host, with LOCKSTEP_VARIANT naming the
+// functions and LOCKSTEP_TARGET giving the instruction set, so there is
+// no include guard. Vectors go by pointer, so the generic copy does not
+// pass them in AVX registers.
+
+// The lanes where a comparison holds, a bit per lane
+static inline LOCKSTEP_TARGET uint32_t LOCKSTEP_VARIANT(bits)(
+        const lanes_mask_t* mask) {
+#if LOCKSTEP_AVX2
+    // Two bytes of the mask per lane, keep one bit of each pair
+    uint32_t bytes = (uint32_t) _mm256_movemask_epi8((__m256i) *mask);
+    return _pext_u32(bytes, 0x55555555);
+#else
+    uint32_t result = 0;
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        result |= (uint32_t) ((*mask)[lane] != 0) << lane;
+    }
+    return result;
+#endif
+}
+
+// The lowest PC of the lanes in running
+static inline LOCKSTEP_TARGET uint16_t LOCKSTEP_VARIANT(lowest)(
+        const lanes_t* pc, uint32_t running) {
+#if LOCKSTEP_AVX2
+    __m256i v = (__m256i) BLEND(SPLAT(0xffff), *pc, LANE_MASK(running));
+    __m128i half = _mm_min_epu16(_mm256_castsi256_si128(v),
+                                 _mm256_extracti128_si256(v, 1));
+    return (uint16_t) _mm_cvtsi128_si32(_mm_minpos_epu16(half));
+#else
+    uint16_t low = 0xffff;
+    for (uint32_t rest = running; rest != 0; rest &= rest - 1) {
+        uint16_t value = (*pc)[__builtin_ctz(rest)];
+        if (value < low) {
+            low = value;
+        }
+    }
+    return low;
+#endif
+}
+
+// True when value is the same in every lane of lanes
+static inline LOCKSTEP_TARGET bool LOCKSTEP_VARIANT(uniform)(
+        const lanes_t* value, uint32_t lanes) {
+    lanes_mask_t same = *value == SPLAT((*value)[__builtin_ctz(lanes)]);
+    return (LOCKSTEP_VARIANT(bits)(&same) & lanes) == lanes;
+}
+
+// Read the address of each lane in lanes. Return false, having read
+// nothing, if it is on a device page in any of them.
+static inline LOCKSTEP_TARGET bool LOCKSTEP_VARIANT(load)(
+        lockstep_t* group, uint32_t lanes, const lanes_t* address,
+        lanes_t* value) {
+    int first = __builtin_ctz(lanes);
+    uint16_t at = (*address)[first];
+    if (LOCKSTEP_VARIANT(uniform)(address, lanes)) {
+        if (is_io(group, at)) {
+            return false;
+        }
+        if (!differs(group, at)) {
+            *value = SPLAT(group->memory[first][at]);
+            return true;
+        }
+    }
+    for (uint32_t rest = lanes; rest != 0; rest &= rest - 1) {
+        if (is_io(group, (*address)[__builtin_ctz(rest)])) {
+            return false;
+        }
+    }
+    for (uint32_t rest = lanes; rest != 0; rest &= rest - 1) {
+        int lane = __builtin_ctz(rest);
+        (*value)[lane] = group->memory[lane][(*address)[lane]];
+    }
+    return true;
+}
+
+// Write the value of each lane in lanes to its address. Return false,
+// having written nothing, if it is on a device page in any of them.
+static inline LOCKSTEP_TARGET bool LOCKSTEP_VARIANT(store)(
+        lockstep_t* group, uint32_t lanes, const lanes_t* address,
+        const lanes_t* value) {
+    for (uint32_t rest = lanes; rest != 0; rest &= rest - 1) {
+        if (is_io(group, (*address)[__builtin_ctz(rest)])) {
+            return false;
+        }
+    }
+    if (lanes == group->all && LOCKSTEP_VARIANT(uniform)(address, lanes) &&
+        LOCKSTEP_VARIANT(uniform)(value, lanes)) {
+        // Every machine has the same word there now
+        uint16_t at = (*address)[0];
+        group->differs[at >> 3] &= ~(1 << (at & 7));
+    } else {
+        for (uint32_t rest = lanes; rest != 0; rest &= rest - 1) {
+            mark(group, (*address)[__builtin_ctz(rest)]);
+        }
+    }
+    for (uint32_t rest = lanes; rest != 0; rest &= rest - 1) {
+        int lane = __builtin_ctz(rest);
+        machine_ram_write(group->machines[lane], (*address)[lane],
+                          (*value)[lane]);
+    }
+    return true;
+}
+
+// Set a register and the condition codes from a result in the lanes of
+// mask
+static inline LOCKSTEP_TARGET void LOCKSTEP_VARIANT(set_result)(
+        lockstep_t* group, int reg, const lanes_t* result,
+        const lanes_mask_t* mask) {
+    group->reg[reg] = BLEND(group->reg[reg], *result, *mask);
+    group->reg[R_COND] = BLEND(group->reg[R_COND], COND_OF_LANES(*result),
+                               *mask);
+}
+
+// Run the instruction at PC at for every lane in lanes, which are all
+// there, and set next to where they all go unless they part. Return
+// STEP_SCALAR, having changed nothing, for an instruction that must run a
+// lane at a time: one that is not the same in every lane, a trap, RTI,
+// the reserved opcode or a device access.
+static LOCKSTEP_TARGET int LOCKSTEP_VARIANT(step)(lockstep_t* group,
+                                                  uint16_t at,
+                                                  uint32_t lanes,
+                                                  uint16_t* next_pc) {
+    if (is_io(group, at) || differs(group, at)) {
+        return STEP_SCALAR;
+    }
+    int first = __builtin_ctz(lanes);
+    const decoded_t* d = predecoded(group->memory[first][at]);
+    lanes_t* reg = group->reg;
+    lanes_mask_t mask = LANE_MASK(lanes);
+    uint16_t next = at + 1;
+    lanes_t result = SPLAT(0);
+    lanes_t address = SPLAT(0);
+    lanes_t target = SPLAT(0);
+
+    switch (d->opcode) {
+    case OP_ADD:
+        result = reg[d->src1] + (d->imm ? SPLAT(d->value) : reg[d->src2]);
+        LOCKSTEP_VARIANT(set_result)(group, d->dst, &result, &mask);
+        break;
+
+    case OP_AND:
+        result = reg[d->src1] & (d->imm ? SPLAT(d->value) : reg[d->src2]);
+        LOCKSTEP_VARIANT(set_result)(group, d->dst, &result, &mask);
+        break;
+
+    case OP_NOT:
+        result = ~reg[d->src1];
+        LOCKSTEP_VARIANT(set_result)(group, d->dst, &result, &mask);
+        break;
+
+    case OP_BR: {
+        // The lanes whose condition codes take the branch
+        lanes_mask_t taken = mask & ((reg[R_COND] & d->nzp) != 0);
+        uint32_t taking = LOCKSTEP_VARIANT(bits)(&taken);
+        reg[R_PC] = BLEND(reg[R_PC], SPLAT(next), mask);
+        reg[R_PC] = BLEND(reg[R_PC], SPLAT(next + d->value), taken);
+        if (taking != 0 && taking != lanes) {
+            return STEP_APART;
+        }
+        *next_pc = taking != 0 ? next + d->value : next;
+        return STEP_TOGETHER;
+    }
+
+    case OP_JMP:
+        target = reg[d->src1];
+        reg[R_PC] = BLEND(reg[R_PC], target, mask);
+        goto jumped;
+
+    case OP_JSR:
+        // R7 first, as JSRR R7 jumps to the return address
+        reg[R_R7] = BLEND(reg[R_R7], SPLAT(next), mask);
+        target = d->nzp ? SPLAT(next + d->value) : reg[d->src1];
+        reg[R_PC] = BLEND(reg[R_PC], target, mask);
+    jumped:
+        if (!LOCKSTEP_VARIANT(uniform)(&target, lanes)) {
+            return STEP_APART;
+        }
+        *next_pc = target[first];
+        return STEP_TOGETHER;
+
+    case OP_LD:
+        address = SPLAT(next + d->value);
+        if (!LOCKSTEP_VARIANT(load)(group, lanes, &address, &result)) {
+            return STEP_SCALAR;
+        }
+        LOCKSTEP_VARIANT(set_result)(group, d->dst, &result, &mask);
+        break;
+
+    case OP_LDI:
+        address = SPLAT(next + d->value);
+        if (!LOCKSTEP_VARIANT(load)(group, lanes, &address, &target) ||
+            !LOCKSTEP_VARIANT(load)(group, lanes, &target, &result)) {
+            return STEP_SCALAR;
+        }
+        LOCKSTEP_VARIANT(set_result)(group, d->dst, &result, &mask);
+        break;
+
+    case OP_LDR:
+        address = reg[d->src1] + d->value;
+        if (!LOCKSTEP_VARIANT(load)(group, lanes, &address, &result)) {
+            return STEP_SCALAR;
+        }
+        LOCKSTEP_VARIANT(set_result)(group, d->dst, &result, &mask);
+        break;
+
+    case OP_LEA:
+        result = SPLAT(next + d->value);
+        LOCKSTEP_VARIANT(set_result)(group, d->dst, &result, &mask);
+        break;
+
+    case OP_ST:
+        address = SPLAT(next + d->value);
+        if (!LOCKSTEP_VARIANT(store)(group, lanes, &address, &reg[d->dst])) {
+            return STEP_SCALAR;
+        }
+        break;
+
+    case OP_STI:
+        address = SPLAT(next + d->value);
+        if (!LOCKSTEP_VARIANT(load)(group, lanes, &address, &target) ||
+            !LOCKSTEP_VARIANT(store)(group, lanes, &target, &reg[d->dst])) {
+            return STEP_SCALAR;
+        }
+        break;
+
+    case OP_STR:
+        address = reg[d->src1] + d->value;
+        if (!LOCKSTEP_VARIANT(store)(group, lanes, &address, &reg[d->dst])) {
+            return STEP_SCALAR;
+        }
+        break;
+
+    default:
+        return STEP_SCALAR;
+    }
+    reg[R_PC] = BLEND(reg[R_PC], SPLAT(next), mask);
+    *next_pc = next;
+    return STEP_TOGETHER;
+}
+
+// Run the lanes in running until each has stopped, left the group or
+// run its limit
+static LOCKSTEP_TARGET void LOCKSTEP_VARIANT(run_chunk)(lockstep_t* group,
+                                                        uint32_t running) {
+    uint64_t steps = 0;
+    uint64_t diverged = 0;
+    lanes_mask_t done = group->ran == group->limit;
+    running &= ~LOCKSTEP_VARIANT(bits)(&done);
+    while (running != 0) {
+        // The lanes at the lowest PC go first, so the others catch up
+        uint16_t at = LOCKSTEP_VARIANT(lowest)(&group->reg[R_PC], running);
+        lanes_mask_t here = group->reg[R_PC] == SPLAT(at);
+        uint32_t lanes = running & LOCKSTEP_VARIANT(bits)(&here);
+        lanes_mask_t mask = LANE_MASK(lanes);
+        int rv;
+        if (lanes == running) {
+            // All together: follow the PC they share without looking at
+            // the lanes until they part or one reaches its limit
+            lanes_t room = group->limit - group->ran;
+            uint16_t left = LOCKSTEP_VARIANT(lowest)(&room, lanes);
+            uint16_t n = 0;
+            while ((rv = LOCKSTEP_VARIANT(step)(group, at, lanes, &at)) ==
+                   STEP_TOGETHER && ++n < left) {
+            }
+            n += rv == STEP_APART;
+            steps += n;
+            group->ran += (lanes_t) mask & n;
+        } else {
+            uint16_t next;
+            rv = LOCKSTEP_VARIANT(step)(group, at, lanes, &next);
+            if (rv != STEP_SCALAR) {
+                steps++;
+                diverged++;
+                group->ran -= (lanes_t) mask;
+            }
+        }
+        if (rv == STEP_SCALAR) {
+            // The lanes are all at the PC at
+            uint32_t counted = lanes;
+            steps++;
+            diverged += lanes != running;
+            running &= ~scalar_step(group, lanes, &counted);
+            group->ran -= (lanes_t) LANE_MASK(counted);
+        }
+        done = group->ran == group->limit;
+        running &= ~LOCKSTEP_VARIANT(bits)(&done);
+    }
+    group->stats.steps += steps;
+    group->stats.diverged += diverged;
+}
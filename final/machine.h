@@ -0,0 +1,204 @@
+#ifndef MACHINE_H_
+#define MACHINE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "block.h"
+#include "framebuffer.h"
+#include "console.h"
+#include "instruction.h"
+#include "interrupt.h"
+#include "x16.h"
+
+// The layout of x16_t and inline versions of its accessors, for the
+// engines and the rest of the emulator. Programs that embed a machine
+// should only need x16.h.
+
+// Bytes in a host cache line
+#define CACHE_LINE      64
+
+// The state an instruction touches on every step: the register file, the
+// lazy condition codes and the instruction counter. It fits in one cache
+// line and nothing else shares that line.
+typedef struct {
+    // The register file contains R0-R7, PC and condition registers
+    uint16_t registers[MAX_REGISTERS];
+
+    // Result of the last instruction that set the condition codes. While
+    // cond_pending is set R_COND is stale and is computed from it on the
+    // next read.
+    uint16_t result;
+    bool cond_pending;
+
+    // Instructions executed by engine_run() and x16_exec()
+    uint64_t executed;
+} __attribute__((aligned(CACHE_LINE))) x16_cpu_t;
+
+// A memory mapped device
+typedef struct {
+    x16_io_read_t read;
+    x16_io_write_t write;
+    void* device;
+} x16_device_t;
+
+// The X16 machine
+struct x16 {
+    x16_cpu_t cpu;
+
+    // The memory of the computer, MAX_MEMORY 16 bit words. It is allocated
+    // on its own, page aligned, so the 128K array does not sit between
+    // the registers and the rest of the machine.
+    uint16_t* memory;
+
+    // The device of each page, an index into devices. 0 is plain RAM.
+    uint8_t io_page[MEM_PAGES];
+    x16_device_t devices[MAX_DEVICES];
+    int num_devices;
+
+    // Blocks translated by the block engine, NULL until it first runs
+    block_cache_t* blocks;
+
+    // Why the last run stopped
+    x16_stop_t stop;
+
+    // A byte per address, non zero at a breakpoint. NULL until the first
+    // breakpoint is set; num_breakpoints counts how many are set.
+    uint8_t* breakpoints;
+    int num_breakpoints;
+
+    // Stop instead of blocking when a trap needs input
+    bool input_wait;
+
+    // Keyboard and console output, NULL until the guest first uses either
+    // and no console was set
+    console_t* console;
+
+    // The framebuffer device, NULL unless x16_map_framebuffer() was called
+    framebuffer_t* framebuffer;
+
+    // Memory writes and traps so far. A guest whose polls of MR_KBSR have
+    // nothing of this in between is only waiting for a key.
+    uint64_t activity;
+
+    // Empty polls of MR_KBSR in a row from around idle_pc with activity
+    // at idle_activity, see keyboard_read()
+    uint16_t idle_pc;
+    uint32_t idle_polls;
+    uint64_t idle_activity;
+
+    // Sleep the host while the guest idles on the keyboard
+    bool idle_sleep;
+
+    // Set by a device store that must take effect at an exact instruction
+    // count. The engines end the run after the store.
+    bool yield;
+
+    // Supervisor mode, the priority of the running code and the stack
+    // pointer of the mode not running (see interrupt.h)
+    bool supervisor;
+    uint8_t priority;
+    uint16_t saved_ssp;
+    uint16_t saved_usp;
+
+    // KBSR_IE as the guest set it, and a key the keyboard interrupt put in
+    // MR_KBDR that the guest has not read yet
+    uint16_t kbsr_ie;
+    bool key_latched;
+
+    // The interrupt controller, NULL until the guest enables an interrupt
+    interrupts_t* interrupts;
+
+    // The snapshot the machine was last saved to or restored from, NULL
+    // before the first, and a byte per page written since (see
+    // snapshot.h)
+    x16_snapshot_t* base;
+    uint8_t dirty[MEM_PAGES];
+};
+
+// Get the condition register, computing it from the last result
+static inline uint16_t cpu_cond(x16_cpu_t* cpu) {
+    if (cpu->cond_pending) {
+        uint16_t result = cpu->result;
+        cpu->registers[R_COND] = result == 0 ? FL_ZRO :
+            (result & 0x8000) ? FL_NEG : FL_POS;
+        cpu->cond_pending = false;
+    }
+    return cpu->registers[R_COND];
+}
+
+// Get the program counter
+static inline uint16_t cpu_pc(x16_cpu_t* cpu) {
+    return cpu->registers[R_PC];
+}
+
+// Get a register
+static inline uint16_t cpu_reg(x16_cpu_t* cpu, reg_t reg) {
+    if (reg == R_COND) {
+        return cpu_cond(cpu);
+    }
+    return cpu->registers[reg];
+}
+
+// Set a register
+static inline void cpu_set(x16_cpu_t* cpu, reg_t reg, uint16_t value) {
+    if (reg == R_COND) {
+        cpu->cond_pending = false;
+    }
+    cpu->registers[reg] = value;
+}
+
+// Record the result that sets the condition codes
+static inline void cpu_set_result(x16_cpu_t* cpu, uint16_t result) {
+    cpu->result = result;
+    cpu->cond_pending = true;
+#ifdef X16_EAGER_COND
+    cpu_cond(cpu);
+#endif
+}
+
+// True when the address is on a device page
+static inline bool machine_is_io(x16_t* machine, uint16_t address) {
+    return machine->io_page[address >> MEM_PAGE_SHIFT] != 0;
+}
+
+// The console, a TTY console on stdin and stdout unless another was set
+console_t* machine_console(x16_t* machine);
+
+// Draw the framebuffer, if one is mapped and a frame is due or frame is
+// set, and write out the console output
+void machine_flush(x16_t* machine, bool frame);
+
+// Read and write an address on a device page
+uint16_t machine_io_read(x16_t* machine, uint16_t address);
+void machine_io_write(x16_t* machine, uint16_t address, uint16_t val);
+
+// Write RAM, invalidating translated blocks that hold the address
+static inline void machine_ram_write(x16_t* machine, uint16_t address,
+                                     uint16_t val) {
+    machine->activity++;
+    machine->dirty[address >> MEM_PAGE_SHIFT] = 1;
+    if (machine->blocks != NULL && machine->memory[address] != val) {
+        block_memwrite(machine->blocks, address);
+    }
+    machine->memory[address] = val;
+}
+
+// Read memory. Plain RAM is one table lookup away from the array.
+static inline uint16_t machine_memread(x16_t* machine, uint16_t address) {
+    if (machine_is_io(machine, address)) {
+        return machine_io_read(machine, address);
+    }
+    return machine->memory[address];
+}
+
+// Write memory
+static inline void machine_memwrite(x16_t* machine, uint16_t address,
+                                    uint16_t val) {
+    if (machine_is_io(machine, address)) {
+        machine_io_write(machine, address, val);
+        return;
+    }
+    machine_ram_write(machine, address, val);
+}
+
+#endif  // MACHINE_H_
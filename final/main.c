@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <termios.h>
 #include <stdlib.h>
 #include <signal.h>
@@ -9,67 +10,103 @@
 #include "x16.h"
 #include "io.h"
 #include "control.h"
-
-
-// Read Image File. Return 0 on success or -1 for failure
-static int read_image_file(x16_t* machine, FILE* fp) {
-    // The origin tells us where in memory to place the image
-    uint16_t origin;
-    if (fread(&origin, sizeof(origin), 1, fp) <= 0) {
-        return -1;
-    }
-    // Swap to host format
-    origin = ntohs(origin);
-
-    // we know the maximum file size so we only need one fread
-    uint16_t max_read = UINT16_MAX - origin;
-    uint16_t* p = x16_memory(machine, origin);
-    size_t read = fread(p, sizeof(uint16_t), max_read, fp);
-    if (read <= 0) {
-        return -1;    // nothing read, or some error in fread
-    }
-
-    // swap each 16 bit value to host format
-    while (read-- > 0) {
-        *p = ntohs(*p);
-        ++p;
-    }
-
-    return 0;
-}
-
-// Read Image into memory. Return 0 on success or -1 for failure.
-static int read_image(x16_t* machine, const char* image_path) {
-    FILE* fp = fopen(image_path, "rb");
-    if (fp == NULL) {
-        return -1;
-    }
-    int rv = read_image_file(machine, fp);
-    fclose(fp);
-    return rv;
-}
+#include "engine.h"
+#include "feature.h"
+#include "governor.h"
+#include "image.h"
+#include "image_cache.h"
+#include "session.h"
+
+// Long options without a short form
+enum {
+    OPT_RECORD = 256,
+    OPT_REPLAY,
+    OPT_IMAGE_CACHE,
+};
+
+static const struct option long_options[] = {
+    {"record", required_argument, NULL, OPT_RECORD},
+    {"replay", required_argument, NULL, OPT_REPLAY},
+    {"image-cache", required_argument, NULL, OPT_IMAGE_CACHE},
+    {NULL, 0, NULL, 0},
+};
+
+// The session being recorded or replayed, for the SIGINT handler
+static session_t* session;
 
 static void usage() {
-    printf("Usage: x16 [-l] image-file1\n");
+    printf("Usage: x16 [-l] [-p] [-e switch|threaded|block|jit] "
+        "[-c rate] [-f]\n"
+        "           [--record file | --replay file] [--image-cache dir] "
+        "image-file1\n");
     exit(1);
 }
 
+// End the session at its next check, which restores the TTY and writes
+// the end of a recording
+static void interrupt_session(int signal) {
+    session_interrupt(session);
+}
+
 int main(int argc, char** argv) {
     int ch;
-    while ((ch = getopt(argc, argv, "l")) != -1) {
+    engine_t engine = engine_default();
+    uint64_t hz = 0;
+    bool framebuffer = false;
+    const char* record = NULL;
+    const char* replay = NULL;
+    const char* image_cache = NULL;
+    while ((ch = getopt_long(argc, argv, "lpe:c:f", long_options,
+                             NULL)) != -1) {
         switch (ch) {
         case 'l':
             LOG = 1;
             LOGFP = fopen("log.txt", "w");
             break;
 
+        case 'p':
+            PROFILE = 1;
+            break;
+
+        case 'e':
+            if (engine_parse(optarg, &engine) != 0) {
+                fprintf(stderr, "Unknown engine: %s\n", optarg);
+                usage();
+            }
+            break;
+
+        case 'c':
+            if (governor_parse(optarg, &hz) != 0) {
+                fprintf(stderr, "Bad clock rate: %s\n", optarg);
+                usage();
+            }
+            break;
+
+        case 'f':
+            framebuffer = true;
+            break;
+
+        case OPT_RECORD:
+            record = optarg;
+            break;
+
+        case OPT_REPLAY:
+            replay = optarg;
+            break;
+
+        case OPT_IMAGE_CACHE:
+            image_cache = optarg;
+            break;
+
         default:
             usage();
         }
     }
     argc -= optind;
     argv += optind;
-
+    if (record != NULL && replay != NULL) {
+        usage();
+    }
 
     char* filename = "a.obj";
     if (argc > 1) {
@@ -80,32 +117,97 @@ int main(int argc, char** argv) {
 
     // Initialize machine
     x16_t* machine = x16_create();
+    if (machine == NULL) {
+        fprintf(stderr, "Cannot create a machine\n");
+        exit(1);
+    }
 
-    // Read the image file into memory
-    if (read_image(machine, filename) != 0) {
+    if (framebuffer && x16_map_framebuffer(machine) != 0) {
+        fprintf(stderr, "Cannot map the framebuffer\n");
+        exit(1);
+    }
+
+    // Read the image file into memory. With a cache directory the image's
+    // pages are shared with every other x16 using it.
+    int rv;
+    if (image_cache != NULL) {
+        image_cache_t* cache = image_cache_create(image_cache);
+        rv = image_cache_read(cache, machine, filename);
+        image_cache_free(cache);
+    } else {
+        rv = read_image(machine, filename);
+    }
+    if (rv != 0) {
         fprintf(stderr, "Failed to read image: %s\n", filename);
         exit(1);
     }
 
+    // A replay takes its keys from the log, not the terminal
+    if (record != NULL) {
+        console_t* console = console_tty_create(STDIN_FILENO, STDOUT_FILENO);
+        session = session_record(machine, console, record);
+        if (session == NULL) {
+            perror(record);
+            exit(1);
+        }
+    } else if (replay != NULL) {
+        console_t* console = console_tty_create(STDIN_FILENO, STDOUT_FILENO);
+        session = session_replay(machine, console, replay);
+        if (session == NULL) {
+            fprintf(stderr, "Failed to read session: %s\n", replay);
+            exit(1);
+        }
+    }
+
     // Set up signal handler to clean up TTY state on SIGINT
-    signal(SIGINT, handle_interrupt);
+    signal(SIGINT, session != NULL ? interrupt_session : handle_interrupt);
 
     // Disable so we can read keystrokes without newline
-    disable_input_buffering();
+    if (replay == NULL) {
+        disable_input_buffering();
+    }
 
-    // Execute the emulation till we see a halt or some error occurs
-    for (;;) {
-        if (execute_instruction(machine) != 0) {
-            break;
-        }
+    // Execute the emulation till we see a halt or some error occurs. With
+    // a clock rate the governor paces every poll of the keyboard, so the
+    // machine does not also sleep on its own.
+    governor_t governor;
+    if (hz != 0) {
+        governor_init(&governor, hz);
+        x16_set_idle_sleep(machine, false);
+    }
+    if (session != NULL) {
+        session_run(session, engine, hz != 0 ? &governor : NULL);
+    } else if (hz != 0) {
+        governor_run(&governor, machine, engine, 0, NULL);
+    } else {
+        engine_run(machine, engine, 0, NULL);
     }
 
     // Restore TTY state
-    restore_input_buffering();
+    if (replay == NULL) {
+        restore_input_buffering();
+    }
+
+    if (PROFILE) {
+        feature_print_profile(stderr);
+    }
+    if (hz != 0) {
+        governor_print(&governor, stderr);
+    }
+    int status = 0;
+    if (session != NULL) {
+        x16_flush(machine);
+        session_print(session, stderr);
+        status = session_diverged(session) ? 3 : 0;
+    }
+    if (x16_stop_reason(machine) == X16_STOP_ILLEGAL) {
+        fprintf(stderr, "Illegal opcode at 0x%x\n", x16_pc(machine));
+    }
 
     x16_free(machine);
 
     if (LOGFP != NULL) {
         fclose(LOGFP);
     }
+    return status;
 }
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "output.h"
+
+struct output {
+    int fd;
+    unsigned long writes;
+
+    // The buffer. length is only changed under the lock; it is atomic so
+    // output_flush() can see an empty buffer without taking the lock.
+    char buffer[OUTPUT_SIZE];
+    atomic_size_t length;
+
+    // The timer thread waits on more while the buffer is empty and until
+    // OUTPUT_DELAY_NS have passed once it is not
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    pthread_t thread;
+    bool stop;
+};
+
+// Write the buffer to fd. The lock is held.
+static void flush_locked(output_t* output) {
+    size_t length = atomic_load_explicit(&output->length,
+                                         memory_order_relaxed);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = write(output->fd, output->buffer + done, length - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        output->writes++;
+        done += (size_t) n;
+    }
+    atomic_store(&output->length, 0);
+}
+
+// The timer thread
+static void* flusher(void* arg) {
+    output_t* output = (output_t*) arg;
+    pthread_mutex_lock(&output->lock);
+    while (!output->stop) {
+        if (atomic_load(&output->length) == 0) {
+            pthread_cond_wait(&output->more, &output->lock);
+            continue;
+        }
+
+        // Give the guest the rest of the delay to finish what it draws
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t ns = deadline.tv_nsec + OUTPUT_DELAY_NS;
+        deadline.tv_sec += ns / 1000000000;
+        deadline.tv_nsec = ns % 1000000000;
+        while (!output->stop && atomic_load(&output->length) != 0 &&
+               pthread_cond_timedwait(&output->more, &output->lock,
+                                      &deadline) == 0) {
+        }
+        flush_locked(output);
+    }
+    pthread_mutex_unlock(&output->lock);
+    return NULL;
+}
+
+// Buffer output to fd, with a thread that flushes it on a timer
+output_t* output_create(int fd) {
+    output_t* output = (output_t*) calloc(1, sizeof(output_t));
+    output->fd = fd;
+    pthread_mutex_init(&output->lock, NULL);
+    pthread_cond_init(&output->more, NULL);
+
+    // Signals go to the emulator thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rv = pthread_create(&output->thread, NULL, flusher, output);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rv != 0) {
+        pthread_mutex_destroy(&output->lock);
+        pthread_cond_destroy(&output->more);
+        free(output);
+        return NULL;
+    }
+    return output;
+}
+
+// Write what is buffered, stop the thread and free the buffer
+void output_free(output_t* output) {
+    if (output == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&output->lock);
+    flush_locked(output);
+    output->stop = true;
+    pthread_cond_signal(&output->more);
+    pthread_mutex_unlock(&output->lock);
+    pthread_join(output->thread, NULL);
+
+    pthread_mutex_destroy(&output->lock);
+    pthread_cond_destroy(&output->more);
+    free(output);
+}
+
+// Buffer length bytes
+void output_write(output_t* output, const char* data, size_t length) {
+    pthread_mutex_lock(&output->lock);
+    while (length > 0) {
+        size_t used = atomic_load_explicit(&output->length,
+                                           memory_order_relaxed);
+        if (used == OUTPUT_SIZE) {
+            flush_locked(output);
+            used = 0;
+        }
+        size_t n = OUTPUT_SIZE - used < length ? OUTPUT_SIZE - used : length;
+        memcpy(output->buffer + used, data, n);
+        atomic_store(&output->length, used + n);
+        if (used == 0) {
+            pthread_cond_signal(&output->more);
+        }
+        data += n;
+        length -= n;
+    }
+    pthread_mutex_unlock(&output->lock);
+}
+
+// Buffer a byte
+void output_putc(output_t* output, char c) {
+    output_write(output, &c, 1);
+}
+
+// Write what is buffered now
+void output_flush(output_t* output) {
+    if (atomic_load(&output->length) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&output->lock);
+    flush_locked(output);
+    pthread_mutex_unlock(&output->lock);
+}
+
+// Writes to fd so far
+unsigned long output_writes(output_t* output) {
+    pthread_mutex_lock(&output->lock);
+    unsigned long writes = output->writes;
+    pthread_mutex_unlock(&output->lock);
+    return writes;
+}
@@ -0,0 +1,40 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <stddef.h>
+
+// Console output of the guest, buffered so a screen redraw goes out in a
+// few writes rather than one per character. The buffer is written when
+// the guest next looks for input (output_flush()), when it fills up, or
+// OUTPUT_DELAY_NS after the first byte was buffered, by a thread that
+// sleeps otherwise.
+
+// Bytes buffered before a write
+#define OUTPUT_SIZE         4096
+
+// Longest a byte waits in the buffer, in nanoseconds
+#define OUTPUT_DELAY_NS     5000000
+
+// A console output buffer
+typedef struct output output_t;
+
+// Buffer output to fd, with a thread that flushes it on a timer. Return
+// NULL if the thread cannot be started.
+output_t* output_create(int fd);
+
+// Write what is buffered, stop the thread and free the buffer
+void output_free(output_t* output);
+
+// Buffer a byte
+void output_putc(output_t* output, char c);
+
+// Buffer length bytes
+void output_write(output_t* output, const char* data, size_t length);
+
+// Write what is buffered now
+void output_flush(output_t* output);
+
+// Writes to fd so far
+unsigned long output_writes(output_t* output);
+
+#endif  // OUTPUT_H_
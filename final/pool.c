@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "pool.h"
+
+// A worker's queue of tasks: a ring of size slots, big enough for every
+// task, from head up to tail. The owner takes from the head and puts back
+// at the tail; thieves take from the tail.
+typedef struct {
+    pthread_mutex_t lock;
+    void** ring;
+    size_t size;
+    size_t head;
+    size_t tail;
+} queue_t;
+
+typedef struct pool pool_t;
+
+typedef struct {
+    pool_t* pool;
+    int index;
+    pthread_t thread;
+    queue_t queue;
+    pool_stats_t stats;
+} worker_t;
+
+struct pool {
+    worker_t* workers;
+    int count;
+    pool_slice_t slice;
+    void* context;
+    atomic_size_t remaining;    // tasks not done yet
+};
+
+static void queue_init(queue_t* queue, size_t size) {
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->ring = (void**) malloc(size * sizeof(void*));
+    queue->size = size;
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+static void queue_free(queue_t* queue) {
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->ring);
+}
+
+static void queue_put(queue_t* queue, void* task) {
+    pthread_mutex_lock(&queue->lock);
+    queue->ring[queue->tail++ % queue->size] = task;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Take the task at the head, or at the tail. Return NULL if there is none.
+static void* queue_take(queue_t* queue, bool tail) {
+    void* task = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head != queue->tail) {
+        task = tail ? queue->ring[--queue->tail % queue->size] :
+            queue->ring[queue->head++ % queue->size];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return task;
+}
+
+// Take a task from another worker, trying each in turn after this one
+static void* steal(worker_t* worker) {
+    pool_t* pool = worker->pool;
+    for (int i = 1; i < pool->count; i++) {
+        worker_t* victim = &pool->workers[(worker->index + i) % pool->count];
+        void* task = queue_take(&victim->queue, true);
+        if (task != NULL) {
+            worker->stats.steals++;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void* work(void* arg) {
+    worker_t* worker = (worker_t*) arg;
+    pool_t* pool = worker->pool;
+    while (atomic_load(&pool->remaining) > 0) {
+        void* task = queue_take(&worker->queue, false);
+        if (task == NULL) {
+            task = steal(worker);
+        }
+        if (task == NULL) {
+            // The last tasks are running elsewhere
+            sched_yield();
+            continue;
+        }
+        worker->stats.slices++;
+        if (pool->slice(task, worker->index, pool->context)) {
+            atomic_fetch_sub(&pool->remaining, 1);
+        } else {
+            queue_put(&worker->queue, task);
+        }
+    }
+    return NULL;
+}
+
+// One worker per core
+int pool_default_workers(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int) cores : 1;
+}
+
+// Run the tasks to the end on a pool of threads
+void pool_run(void** tasks, size_t count, int workers, pool_slice_t slice,
+              void* context, pool_stats_t* stats) {
+    pool_t pool;
+    pool.count = workers > 0 ? workers : 1;
+    pool.workers = (worker_t*) calloc(pool.count, sizeof(worker_t));
+    pool.slice = slice;
+    pool.context = context;
+    atomic_init(&pool.remaining, count);
+
+    for (int i = 0; i < pool.count; i++) {
+        worker_t* worker = &pool.workers[i];
+        worker->pool = &pool;
+        worker->index = i;
+        queue_init(&worker->queue, count > 0 ? count : 1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        queue_put(&pool.workers[i % pool.count].queue, tasks[i]);
+    }
+
+    // The calling thread is worker 0
+    for (int i = 1; i < pool.count; i++) {
+        pthread_create(&pool.workers[i].thread, NULL, work,
+                       &pool.workers[i]);
+    }
+    work(&pool.workers[0]);
+    for (int i = 1; i < pool.count; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+    }
+
+    pool_stats_t total = {0, 0};
+    for (int i = 0; i < pool.count; i++) {
+        total.slices += pool.workers[i].stats.slices;
+        total.steals += pool.workers[i].stats.steals;
+        queue_free(&pool.workers[i].queue);
+    }
+    free(pool.workers);
+    if (stats != NULL) {
+        *stats = total;
+    }
+}
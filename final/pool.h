@@ -0,0 +1,33 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A pool of threads that run tasks in slices. Every worker keeps a queue
+// of tasks and runs a slice of the one at its head, then puts the task
+// back at the tail if it is not done, so a long task only delays the
+// others on its queue by a slice at a time. A worker whose queue is empty
+// steals from the tail of another's.
+
+// Run a slice of task on the given worker. Return true when the task is
+// done, or false to have it run again later, maybe on another worker.
+typedef bool (*pool_slice_t)(void* task, int worker, void* context);
+
+// What the workers did
+typedef struct {
+    uint64_t slices;
+    uint64_t steals;
+} pool_stats_t;
+
+// The number of workers to use when none is asked for: one per core
+int pool_default_workers(void);
+
+// Run count tasks on workers threads until every one is done. The tasks
+// are dealt out to the workers in turn. stats, if not NULL, gets the
+// totals over all workers.
+void pool_run(void** tasks, size_t count, int workers, pool_slice_t slice,
+              void* context, pool_stats_t* stats);
+
+#endif  // POOL_H_
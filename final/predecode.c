@@ -0,0 +1,95 @@
+#include <pthread.h>
+#include <string.h>
+#include "bits.h"
+#include "instruction.h"
+#include "predecode.h"
+
+decoded_t PREDECODE[65536];
+
+static pthread_once_t predecode_once = PTHREAD_ONCE_INIT;
+
+// Decode one instruction without the table
+decoded_t predecode_instruction(uint16_t instruction) {
+    decoded_t d;
+    memset(&d, 0, sizeof(d));
+
+    d.opcode = getopcode(instruction);
+    switch (d.opcode) {
+    case OP_ADD:
+    case OP_AND:
+        d.dst = getbits(instruction, 9, 3);
+        d.src1 = getbits(instruction, 6, 3);
+        d.imm = getimmediate(instruction);
+        if (d.imm) {
+            d.value = sign_extend(getbits(instruction, 0, 5), 5);
+        } else {
+            d.src2 = getbits(instruction, 0, 3);
+        }
+        break;
+
+    case OP_NOT:
+        d.dst = getbits(instruction, 9, 3);
+        d.src1 = getbits(instruction, 6, 3);
+        break;
+
+    case OP_BR:
+        d.nzp = getbits(instruction, 9, 3);
+        if (d.nzp == 0) {
+            // A BR with no condition bits is always taken
+            d.nzp = FL_NEG | FL_ZRO | FL_POS;
+        }
+        d.value = sign_extend(getbits(instruction, 0, 9), 9);
+        break;
+
+    case OP_JMP:
+        d.src1 = getbits(instruction, 6, 3);
+        break;
+
+    case OP_JSR:
+        d.nzp = getbit(instruction, 11);
+        if (d.nzp) {
+            d.value = sign_extend(getbits(instruction, 0, 11), 11);
+        } else {
+            d.src1 = getbits(instruction, 6, 3);
+        }
+        break;
+
+    case OP_LD:
+    case OP_LDI:
+    case OP_LEA:
+    case OP_ST:
+    case OP_STI:
+        d.dst = getbits(instruction, 9, 3);
+        d.value = sign_extend(getbits(instruction, 0, 9), 9);
+        break;
+
+    case OP_LDR:
+    case OP_STR:
+        d.dst = getbits(instruction, 9, 3);
+        d.src1 = getbits(instruction, 6, 3);
+        d.value = sign_extend(getbits(instruction, 0, 6), 6);
+        break;
+
+    case OP_TRAP:
+        d.value = getbits(instruction, 0, 8);
+        break;
+
+    default:
+        // RTI and RES carry no operands
+        break;
+    }
+
+    return d;
+}
+
+// Fill in the table for all 65536 encodings
+static void build_table(void) {
+    for (int i = 0; i < 65536; i++) {
+        PREDECODE[i] = predecode_instruction((uint16_t) i);
+    }
+}
+
+// Build the predecode table once
+void predecode_init(void) {
+    pthread_once(&predecode_once, build_table);
+}
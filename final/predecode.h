@@ -0,0 +1,37 @@
+#ifndef PREDECODE_H_
+#define PREDECODE_H_
+
+#include <stdint.h>
+#include "instruction.h"
+
+// The fully decoded form of a 16 bit instruction. Every field that an
+// instruction does not use is 0.
+typedef struct {
+    uint8_t opcode;     // opcode_t, the highest 4 bits
+    uint8_t dst;        // bits 9-11: DR, or SR for ST/STI/STR
+    uint8_t src1;       // bits 6-8: SR1, or BaseR for JMP/JSRR/LDR/STR
+    uint8_t src2;       // bits 0-2: SR2 in register mode
+    uint8_t imm;        // 1 when the second operand is the immediate value
+    uint8_t nzp;        // BR condition mask (0 becomes FL_NEG|FL_ZRO|FL_POS),
+                        // or 1 for PC relative JSR
+    uint16_t value;     // sign extended imm5/offset6/PCoffset9/PCoffset11,
+                        // or the trap vector
+} decoded_t;
+
+// The decoded form of every possible instruction, indexed by the
+// instruction itself. Built by predecode_init().
+extern decoded_t PREDECODE[65536];
+
+// Build the predecode table. Safe to call any number of times and
+// from any thread; the table is only built once.
+void predecode_init(void);
+
+// Decode one instruction without the table
+decoded_t predecode_instruction(uint16_t instruction);
+
+// Get the decoded form of an instruction
+static inline const decoded_t* predecoded(uint16_t instruction) {
+    return &PREDECODE[instruction];
+}
+
+#endif  // PREDECODE_H_
@@ -0,0 +1,326 @@
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include "session.h"
+
+// An input event: a key, or EOF, handed over after count instructions
+typedef struct {
+    uint64_t count;
+    int key;
+} session_event_t;
+
+struct session {
+    console_t console;
+    x16_t* machine;
+    console_t* inner;           // output, and keys when recording
+    FILE* log;                  // NULL when replaying
+
+    // The key handed over and not yet taken, CONSOLE_EMPTY if none. EOF
+    // stays once handed over.
+    int pending;
+
+    // The guest asked to sleep on an empty keyboard
+    bool idle;
+
+    // The recorded events, when replaying
+    session_event_t* events;
+    size_t num_events;
+    size_t next;                // next event to hand over
+    uint64_t end;               // count the session ended at
+    bool diverged;
+
+    uint64_t handed;            // events handed over
+    volatile sig_atomic_t interrupted;
+};
+
+// ------------------------------ Console
+
+static int session_poll(console_t* console) {
+    session_t* session = (session_t*) console;
+    int key = session->pending;
+    if (key != EOF) {
+        session->pending = CONSOLE_EMPTY;
+    }
+    return key;
+}
+
+// GETC and IN only read once the key is ready (x16_set_input_wait)
+static int session_getc(console_t* console) {
+    int key = session_poll(console);
+    return key == CONSOLE_EMPTY ? EOF : key;
+}
+
+static bool session_ready(console_t* console) {
+    return ((session_t*) console)->pending != CONSOLE_EMPTY;
+}
+
+// Keys only arrive between runs, so rather than sleep in the middle of
+// one, note that the guest is idle and wait after the run
+static bool session_sleep(console_t* console, uint64_t timeout_ns) {
+    session_t* session = (session_t*) console;
+    session->idle = true;
+    return session->pending != CONSOLE_EMPTY;
+}
+
+static void session_write(console_t* console, const char* data,
+                          size_t length) {
+    session_t* session = (session_t*) console;
+    console_write(session->inner, data, length);
+}
+
+static void session_flush(console_t* console) {
+    session_t* session = (session_t*) console;
+    session->inner->ops->flush(session->inner);
+}
+
+static void session_free(console_t* console) {
+    session_t* session = (session_t*) console;
+    if (session->log != NULL) {
+        fclose(session->log);
+    }
+    console_free(session->inner);
+    free(session->events);
+    free(session);
+}
+
+static const console_ops_t session_ops = {
+    session_poll, session_getc, session_ready, session_sleep, session_write,
+    session_flush, session_free,
+};
+
+// A session with output to console
+static session_t* session_create(console_t* console) {
+    session_t* session = (session_t*) calloc(1, sizeof(session_t));
+    session->console.ops = &session_ops;
+    session->inner = console;
+    session->pending = CONSOLE_EMPTY;
+    session->end = UINT64_MAX;
+    return session;
+}
+
+// Make a session the console of machine
+static void session_attach(session_t* session, x16_t* machine) {
+    session->machine = machine;
+    x16_set_console(machine, &session->console);
+    x16_set_input_wait(machine, true);
+}
+
+// ------------------------------ Recording
+
+// Write an event line
+static void log_event(session_t* session, uint64_t count, const char* what) {
+    fprintf(session->log, "%" PRIu64 " %s\n", count, what);
+    fflush(session->log);
+}
+
+// Hand key over to the guest now and log it
+static void record_key(session_t* session, int key) {
+    char text[16];
+    if (key == EOF) {
+        strcpy(text, "eof");
+    } else {
+        snprintf(text, sizeof(text), "%d", key);
+    }
+    log_event(session, x16_executed(session->machine), text);
+    session->pending = key;
+    session->handed++;
+}
+
+// Hand over a key that has come in, waiting up to timeout_ns for one.
+// Return true if a key was handed over.
+static bool record_next(session_t* session, uint64_t timeout_ns) {
+    console_t* inner = session->inner;
+    int key = inner->ops->poll(inner);
+    if (key == CONSOLE_EMPTY && timeout_ns != 0 &&
+        inner->ops->sleep(inner, timeout_ns)) {
+        key = inner->ops->poll(inner);
+    }
+    if (key == CONSOLE_EMPTY) {
+        return false;
+    }
+    record_key(session, key);
+    return true;
+}
+
+// Record the keys from console
+session_t* session_record(x16_t* machine, console_t* console,
+                          const char* path) {
+    FILE* log = fopen(path, "w");
+    if (log == NULL) {
+        return NULL;
+    }
+    fprintf(log, "x16 session 1\n");
+    session_t* session = session_create(console);
+    session->log = log;
+    session_attach(session, machine);
+    return session;
+}
+
+// ------------------------------ Replay
+
+// Read the events of a log into session. Return -1 if it is not one.
+static int read_events(session_t* session, FILE* fp) {
+    char line[64];
+    if (fgets(line, sizeof(line), fp) == NULL ||
+        strcmp(line, "x16 session 1\n") != 0) {
+        return -1;
+    }
+    size_t size = 0;
+    uint64_t last = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char* what;
+        uint64_t count = strtoull(line, &what, 10);
+        if (what == line || *what != ' ' || count < last ||
+            session->end != UINT64_MAX) {
+            return -1;
+        }
+        what++;
+        last = count;
+        if (strcmp(what, "end\n") == 0) {
+            session->end = count;
+            continue;
+        }
+
+        int key;
+        if (strcmp(what, "eof\n") == 0) {
+            key = EOF;
+        } else {
+            char* rest;
+            key = (int) strtol(what, &rest, 10);
+            if (rest == what || *rest != '\n' || key < 0 || key > 0xffff) {
+                return -1;
+            }
+        }
+        if (session->num_events == size) {
+            size = size != 0 ? size * 2 : 256;
+            session->events = (session_event_t*) realloc(
+                session->events, size * sizeof(session_event_t));
+        }
+        session->events[session->num_events++] =
+            (session_event_t) {count, key};
+    }
+    return 0;
+}
+
+// Replay the keys recorded in path
+session_t* session_replay(x16_t* machine, console_t* console,
+                          const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+    session_t* session = session_create(console);
+    int rv = read_events(session, fp);
+    fclose(fp);
+    if (rv != 0) {
+        session->inner = NULL;
+        session_free(&session->console);
+        return NULL;
+    }
+    session_attach(session, machine);
+    return session;
+}
+
+// Hand over the events due at the current count. Return the count of the
+// next event or the end, whichever is first.
+static uint64_t replay_next(session_t* session) {
+    uint64_t now = x16_executed(session->machine);
+    while (session->next < session->num_events) {
+        session_event_t* event = &session->events[session->next];
+        if (event->count > now) {
+            return event->count < session->end ? event->count : session->end;
+        }
+        if (event->count < now || session->pending != CONSOLE_EMPTY) {
+            // The guest ran past the count, or has not taken the last key
+            session->diverged = true;
+            return now;
+        }
+        session->pending = event->key;
+        session->next++;
+        session->handed++;
+    }
+    return session->end;
+}
+
+// ------------------------------ Running
+
+// Run the session
+x16_stop_t session_run(session_t* session, engine_t engine,
+                       governor_t* governor) {
+    x16_t* machine = session->machine;
+    bool replay = session->log == NULL;
+    x16_stop_t reason = X16_STOP_INPUT;
+    while (!session->interrupted) {
+        uint64_t slice = SESSION_SLICE;
+        if (replay) {
+            uint64_t next = replay_next(session);
+            uint64_t now = x16_executed(machine);
+            if (session->diverged || next <= now) {
+                reason = X16_STOP_BUDGET;
+                break;
+            }
+            if (next - now < slice) {
+                slice = next - now;
+            }
+        } else if (session->pending == CONSOLE_EMPTY) {
+            record_next(session, session->idle ? SESSION_WAIT_NS : 0);
+        }
+        session->idle = false;
+
+        int rv = governor != NULL ?
+            governor_run(governor, machine, engine, slice, NULL) :
+            engine_run(machine, engine, slice, NULL);
+        if (rv == 0) {
+            continue;
+        }
+        reason = x16_stop_reason(machine);
+        if (reason != X16_STOP_INPUT) {
+            break;
+        }
+
+        // GETC or IN is waiting. A replay has no key due, or it would
+        // have been handed over before the run.
+        if (replay) {
+            session->diverged = session->next < session->num_events ||
+                (session->end != UINT64_MAX &&
+                 session->end != x16_executed(machine));
+            break;
+        }
+        x16_flush(machine);
+        while (!session->interrupted &&
+               !record_next(session, SESSION_WAIT_NS)) {
+        }
+    }
+
+    if (!replay) {
+        log_event(session, x16_executed(machine), "end");
+    } else if (reason == X16_STOP_HALT && session->end != UINT64_MAX &&
+               session->end != x16_executed(machine)) {
+        session->diverged = true;
+    }
+    return reason;
+}
+
+// Stop the run at the next check
+void session_interrupt(session_t* session) {
+    session->interrupted = 1;
+}
+
+// True when a replay did not match its recording
+bool session_diverged(session_t* session) {
+    return session->diverged;
+}
+
+// Print the events handed over
+void session_print(session_t* session, FILE* fp) {
+    uint64_t executed = x16_executed(session->machine);
+    if (session->log != NULL) {
+        fprintf(fp, "Recorded %" PRIu64 " keys over %" PRIu64
+                " instructions\n", session->handed, executed);
+        return;
+    }
+    fprintf(fp, "Replayed %" PRIu64 " of %zu keys over %" PRIu64
+            " instructions%s\n", session->handed, session->num_events,
+            executed, session->diverged ? ", diverged" : "");
+}
@@ -0,0 +1,62 @@
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "console.h"
+#include "engine.h"
+#include "governor.h"
+#include "x16.h"
+
+// Records the input a guest is given so it can be replayed exactly
+// (x16 --record, x16 --replay). A session is the console of the machine.
+// It hands the guest a key only between runs of at most SESSION_SLICE
+// instructions, or when GETC or IN stops a run to wait for one, so the
+// instruction count a key arrives at is exact with every engine. A replay
+// hands over the same keys at the same counts without a terminal, and
+// the guest executes the same instructions.
+//
+// The log is text: the line "x16 session 1", then a line per event with
+// the instruction count and either the key code, "eof" for the end of the
+// input, or "end" for the end of the session.
+
+// Most instructions run between checks for a key
+#define SESSION_SLICE       100000
+
+// Longest wait for a key between checks of session_interrupt()
+#define SESSION_WAIT_NS     10000000
+
+typedef struct session session_t;
+
+// Record the keys console gives the machine into path and make the
+// session the machine's console. Output goes to console, which the
+// session frees. Return NULL, leaving console to the caller, if path
+// cannot be created.
+session_t* session_record(x16_t* machine, console_t* console,
+                          const char* path);
+
+// Replay the keys recorded in path and make the session the machine's
+// console. Output goes to console, which the session frees. Return NULL,
+// leaving console to the caller, if path cannot be read or is not a log.
+session_t* session_replay(x16_t* machine, console_t* console,
+                          const char* path);
+
+// Run the machine like engine_run(), paced by governor if it is not NULL,
+// until it halts or stops, the replay ends or session_interrupt() is
+// called. Return why it stopped: X16_STOP_BUDGET at the end of a replay,
+// X16_STOP_INPUT when GETC or IN waits past the end of a replay or after
+// an interrupt.
+x16_stop_t session_run(session_t* session, engine_t engine,
+                       governor_t* governor);
+
+// Stop session_run() at the next check. Safe in a signal handler.
+void session_interrupt(session_t* session);
+
+// True when a replay gave a key or stopped at a count the recording did
+// not
+bool session_diverged(session_t* session);
+
+// Print the events handed over and the instructions run
+void session_print(session_t* session, FILE* fp);
+
+#endif  // SESSION_H_
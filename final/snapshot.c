@@ -0,0 +1,184 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "block.h"
+#include "interrupt.h"
+#include "machine.h"
+#include "snapshot.h"
+#include "x16.h"
+
+// Bytes in a page of memory
+#define PAGE_BYTES      (MEM_PAGE_SIZE * sizeof(uint16_t))
+
+// A page of memory, shared by snapshots
+typedef struct {
+    atomic_uint refs;
+    uint16_t words[MEM_PAGE_SIZE];
+} snapshot_page_t;
+
+struct x16_snapshot {
+    atomic_uint refs;           // the caller's and each machine's base
+    snapshot_page_t* pages[MEM_PAGES];
+
+    // The rest of the machine's state
+    x16_cpu_t cpu;
+    bool supervisor;
+    uint8_t priority;
+    uint16_t saved_ssp;
+    uint16_t saved_usp;
+    uint16_t kbsr_ie;
+    bool key_latched;
+    interrupts_t* interrupts;   // a copy, or NULL
+};
+
+// Every snapshot page that is all zeros. It is never counted or freed.
+static snapshot_page_t zero_page;
+
+static bool page_zero(const uint16_t* words) {
+    return memcmp(words, zero_page.words, PAGE_BYTES) == 0;
+}
+
+static snapshot_page_t* page_copy(const uint16_t* words) {
+    if (page_zero(words)) {
+        return &zero_page;
+    }
+    snapshot_page_t* page = (snapshot_page_t*) malloc(sizeof(*page));
+    atomic_init(&page->refs, 1);
+    memcpy(page->words, words, PAGE_BYTES);
+    return page;
+}
+
+static snapshot_page_t* page_keep(snapshot_page_t* page) {
+    if (page != &zero_page) {
+        atomic_fetch_add(&page->refs, 1);
+    }
+    return page;
+}
+
+static void page_release(snapshot_page_t* page) {
+    if (page != &zero_page && atomic_fetch_sub(&page->refs, 1) == 1) {
+        free(page);
+    }
+}
+
+static x16_snapshot_t* snapshot_keep(x16_snapshot_t* snapshot) {
+    atomic_fetch_add(&snapshot->refs, 1);
+    return snapshot;
+}
+
+// Let go of a snapshot
+void x16_snapshot_free(x16_snapshot_t* snapshot) {
+    if (snapshot == NULL || atomic_fetch_sub(&snapshot->refs, 1) != 1) {
+        return;
+    }
+    for (int page = 0; page < MEM_PAGES; page++) {
+        page_release(snapshot->pages[page]);
+    }
+    interrupt_free(snapshot->interrupts);
+    free(snapshot);
+}
+
+// True when the page of the machine is the same as the base's
+static bool clean(x16_t* machine, int page) {
+    return machine->base != NULL && !machine->dirty[page] &&
+        machine->io_page[page] == 0;
+}
+
+// Make the snapshot the machine's base, with every page clean
+static void set_base(x16_t* machine, x16_snapshot_t* snapshot) {
+    snapshot_keep(snapshot);
+    x16_snapshot_free(machine->base);
+    machine->base = snapshot;
+    memset(machine->dirty, 0, sizeof(machine->dirty));
+}
+
+// Save the state of the machine
+x16_snapshot_t* x16_snapshot(x16_t* machine) {
+    x16_snapshot_t* snapshot =
+        (x16_snapshot_t*) calloc(1, sizeof(x16_snapshot_t));
+    atomic_init(&snapshot->refs, 1);
+    for (int page = 0; page < MEM_PAGES; page++) {
+        const uint16_t* words = machine->memory + page * MEM_PAGE_SIZE;
+        snapshot_page_t* base = machine->base != NULL ?
+            machine->base->pages[page] : NULL;
+        // A page written back to what it was is shared too
+        if (clean(machine, page) ||
+            (base != NULL && memcmp(base->words, words, PAGE_BYTES) == 0)) {
+            snapshot->pages[page] = page_keep(base);
+        } else {
+            snapshot->pages[page] = page_copy(words);
+        }
+    }
+
+    x16_cpu_t* cpu = &machine->cpu;
+    cpu_cond(cpu);
+    snapshot->cpu = *cpu;
+    snapshot->supervisor = machine->supervisor;
+    snapshot->priority = machine->priority;
+    snapshot->saved_ssp = machine->saved_ssp;
+    snapshot->saved_usp = machine->saved_usp;
+    snapshot->kbsr_ie = machine->kbsr_ie;
+    snapshot->key_latched = machine->key_latched;
+    snapshot->interrupts = interrupt_copy(machine->interrupts);
+
+    set_base(machine, snapshot);
+    return snapshot;
+}
+
+// Put the machine back in the state of a snapshot
+void x16_restore(x16_t* machine, x16_snapshot_t* snapshot) {
+    for (int page = 0; page < MEM_PAGES; page++) {
+        snapshot_page_t* from = snapshot->pages[page];
+        if (clean(machine, page) && machine->base->pages[page] == from) {
+            continue;
+        }
+        // Leave pages that match alone, so a fresh machine is only
+        // backed by host memory where the snapshot is not zero
+        uint16_t* words = machine->memory + page * MEM_PAGE_SIZE;
+        if (memcmp(words, from->words, PAGE_BYTES) == 0) {
+            continue;
+        }
+        if (machine->blocks != NULL) {
+            // Translated code on the page may change
+            int start = page * MEM_PAGE_SIZE;
+            for (int address = start; address < start + MEM_PAGE_SIZE;
+                 address++) {
+                block_memwrite(machine->blocks, address);
+            }
+        }
+        memcpy(words, from->words, PAGE_BYTES);
+    }
+
+    machine->cpu = snapshot->cpu;
+    machine->supervisor = snapshot->supervisor;
+    machine->priority = snapshot->priority;
+    machine->saved_ssp = snapshot->saved_ssp;
+    machine->saved_usp = snapshot->saved_usp;
+    machine->kbsr_ie = snapshot->kbsr_ie;
+    machine->key_latched = snapshot->key_latched;
+    interrupt_free(machine->interrupts);
+    machine->interrupts = interrupt_copy(snapshot->interrupts);
+    machine->stop = X16_STOP_HALT;
+    machine->yield = false;
+    machine->idle_polls = 0;
+
+    set_base(machine, snapshot);
+}
+
+// Create a machine in the state of a snapshot
+x16_t* x16_fork(x16_snapshot_t* snapshot) {
+    x16_t* machine = x16_create();
+    if (machine != NULL) {
+        x16_restore(machine, snapshot);
+    }
+    return machine;
+}
+
+// The pages two snapshots share
+int snapshot_shared(const x16_snapshot_t* a, const x16_snapshot_t* b) {
+    int shared = 0;
+    for (int page = 0; page < MEM_PAGES; page++) {
+        shared += a->pages[page] == b->pages[page];
+    }
+    return shared;
+}
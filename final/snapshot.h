@@ -0,0 +1,21 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "x16.h"
+
+// Snapshots of machines (see x16_snapshot()). A snapshot holds memory as
+// MEM_PAGES pages with reference counts, so snapshots taken one after
+// the other from a machine share every page it did not write in
+// between, and restoring one only copies the pages that differ from what
+// the machine holds. Pages of zeros are all one page that is never freed.
+//
+// The machine keeps its memory in one array, which every engine reads
+// directly. It remembers the snapshot it was last saved to or restored
+// from (machine->base) and marks each page it writes after that in
+// machine->dirty, so a clean page is the same as the base's. Device
+// pages are not tracked and are always compared.
+
+// The pages two snapshots share
+int snapshot_shared(const x16_snapshot_t* a, const x16_snapshot_t* b);
+
+#endif  // SNAPSHOT_H_
@@ -0,0 +1,39 @@
+// The loop of the switch engine. engine.c includes this file once for
+// every feature set, with FEATURES defined to the feature mask (see
+// feature.h), so there is no include guard.
+
+// Run execute_instruction in a loop, built for FEATURES
+static int SWITCH_VARIANT(FEATURES)(x16_t* machine,
+                                    uint64_t max_instructions,
+                                    uint64_t* executed) {
+    const uint8_t* breakpoints = x16_breakpoints(machine);
+    (void) breakpoints;
+    uint64_t count = 0;
+    int rv = 0;
+    while (max_instructions == 0 || count < max_instructions) {
+        if (FEATURES != 0) {
+            uint16_t pc = cpu_pc(&machine->cpu);
+            if ((FEATURES & FEATURE_BREAKPOINTS) && count > 0 &&
+                breakpoints[pc]) {
+                x16_stop(machine, X16_STOP_BREAKPOINT);
+                rv = -1;
+                break;
+            }
+            uint16_t instruction = machine->memory[pc];
+            if (FEATURES & FEATURE_TRACE) {
+                feature_trace(pc, instruction);
+            }
+            if (FEATURES & FEATURE_PROFILE) {
+                PROFILE_COUNTS[getopcode(instruction)]++;
+            }
+        }
+        count++;
+        if ((rv = execute_instruction(machine)) != 0 || machine->yield) {
+            break;
+        }
+    }
+    if (executed != NULL) {
+        *executed = count;
+    }
+    return rv;
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "catch.hpp"
+
+extern "C" {
+#include "console.h"
+#include "engine.h"
+#include "instruction.h"
+#include "machine.h"
+#include "x16.h"
+}
+
+static std::string read_file(const std::string& path) {
+    std::string text;
+    FILE* fp = fopen(path.c_str(), "rb");
+    REQUIRE(fp != NULL);
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        text.append(buffer, n);
+    }
+    fclose(fp);
+    return text;
+}
+
+// Translate the program at 0x3000 with x16aot, run it, and run it again
+// with the switch engine. Both must end with the same registers,
+// instruction count, memory and output.
+static void compare(const std::vector<uint16_t>& program) {
+    char dir[] = "/tmp/x16aotXXXXXX";
+    REQUIRE(mkdtemp(dir) != NULL);
+    std::string base = std::string(dir) + "/prog";
+
+    FILE* fp = fopen((base + ".obj").c_str(), "wb");
+    REQUIRE(fp != NULL);
+    fputc(0x30, fp);
+    fputc(0x00, fp);
+    for (uint16_t word : program) {
+        fputc(word >> 8, fp);
+        fputc(word & 0xff, fp);
+    }
+    fclose(fp);
+    std::string command = "make -s " + base + "-aot >/dev/null 2>&1 && " +
+        base + "-aot -n 1000000 -d " + base + ".state <" + " /dev/null >" +
+        base + ".out 2>/dev/null";
+    REQUIRE(system(command.c_str()) == 0);
+
+    x16_t* machine = x16_create();
+    x16_set_console(machine, console_memory_create("", 0));
+    for (size_t i = 0; i < program.size(); i++) {
+        x16_memwrite(machine, 0x3000 + i, program[i]);
+    }
+    uint64_t executed;
+    REQUIRE(engine_run(machine, ENGINE_SWITCH, 1000000, &executed) == -1);
+    x16_flush(machine);
+
+    std::string state = read_file(base + ".state");
+    uint16_t reg[MAX_REGISTERS];
+    uint64_t aot_executed;
+    REQUIRE(state.size() == sizeof(reg) + sizeof(aot_executed) +
+            MAX_MEMORY * sizeof(uint16_t));
+    memcpy(reg, state.data(), sizeof(reg));
+    memcpy(&aot_executed, state.data() + sizeof(reg), sizeof(aot_executed));
+    const uint16_t* memory = (const uint16_t*)
+        (state.data() + sizeof(reg) + sizeof(aot_executed));
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        INFO("register " << i);
+        REQUIRE(reg[i] == x16_reg(machine, (reg_t) i));
+    }
+    REQUIRE(aot_executed == x16_executed(machine));
+    for (int address = 0; address < MAX_MEMORY; address++) {
+        if (!machine_is_io(machine, address) &&
+            memory[address] != machine->memory[address]) {
+            FAIL("memory differs at " << address);
+        }
+    }
+
+    size_t length;
+    const char* output = console_memory_output(machine_console(machine),
+                                               &length);
+    REQUIRE(read_file(base + ".out") == std::string(output, length));
+    x16_free(machine);
+    REQUIRE(system((std::string("rm -r ") + dir).c_str()) == 0);
+}
+
+TEST_CASE("Aot.run", "[aot]") {
+    // Add up 5..1, keep the sums in a table, print them as letters and
+    // halt
+    compare({
+        emit_and_imm(R_R0, R_R0, 0),
+        emit_add_imm(R_R1, R_R0, 5),
+        emit_lea(R_R2, 10),                                     // table
+        // loop:
+        emit_add_reg(R_R3, R_R3, R_R1),
+        emit_str(R_R3, R_R2, 0),
+        emit_ld(R_R0, 7),                                       // 'A'
+        emit_add_reg(R_R0, R_R0, R_R3),
+        emit_trap(TRAP_OUT),
+        emit_add_imm(R_R2, R_R2, 1),
+        emit_add_imm(R_R1, R_R1, -1),
+        emit_br(false, false, true, -8),                        // loop
+        emit_trap(TRAP_HALT),
+        emit_value('A'),
+        // table:
+        emit_value(0),
+    });
+}
+
+TEST_CASE("Aot.patch", "[aot]") {
+    // A routine reached only through JSRR, so interpreted, patches the
+    // translated ADD at 0x3001 into an ADD of 10 before the second pass
+    std::vector<uint16_t> program = {
+        emit_and_imm(R_R2, R_R2, 0),
+        // target:
+        emit_add_imm(R_R0, R_R0, 1),
+        emit_add_imm(R_R2, R_R2, 1),
+        emit_add_imm(R_R3, R_R2, -2),
+        emit_br(false, true, false, 3),                         // done
+        emit_ld(R_R1, 3),                                       // patcher
+        emit_jsrr(R_R1),
+        emit_br(true, true, true, -7),                          // target
+        // done:
+        emit_trap(TRAP_HALT),
+        emit_value(0x3100),                                     // patcher
+    };
+    program.resize(0x100);
+    program.push_back(emit_ld(R_R4, 3));                        // new
+    program.push_back(emit_ld(R_R5, 3));                        // target
+    program.push_back(emit_str(R_R4, R_R5, 0));
+    program.push_back(emit_jmp(R_R7));
+    program.push_back(emit_add_imm(R_R0, R_R0, 10));            // new
+    program.push_back(emit_value(0x3001));                      // target
+    compare(program);
+}
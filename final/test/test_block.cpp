@@ -0,0 +1,168 @@
+#include "catch.hpp"
+
+extern "C" {
+#include "block.h"
+#include "control.h"
+#include "engine.h"
+#include "x16.h"
+#include "instruction.h"
+}
+
+// Beginning program counter
+static int CODESTART = 0x3000;
+
+// ----------------- Test store into the running block
+
+// This function initializes the machine with a program that overwrites
+// an instruction further down in its own block
+static x16_t* setup_test_machine_patch_ahead() {
+    x16_t* machine = x16_create();
+
+    x16_memwrite(machine, CODESTART, emit_ld(R_R1, 3));
+    x16_memwrite(machine, CODESTART + 1, emit_st(R_R1, 0));
+    x16_memwrite(machine, CODESTART + 2, emit_add_imm(R_R2, R_R2, 1));
+    x16_memwrite(machine, CODESTART + 3, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, CODESTART + 4, emit_add_imm(R_R2, R_R2, 5));
+    x16_set(machine, R_PC, CODESTART);
+
+    return machine;
+}
+
+TEST_CASE("Block.smc.ahead", "[block]") {
+    x16_t* machine = setup_test_machine_patch_ahead();
+
+    REQUIRE(execute_blocks(machine, 0, NULL) == -1);
+
+    // The patched instruction ran, not the translated one
+    REQUIRE(x16_reg(machine, R_R2) == 5);
+
+    x16_free(machine);
+}
+
+// ----------------- Test store into a block that already ran
+
+// This function initializes the machine with a loop that patches its
+// own body after the first iteration
+static x16_t* setup_test_machine_patch_loop() {
+    x16_t* machine = x16_create();
+
+    x16_memwrite(machine, CODESTART, emit_and_imm(R_R2, R_R2, 0));
+    x16_memwrite(machine, CODESTART + 1, emit_add_imm(R_R3, R_R2, 2));
+    // loop:
+    x16_memwrite(machine, CODESTART + 2, emit_add_imm(R_R2, R_R2, 1));
+    x16_memwrite(machine, CODESTART + 3, emit_ld(R_R1, 4));
+    x16_memwrite(machine, CODESTART + 4, emit_st(R_R1, -3));
+    x16_memwrite(machine, CODESTART + 5, emit_add_imm(R_R3, R_R3, -1));
+    x16_memwrite(machine, CODESTART + 6, emit_br(false, false, true, -5));
+    x16_memwrite(machine, CODESTART + 7, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, CODESTART + 8, emit_add_imm(R_R2, R_R2, 5));
+    x16_set(machine, R_PC, CODESTART);
+
+    return machine;
+}
+
+TEST_CASE("Block.smc.loop", "[block]") {
+    x16_t* machine = setup_test_machine_patch_loop();
+
+    REQUIRE(execute_blocks(machine, 0, NULL) == -1);
+    REQUIRE(x16_reg(machine, R_R2) == 1 + 5);
+
+    block_cache_t* cache = x16_block_cache(machine);
+    REQUIRE(cache->invalidations > 0);
+
+    x16_free(machine);
+}
+
+// ----------------- Test writes next to code
+
+TEST_CASE("Block.invalidate", "[block]") {
+    x16_t* machine = setup_test_machine_patch_loop();
+    block_cache_t* cache = x16_block_cache(machine);
+
+    block_t* block = block_translate(machine, CODESTART + 2);
+    REQUIRE(block->length == 5);
+    REQUIRE(cache->blocks[CODESTART + 2] == block);
+
+    // A write outside the block leaves it alone
+    x16_memwrite(machine, CODESTART + 8, 0);
+    REQUIRE(cache->blocks[CODESTART + 2] == block);
+
+    // A write into the block drops it
+    x16_memwrite(machine, CODESTART + 6, 0);
+    REQUIRE(cache->blocks[CODESTART + 2] == NULL);
+
+    x16_free(machine);
+}
+
+// ----------------- Test fused micro-ops
+
+// This function initializes the machine with a loop that has an LDR+ADD
+// and an ADD+BR pair, followed by an LD+TRAP pair
+static x16_t* setup_test_machine_fused() {
+    x16_t* machine = x16_create();
+
+    x16_memwrite(machine, CODESTART, emit_and_imm(R_R0, R_R0, 0));
+    x16_memwrite(machine, CODESTART + 1, emit_add_imm(R_R1, R_R0, 3));
+    x16_memwrite(machine, CODESTART + 2, emit_lea(R_R2, 6));
+    // loop:
+    x16_memwrite(machine, CODESTART + 3, emit_ldr(R_R3, R_R2, 0));
+    x16_memwrite(machine, CODESTART + 4, emit_add_reg(R_R0, R_R0, R_R3));
+    x16_memwrite(machine, CODESTART + 5, emit_add_imm(R_R1, R_R1, -1));
+    x16_memwrite(machine, CODESTART + 6, emit_br(false, false, true, -4));
+    x16_memwrite(machine, CODESTART + 7, emit_ld(R_R4, 1));
+    x16_memwrite(machine, CODESTART + 8, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, CODESTART + 9, emit_value(7));
+    x16_set(machine, R_PC, CODESTART);
+
+    return machine;
+}
+
+TEST_CASE("Block.fusion", "[block]") {
+    x16_t* machine = setup_test_machine_fused();
+
+    block_t* block = block_build(machine, CODESTART + 3, MAX_BLOCK_LENGTH);
+    REQUIRE(block->length == 4);
+#ifndef X16_NO_FUSION
+    REQUIRE(block->ops[0].kind == UOP_LDR_ADD_REG);
+    REQUIRE(block->ops[1].kind == UOP_ADD_REG);
+    REQUIRE(block->ops[2].kind == UOP_ADD_IMM_BR);
+    REQUIRE(block->ops[3].kind == UOP_BR);
+#endif
+    REQUIRE(uop_unfused(block->ops[0].kind) == UOP_LDR);
+    free(block);
+
+    // Guest state matches the switch interpreter, including the counts
+    x16_t* reference = setup_test_machine_fused();
+    uint64_t executed, expected;
+    REQUIRE(engine_run(reference, ENGINE_SWITCH, 0, &expected) == -1);
+    REQUIRE(engine_run(machine, ENGINE_BLOCK, 0, &executed) == -1);
+    REQUIRE(executed == expected);
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        REQUIRE(x16_reg(machine, (reg_t) i) == x16_reg(reference, (reg_t) i));
+    }
+    REQUIRE(x16_reg(machine, R_R0) == 21);
+    REQUIRE(x16_reg(machine, R_R4) == 7);
+
+    x16_free(reference);
+    x16_free(machine);
+}
+
+// A block entered between the two ops of a pair runs only the second
+TEST_CASE("Block.fusion.enter", "[block]") {
+    x16_t* machine = setup_test_machine_fused();
+    x16_set(machine, R_R1, 1);
+    x16_set(machine, R_R2, CODESTART + 9);
+
+    block_t* block = block_build(machine, CODESTART + 3, MAX_BLOCK_LENGTH);
+    uint16_t reg[MAX_REGISTERS];
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        reg[i] = x16_reg(machine, (reg_t) i);
+    }
+    int rv = 0;
+    REQUIRE(block_interpret(machine, block, 1, reg, &rv) == 3);
+    REQUIRE(reg[R_R3] == 0);
+    REQUIRE(reg[R_R1] == 0);
+    REQUIRE(reg[R_PC] == CODESTART + 7);
+    free(block);
+    x16_free(machine);
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <string>
+#include "catch.hpp"
+
+extern "C" {
+#include "console.h"
+#include "instruction.h"
+#include "x16.h"
+}
+
+TEST_CASE("Console.memory", "[console]") {
+    console_t* console = console_memory_create("ab", 2);
+    REQUIRE(console->ops->ready(console));
+    REQUIRE(console->ops->poll(console) == 'a');
+    REQUIRE(console->ops->getc(console) == 'b');
+    REQUIRE(console->ops->poll(console) == EOF);
+    REQUIRE(console->ops->getc(console) == EOF);
+
+    size_t length;
+    REQUIRE(std::string(console_memory_output(console, &length)) == "");
+    REQUIRE(length == 0);
+
+    // Output grows past the first buffer
+    std::string expected;
+    for (int i = 0; i < 10000; i++) {
+        char c = (char) ('a' + i % 26);
+        console_putc(console, c);
+        expected += c;
+    }
+    console_write(console, "xyz", 3);
+    expected += "xyz";
+    const char* output = console_memory_output(console, &length);
+    REQUIRE(std::string(output, length) == expected);
+    console_free(console);
+}
+
+TEST_CASE("Console.null", "[console]") {
+    console_t* console = console_null_create();
+    REQUIRE(console->ops->ready(console));
+    REQUIRE(console->ops->poll(console) == EOF);
+    REQUIRE(console->ops->getc(console) == EOF);
+    console_write(console, "gone", 4);
+    console_free(console);
+}
+
+TEST_CASE("Console.script", "[console]") {
+    console_t* console = console_script_create("ab", 2);
+    REQUIRE(console->ops->poll(console) == 'a');
+    REQUIRE(console->ops->getc(console) == 'b');
+    REQUIRE(!console->ops->ready(console));
+    REQUIRE(console->ops->poll(console) == CONSOLE_EMPTY);
+    REQUIRE(!console->ops->sleep(console, 1000));
+
+    // GETC stops a machine waiting for input once the keys are used up
+    x16_t* machine = x16_create();
+    x16_set_console(machine, console_script_create("x", 1));
+    x16_set_input_wait(machine, true);
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_GETC));
+    x16_stop_info_t info;
+    REQUIRE(x16_run(machine, 0, &info) == X16_STOP_INPUT);
+    REQUIRE(info.executed == 1);
+    REQUIRE(x16_reg(machine, R_R0) == 'x');
+    x16_free(machine);
+    console_free(console);
+}
+
+TEST_CASE("Console.machine", "[console]") {
+    x16_t* machine = x16_create();
+    console_t* console = console_memory_create("hi", 2);
+    x16_set_console(machine, console);
+
+    // Echo both keys
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_stop_info_t info;
+    REQUIRE(x16_run(machine, 0, &info) == X16_STOP_HALT);
+
+    size_t length;
+    const char* output = console_memory_output(console, &length);
+    REQUIRE(std::string(output, length) == "hiHALT\n\n");
+    REQUIRE(x16_input_ready(machine));
+    REQUIRE(x16_getchar(machine) == EOF);
+    x16_free(machine);
+}
@@ -4,6 +4,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <cstring>
+#include <string>
 
 extern "C" {
 #include "control.h"
@@ -367,3 +368,71 @@ TEST_CASE("Control.trap.putsp", "[control.trap]") {
         REQUIRE(WEXITSTATUS(status) == 0);
     }
 }
+
+//  --------------------  Test long strings
+
+// Run the trap at CODESTART on a memory console and return what it printed
+static std::string run_trap_output(x16_t* machine) {
+    console_t* console = console_memory_create("", 0);
+    x16_set_console(machine, console);
+    x16_set(machine, R_PC, CODESTART);
+    REQUIRE(execute_instruction(machine) == 0);
+    size_t length;
+    const char* output = console_memory_output(console, &length);
+    std::string out(output, length);
+    x16_set_console(machine, NULL);
+    return out;
+}
+
+TEST_CASE("Control.trap.puts.long", "[control.trap]") {
+    x16_t* machine = x16_create();
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_PUTS));
+
+    // 1000 characters across page and chunk boundaries. The high bytes
+    // are not printed.
+    std::string expected;
+    uint16_t start = 0x40f3;
+    for (int i = 0; i < 1000; i++) {
+        char c = (char) (1 + i % 255);
+        expected += c;
+        x16_memwrite(machine, start + i, (uint16_t) ((i << 8) | (uint8_t) c));
+    }
+    x16_memwrite(machine, start + 1000, 0x4200);    // low byte 0 ends it
+    x16_set(machine, R_R0, start);
+    REQUIRE(run_trap_output(machine) == expected);
+
+    // A string that runs into the keyboard page ends at MR_KBSR, which
+    // reads 0 with no key waiting
+    expected.clear();
+    for (uint16_t a = 0xfdf0; a < 0xfe00; a++) {
+        x16_memwrite(machine, a, 'a' + (a & 15));
+        expected += (char) ('a' + (a & 15));
+    }
+    x16_set(machine, R_R0, 0xfdf0);
+    REQUIRE(run_trap_output(machine) == expected);
+    x16_free(machine);
+}
+
+TEST_CASE("Control.trap.putsp.long", "[control.trap]") {
+    x16_t* machine = x16_create();
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_PUTSP));
+
+    // Two characters a word, except for a word with a 0 high byte in the
+    // middle, which prints one
+    std::string expected;
+    uint16_t start = 0x50fb;
+    for (int i = 0; i < 700; i++) {
+        char low = (char) ('A' + i % 26);
+        char high = i == 333 ? 0 : (char) ('a' + i % 26);
+        expected += low;
+        if (high != 0) {
+            expected += high;
+        }
+        x16_memwrite(machine, start + i,
+                     (uint16_t) (((uint8_t) high << 8) | (uint8_t) low));
+    }
+    x16_memwrite(machine, start + 700, 0);
+    x16_set(machine, R_R0, start);
+    REQUIRE(run_trap_output(machine) == expected);
+    x16_free(machine);
+}
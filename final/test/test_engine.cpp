@@ -0,0 +1,180 @@
+#include "catch.hpp"
+
+extern "C" {
+#include "control.h"
+#include "engine.h"
+#include "x16.h"
+#include "instruction.h"
+}
+
+// Beginning program counter
+static int CODESTART = 0x3000;
+
+// Data area used by the program
+static int DATA = 0x4000;
+
+// This function initializes the machine with a small program that uses
+// every non trap instruction: it sums the numbers 1..10 through memory,
+// calls a subroutine and halts.
+static x16_t* setup_test_machine_program() {
+    x16_t* machine = x16_create();
+    int pc = CODESTART;
+
+    x16_memwrite(machine, pc++, emit_and_imm(R_R0, R_R0, 0));     // r0 = 0
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R0, 10));    // r1 = 10
+    x16_memwrite(machine, pc++, emit_ld(R_R2, 12));               // r2 = DATA
+    // loop:
+    x16_memwrite(machine, pc++, emit_str(R_R1, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_ldr(R_R3, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_add_reg(R_R0, R_R0, R_R3));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, -1));
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -5));
+    x16_memwrite(machine, pc++, emit_jsr(4));                     // sub
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 5));               // *DATA
+    x16_memwrite(machine, pc++, emit_ldi(R_R5, 4));
+    x16_memwrite(machine, pc++, emit_lea(R_R6, -3));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    // sub:
+    x16_memwrite(machine, pc++, emit_not(R_R4, R_R0));
+    x16_memwrite(machine, pc++, emit_jmp(R_R7));
+    x16_memwrite(machine, pc++, emit_value(DATA));
+
+    x16_set(machine, R_PC, CODESTART);
+    return machine;
+}
+
+// Run the program with the given engine and check the final state
+static void check_engine(engine_t engine) {
+    x16_t* machine = setup_test_machine_program();
+
+    uint64_t executed = 0;
+    int rv = engine_run(machine, engine, 0, &executed);
+    REQUIRE(rv == -1);
+    REQUIRE(executed == 60);
+
+    REQUIRE(x16_reg(machine, R_R0) == 55);
+    REQUIRE(x16_reg(machine, R_R1) == 0);
+    REQUIRE(x16_reg(machine, R_R4) == (uint16_t) ~55);
+    REQUIRE(x16_reg(machine, R_R5) == 55);
+    REQUIRE(x16_reg(machine, R_R6) == CODESTART + 9);
+    REQUIRE(x16_reg(machine, R_R7) == CODESTART + 9);
+    REQUIRE(x16_reg(machine, R_PC) == CODESTART + 13);
+    REQUIRE(x16_memread(machine, DATA) == 55);
+
+    x16_free(machine);
+}
+
+TEST_CASE("Engine.switch", "[engine]") {
+    check_engine(ENGINE_SWITCH);
+}
+
+TEST_CASE("Engine.threaded", "[engine]") {
+    engine_t engine;
+    if (engine_parse("threaded", &engine) == 0) {
+        check_engine(engine);
+    }
+}
+
+TEST_CASE("Engine.block", "[engine]") {
+    check_engine(ENGINE_BLOCK);
+}
+
+TEST_CASE("Engine.jit", "[engine]") {
+    engine_t engine;
+    if (engine_parse("jit", &engine) == 0) {
+        check_engine(engine);
+    }
+}
+
+// Every engine stops when the budget runs out and can be resumed
+TEST_CASE("Engine.budget", "[engine]") {
+    engine_t engines[] = {
+        ENGINE_SWITCH, engine_default(), ENGINE_BLOCK, ENGINE_JIT
+    };
+    for (engine_t engine : engines) {
+        x16_t* machine = setup_test_machine_program();
+        uint64_t executed = 0;
+        REQUIRE(engine_run(machine, engine, 3, &executed) == 0);
+        REQUIRE(executed == 3);
+        REQUIRE(x16_reg(machine, R_PC) == CODESTART + 3);
+        REQUIRE(x16_reg(machine, R_R1) == 10);
+
+        REQUIRE(engine_run(machine, engine, 0, &executed) == -1);
+        REQUIRE(executed == 57);
+        REQUIRE(x16_reg(machine, R_R0) == 55);
+        x16_free(machine);
+    }
+}
+
+// The condition codes are computed from the last result when read, and an
+// explicit write of R_COND replaces a pending result
+TEST_CASE("Engine.cond", "[engine]") {
+    x16_t* machine = x16_create();
+    REQUIRE(x16_cond(machine) == FL_ZRO);
+    x16_set_result(machine, 0x8000);
+    REQUIRE(x16_reg(machine, R_COND) == FL_NEG);
+    x16_set_result(machine, 5);
+    x16_set(machine, R_COND, FL_ZRO);
+    REQUIRE(x16_cond(machine) == FL_ZRO);
+    x16_free(machine);
+
+    // Every engine leaves the flags of the last result in the machine
+    engine_t engines[] = {
+        ENGINE_SWITCH, engine_default(), ENGINE_BLOCK, ENGINE_JIT
+    };
+    for (engine_t engine : engines) {
+        machine = x16_create();
+        int pc = CODESTART;
+        x16_memwrite(machine, pc++, emit_add_imm(R_R0, R_R0, -1));
+        x16_memwrite(machine, pc++, emit_st(R_R0, 2));
+        x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+        REQUIRE(engine_run(machine, engine, 0, NULL) == -1);
+        REQUIRE(x16_cond(machine) == FL_NEG);
+        x16_free(machine);
+    }
+}
+
+// A device with its own registers that counts accesses
+typedef struct {
+    uint16_t registers[MEM_PAGE_SIZE];
+    int reads;
+    int writes;
+} test_device_t;
+
+static uint16_t test_device_read(x16_t* machine, void* device,
+                                 uint16_t address) {
+    test_device_t* t = (test_device_t*) device;
+    t->reads++;
+    return t->registers[address % MEM_PAGE_SIZE];
+}
+
+static void test_device_write(x16_t* machine, void* device,
+                              uint16_t address, uint16_t value) {
+    test_device_t* t = (test_device_t*) device;
+    t->writes++;
+    t->registers[address % MEM_PAGE_SIZE] = value;
+}
+
+// Every engine sends the accesses to a device page to the device
+TEST_CASE("Engine.device", "[engine]") {
+    engine_t engines[] = {
+        ENGINE_SWITCH, engine_default(), ENGINE_BLOCK, ENGINE_JIT
+    };
+    for (engine_t engine : engines) {
+        x16_t* machine = setup_test_machine_program();
+        test_device_t device = {};
+        uint8_t page = DATA >> MEM_PAGE_SHIFT;
+        REQUIRE(x16_map_device(machine, page, test_device_read,
+                               test_device_write, &device) == 0);
+        REQUIRE(x16_map_device(machine, page, NULL, NULL, NULL) == -1);
+
+        REQUIRE(engine_run(machine, engine, 0, NULL) == -1);
+        REQUIRE(x16_reg(machine, R_R0) == 55);
+        REQUIRE(x16_reg(machine, R_R5) == 55);
+        REQUIRE(device.registers[0] == 55);
+        REQUIRE(device.writes == 11);
+        REQUIRE(device.reads == 11);
+        REQUIRE(*x16_memory(machine, DATA) == 0);
+        x16_free(machine);
+    }
+}
@@ -0,0 +1,47 @@
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include "catch.hpp"
+
+extern "C" {
+#include "event.h"
+}
+
+TEST_CASE("Event.order", "[event]") {
+    event_queue_t queue;
+    event_queue_init(&queue);
+    REQUIRE(event_next(&queue) == EVENT_NEVER);
+
+    std::vector<uint64_t> due;
+    srand(16);
+    for (int i = 0; i < 1000; i++) {
+        uint64_t at = rand() % 5000;
+        event_push(&queue, at, i % 3);
+        due.push_back(at);
+    }
+    std::sort(due.begin(), due.end());
+    for (uint64_t at : due) {
+        REQUIRE(event_next(&queue) == at);
+        REQUIRE(event_pop(&queue).at == at);
+    }
+    REQUIRE(event_next(&queue) == EVENT_NEVER);
+    event_queue_free(&queue);
+}
+
+TEST_CASE("Event.cancel", "[event]") {
+    event_queue_t queue;
+    event_queue_init(&queue);
+    for (int i = 0; i < 100; i++) {
+        event_push(&queue, 100 - i, i % 2);
+    }
+    event_cancel(&queue, 1);
+    REQUIRE(queue.count == 50);
+    uint64_t last = 0;
+    while (queue.count > 0) {
+        event_t event = event_pop(&queue);
+        REQUIRE(event.kind == 0);
+        REQUIRE(event.at >= last);
+        last = event.at;
+    }
+    event_queue_free(&queue);
+}
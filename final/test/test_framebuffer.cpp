@@ -0,0 +1,93 @@
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "catch.hpp"
+
+extern "C" {
+#include "console.h"
+#include "framebuffer.h"
+#include "instruction.h"
+#include "x16.h"
+}
+
+// What a memory console got since the last call
+static std::string drain(console_t* console, size_t* seen) {
+    size_t length;
+    const char* output = console_memory_output(console, &length);
+    std::string got(output + *seen, length - *seen);
+    *seen = length;
+    return got;
+}
+
+TEST_CASE("Framebuffer.map", "[framebuffer]") {
+    x16_t* machine = x16_create();
+    x16_set_console(machine, console_null_create());
+    REQUIRE(x16_map_framebuffer(machine) == 0);
+    REQUIRE(x16_map_framebuffer(machine) == -1);
+
+    x16_memwrite(machine, MR_FB + 5, 'A');
+    REQUIRE(x16_memread(machine, MR_FB + 5) == 'A');
+    REQUIRE(x16_memread(machine, MR_FB + FB_ROWS * FB_COLS) == 0);
+
+    // A guest draws with plain stores
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_ld(R_R1, 4));
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 4));
+    x16_memwrite(machine, pc++, emit_str(R_R0, R_R1, 3));
+    x16_memwrite(machine, pc++, emit_ldr(R_R2, R_R1, 3));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, MR_FB + FB_COLS);
+    x16_memwrite(machine, pc++, 'Z');
+    x16_stop_info_t info;
+    REQUIRE(x16_run(machine, 0, &info) == X16_STOP_HALT);
+    REQUIRE(x16_reg(machine, R_R2) == 'Z');
+    REQUIRE(x16_memread(machine, MR_FB + FB_COLS + 3) == 'Z');
+    x16_free(machine);
+}
+
+TEST_CASE("Framebuffer.render", "[framebuffer]") {
+    console_t* console = console_memory_create("", 0);
+    size_t seen = 0;
+    x16_t* machine = x16_create();
+    framebuffer_t* fb = framebuffer_create(machine);
+    REQUIRE(fb != NULL);
+
+    // The first frame clears the screen and draws the cells written
+    x16_memwrite(machine, MR_FB, 'H');
+    x16_memwrite(machine, MR_FB + 1, 'i');
+    x16_memwrite(machine, MR_FB + 2 * FB_COLS + 10, 'X');
+    framebuffer_render(fb, console, true);
+    REQUIRE(drain(console, &seen) ==
+            "\x1b[2J\x1b[?25l\x1b[1;1HHi\x1b[3;11HX");
+
+    // Then only what changed
+    x16_memwrite(machine, MR_FB + 2 * FB_COLS + 10, 'Y');
+    x16_memwrite(machine, MR_FB + 1, 'i');
+    framebuffer_render(fb, console, true);
+    REQUIRE(drain(console, &seen) == "\x1b[3;11HY");
+
+    // A short gap is redrawn rather than skipped
+    x16_memwrite(machine, MR_FB + 4 * FB_COLS, 'a');
+    x16_memwrite(machine, MR_FB + 4 * FB_COLS + 3, 'b');
+    framebuffer_render(fb, console, true);
+    REQUIRE(drain(console, &seen) == "\x1b[5;1Ha  b");
+
+    // Frames are capped at FB_FPS unless forced
+    x16_memwrite(machine, MR_FB, 'J');
+    framebuffer_render(fb, console, false);
+    REQUIRE(framebuffer_stats(fb).frames == 3);
+    usleep(1000000 / FB_FPS + 1000);
+    framebuffer_render(fb, console, false);
+    REQUIRE(framebuffer_stats(fb).frames == 4);
+    REQUIRE(drain(console, &seen) == "\x1b[1;1HJ");
+
+    // Nothing changed, nothing drawn
+    framebuffer_render(fb, console, true);
+    REQUIRE(framebuffer_stats(fb).frames == 4);
+    REQUIRE(framebuffer_stats(fb).cells == 7);
+
+    framebuffer_free(fb, console);
+    REQUIRE(drain(console, &seen) == "\x1b[26;1H\x1b[?25h");
+    console_free(console);
+    x16_free(machine);
+}
@@ -0,0 +1,64 @@
+#include <time.h>
+#include "catch.hpp"
+
+extern "C" {
+#include "governor.h"
+#include "instruction.h"
+#include "x16.h"
+}
+
+// Seconds on the monotonic clock
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+TEST_CASE("Governor.parse", "[governor]") {
+    uint64_t hz = 0;
+    REQUIRE(governor_parse("2MHz", &hz) == 0);
+    REQUIRE(hz == 2000000);
+    REQUIRE(governor_parse("500khz", &hz) == 0);
+    REQUIRE(hz == 500000);
+    REQUIRE(governor_parse("1.5M", &hz) == 0);
+    REQUIRE(hz == 1500000);
+    REQUIRE(governor_parse("800000", &hz) == 0);
+    REQUIRE(hz == 800000);
+    REQUIRE(governor_parse("60 Hz", &hz) == 0);
+    REQUIRE(hz == 60);
+
+    REQUIRE(governor_parse("", &hz) == -1);
+    REQUIRE(governor_parse("fast", &hz) == -1);
+    REQUIRE(governor_parse("2MHzz", &hz) == -1);
+    REQUIRE(governor_parse("0", &hz) == -1);
+    REQUIRE(governor_parse("-1MHz", &hz) == -1);
+    REQUIRE(governor_parse("2GHz", &hz) == -1);
+}
+
+TEST_CASE("Governor.run", "[governor]") {
+    // Loop forever, so only the budget stops the run
+    x16_t* machine = x16_create();
+    x16_memwrite(machine, 0x3000, emit_br(true, true, true, -1));
+
+    governor_t governor;
+    governor_init(&governor, 1000000);
+    REQUIRE(governor.batch == 1000);
+
+    // 100 batches of 1 ms each. Not on the switch engine, which steps
+    // through the JIT when it is forced and then has no time to spare.
+    uint64_t executed = 0;
+    double start = now();
+    REQUIRE(governor_run(&governor, machine, ENGINE_THREADED, 100000,
+                         &executed) == 0);
+    double elapsed = now() - start;
+    REQUIRE(executed == 100000);
+    REQUIRE(elapsed >= 0.099);
+    REQUIRE(elapsed < 0.5);
+
+    const governor_stats_t* stats = &governor.stats;
+    REQUIRE(stats->executed == 100000);
+    REQUIRE(stats->batches == 100);
+    REQUIRE(stats->paced + stats->resyncs == 99);
+    REQUIRE(stats->sleep_ns + stats->spin_ns > 50000000);
+    x16_free(machine);
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "catch.hpp"
+
+extern "C" {
+#include "image.h"
+#include "image_cache.h"
+#include "machine.h"
+#include "x16.h"
+}
+
+// True when two machines hold the same memory
+static bool same_memory(x16_t* a, x16_t* b) {
+    return memcmp(a->memory, b->memory, MAX_MEMORY * sizeof(uint16_t)) == 0;
+}
+
+TEST_CASE("Image_cache.share", "[image_cache]") {
+    x16_t* expected = x16_create();
+    REQUIRE(read_image(expected, "rogue.obj") == 0);
+    image_cache_t* cache = image_cache_create(NULL);
+    x16_t* machines[3];
+    for (x16_t*& machine : machines) {
+        machine = x16_create();
+        REQUIRE(image_cache_read(cache, machine, "rogue.obj") == 0);
+        REQUIRE(same_memory(machine, expected));
+    }
+    image_cache_stats_t stats;
+    image_cache_stats(cache, &stats);
+    REQUIRE(stats.images == 1);
+    REQUIRE(stats.mapped == 3);
+    REQUIRE(stats.copied == 0);
+
+    // A write only changes the machine that made it, also after the
+    // cache is gone
+    image_cache_free(cache);
+    uint16_t word = x16_memread(machines[1], 0x3000);
+    x16_memwrite(machines[0], 0x3000, word + 1);
+    REQUIRE(x16_memread(machines[0], 0x3000) == word + 1);
+    REQUIRE(x16_memread(machines[1], 0x3000) == word);
+    REQUIRE(same_memory(machines[2], expected));
+    for (x16_t* machine : machines) {
+        x16_free(machine);
+    }
+    x16_free(expected);
+}
+
+TEST_CASE("Image_cache.copy", "[image_cache]") {
+    image_cache_t* cache = image_cache_create(NULL);
+    x16_t* machine = x16_create();
+    x16_t* expected = x16_create();
+    REQUIRE(image_cache_read(cache, machine, "no-such.obj") == -1);
+
+    // A word next to the image stays, as read_image() leaves it
+    x16_memwrite(machine, 0x3010, 5);
+    x16_memwrite(expected, 0x3010, 5);
+    REQUIRE(image_cache_read(cache, machine, "test/samples/loop.obj") == 0);
+    REQUIRE(read_image(expected, "test/samples/loop.obj") == 0);
+    REQUIRE(same_memory(machine, expected));
+
+    image_cache_stats_t stats;
+    image_cache_stats(cache, &stats);
+    REQUIRE(stats.images == 1);
+    REQUIRE(stats.mapped == 0);
+    REQUIRE(stats.copied == 1);
+    image_cache_free(cache);
+    x16_free(machine);
+    x16_free(expected);
+}
+
+TEST_CASE("Image_cache.dir", "[image_cache]") {
+    char dir[] = "/tmp/x16imagesXXXXXX";
+    REQUIRE(mkdtemp(dir) != NULL);
+    x16_t* expected = x16_create();
+    REQUIRE(read_image(expected, "rogue.obj") == 0);
+
+    // Caches on the same directory share its files
+    image_cache_t* caches[2];
+    for (image_cache_t*& cache : caches) {
+        cache = image_cache_create(dir);
+        x16_t* machine = x16_create();
+        REQUIRE(image_cache_read(cache, machine, "rogue.obj") == 0);
+        REQUIRE(same_memory(machine, expected));
+        x16_free(machine);
+
+        image_cache_stats_t stats;
+        image_cache_stats(cache, &stats);
+        REQUIRE(stats.mapped == 1);
+    }
+    for (image_cache_t* cache : caches) {
+        image_cache_free(cache);
+    }
+    REQUIRE(system((std::string("rm -r ") + dir).c_str()) == 0);
+    x16_free(expected);
+}
@@ -0,0 +1,72 @@
+#include <unistd.h>
+#include "catch.hpp"
+
+extern "C" {
+#include "input.h"
+}
+
+// Wait until the reader has something, for up to a second
+static bool wait_ready(input_t* input) {
+    for (int i = 0; i < 1000 && !input_ready(input); i++) {
+        usleep(1000);
+    }
+    return input_ready(input);
+}
+
+TEST_CASE("Input.poll", "[input]") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    input_t* input = input_create(fds[0]);
+    REQUIRE(input != NULL);
+    REQUIRE(input_poll(input) == INPUT_EMPTY);
+
+    REQUIRE(write(fds[1], "ab", 2) == 2);
+    REQUIRE(wait_ready(input));
+    REQUIRE(input_poll(input) == 'a');
+    REQUIRE(input_getc(input) == 'b');
+    REQUIRE(input_poll(input) == INPUT_EMPTY);
+
+    // The end of input is reported once every key was taken
+    REQUIRE(write(fds[1], "c", 1) == 1);
+    close(fds[1]);
+    REQUIRE(input_getc(input) == 'c');
+    REQUIRE(input_getc(input) == EOF);
+    REQUIRE(input_poll(input) == EOF);
+    REQUIRE(input_ready(input));
+
+    input_free(input);
+    close(fds[0]);
+}
+
+// More input than fits in the ring arrives in order
+TEST_CASE("Input.full", "[input]") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    input_t* input = input_create(fds[0]);
+    REQUIRE(input != NULL);
+
+    const int count = 5000;
+    for (int i = 0; i < count; i++) {
+        char c = 'a' + i % 26;
+        REQUIRE(write(fds[1], &c, 1) == 1);
+    }
+    close(fds[1]);
+    for (int i = 0; i < count; i++) {
+        REQUIRE(input_getc(input) == 'a' + i % 26);
+    }
+    REQUIRE(input_getc(input) == EOF);
+
+    input_free(input);
+    close(fds[0]);
+}
+
+// A reader blocked in poll() stops when it is freed
+TEST_CASE("Input.free", "[input]") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    input_t* input = input_create(fds[0]);
+    REQUIRE(input != NULL);
+    input_free(input);
+    close(fds[0]);
+    close(fds[1]);
+}
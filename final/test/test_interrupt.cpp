@@ -0,0 +1,232 @@
+#include <string>
+#include "catch.hpp"
+
+extern "C" {
+#include "console.h"
+#include "engine.h"
+#include "instruction.h"
+#include "machine.h"
+#include "x16.h"
+}
+
+static const engine_t engines[] = {
+    ENGINE_SWITCH, ENGINE_THREADED, ENGINE_BLOCK, ENGINE_JIT,
+};
+
+// Count timer interrupts in R2, reading MR_TMR into R3
+static void load_timer_handler(x16_t* machine) {
+    int pc = 0x3100;
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 1));
+    x16_memwrite(machine, pc++, emit_ldi(R_R3, 1));
+    x16_memwrite(machine, pc++, emit_rti());
+    x16_memwrite(machine, pc++, emit_value(MR_TMR));
+    x16_memwrite(machine, IVT_BASE + INT_TIMER, 0x3100);
+}
+
+// Start a timer of 100 instructions and count in R1 until it fires
+static void load_timer(x16_t* machine) {
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 6));                // interval
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 6));               // tmi
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 6));                // ie
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 6));               // tmr
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, 1));     // loop
+    x16_memwrite(machine, pc++, emit_br(true, true, true, -2));   // loop
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, emit_value(100));                 // interval
+    x16_memwrite(machine, pc++, emit_value(MR_TMI));              // tmi
+    x16_memwrite(machine, pc++, emit_value(TMR_IE));              // ie
+    x16_memwrite(machine, pc++, emit_value(MR_TMR));              // tmr
+    load_timer_handler(machine);
+}
+
+// Print the keys the keyboard interrupt brings, waiting in a branch to
+// itself
+static void load_keyboard(x16_t* machine) {
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 2));                // ie
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 2));               // kbsr
+    x16_memwrite(machine, pc++, emit_br(true, true, true, -1));
+    x16_memwrite(machine, pc++, emit_value(KBSR_IE));             // ie
+    x16_memwrite(machine, pc++, emit_value(MR_KBSR));             // kbsr
+
+    pc = 0x3100;
+    x16_memwrite(machine, pc++, emit_ldi(R_R0, 2));               // kbdr
+    x16_memwrite(machine, pc++, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, pc++, emit_rti());
+    x16_memwrite(machine, pc++, emit_value(MR_KBDR));             // kbdr
+    x16_memwrite(machine, IVT_BASE + INT_KEYBOARD, 0x3100);
+}
+
+// A timer every 50 instructions and a keyboard handler that counts down
+// from 200, then copies the timer count into R5
+static void load_nested(x16_t* machine) {
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 5));                // interval
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 5));               // tmi
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 5));                // ie
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 5));               // tmr
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 5));               // kbsr
+    x16_memwrite(machine, pc++, emit_br(true, true, true, -1));
+    x16_memwrite(machine, pc++, emit_value(50));                  // interval
+    x16_memwrite(machine, pc++, emit_value(MR_TMI));              // tmi
+    x16_memwrite(machine, pc++, emit_value(TMR_IE));              // ie
+    x16_memwrite(machine, pc++, emit_value(MR_TMR));              // tmr
+    x16_memwrite(machine, pc++, emit_value(MR_KBSR));             // kbsr
+    load_timer_handler(machine);
+
+    pc = 0x3200;
+    x16_memwrite(machine, pc++, emit_ld(R_R4, 5));                // count
+    x16_memwrite(machine, pc++, emit_add_imm(R_R4, R_R4, -1));    // loop
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -2)); // loop
+    x16_memwrite(machine, pc++, emit_add_imm(R_R5, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_ldi(R_R0, 2));               // kbdr
+    x16_memwrite(machine, pc++, emit_rti());
+    x16_memwrite(machine, pc++, emit_value(200));                 // count
+    x16_memwrite(machine, pc++, emit_value(MR_KBDR));             // kbdr
+    x16_memwrite(machine, IVT_BASE + INT_KEYBOARD, 0x3200);
+}
+
+TEST_CASE("Interrupt.timer", "[interrupt]") {
+    uint16_t pc = 0;
+    uint16_t r1 = 0;
+    for (engine_t engine : engines) {
+        x16_t* machine = x16_create();
+        load_timer(machine);
+        x16_set(machine, R_PC, 0x3000);
+
+        // The timer starts after the store at 2 and fires at 102, 202 and
+        // so on up to 902
+        uint64_t executed;
+        REQUIRE(engine_run(machine, engine, 1000, &executed) == 0);
+        REQUIRE(executed == 1000);
+        REQUIRE(x16_executed(machine) == 1000);
+        REQUIRE(x16_reg(machine, R_R2) == 9);
+        REQUIRE(x16_reg(machine, R_R3) == (TMR_FIRED | TMR_IE));
+
+        // Back in user mode on the user stack
+        REQUIRE(x16_psr(machine) == (PSR_USER | FL_POS));
+        REQUIRE(x16_reg(machine, R_R6) == 0);
+        REQUIRE(x16_memread(machine, SUPERVISOR_STACK - 1) ==
+                (PSR_USER | FL_POS));
+        if (engine == ENGINE_SWITCH) {
+            pc = x16_pc(machine);
+            r1 = x16_reg(machine, R_R1);
+        }
+        REQUIRE(x16_pc(machine) == pc);
+        REQUIRE(x16_reg(machine, R_R1) == r1);
+        x16_free(machine);
+    }
+}
+
+TEST_CASE("Interrupt.rti", "[interrupt]") {
+    // RTI in user mode is still illegal
+    for (engine_t engine : engines) {
+        x16_t* machine = x16_create();
+        x16_memwrite(machine, 0x3000, emit_rti());
+        x16_set(machine, R_PC, 0x3000);
+        uint64_t executed;
+        REQUIRE(engine_run(machine, engine, 0, &executed) == -1);
+        REQUIRE(x16_stop_reason(machine) == X16_STOP_ILLEGAL);
+        REQUIRE(executed == 0);
+        REQUIRE(x16_pc(machine) == 0x3000);
+        x16_free(machine);
+    }
+}
+
+// Take a timer interrupt whose handler puts psr in the saved PSR and
+// returns to code that counts a plain BR falling through in R1 and a BRn
+// falling through in R2
+static void load_psr(x16_t* machine, uint16_t psr) {
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 4));                // interval
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 4));               // tmi
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 4));                // ie
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 4));               // tmr
+    x16_memwrite(machine, pc++, emit_br(true, true, true, -1));
+    x16_memwrite(machine, pc++, emit_value(10));                  // interval
+    x16_memwrite(machine, pc++, emit_value(MR_TMI));              // tmi
+    x16_memwrite(machine, pc++, emit_value(TMR_IE));              // ie
+    x16_memwrite(machine, pc++, emit_value(MR_TMR));              // tmr
+
+    pc = 0x3100;
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 4));                // psr
+    x16_memwrite(machine, pc++, emit_str(R_R0, R_R6, 1));
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 3));                // check
+    x16_memwrite(machine, pc++, emit_str(R_R0, R_R6, 0));
+    x16_memwrite(machine, pc++, emit_rti());
+    x16_memwrite(machine, pc++, emit_value(psr));                 // psr
+    x16_memwrite(machine, pc++, emit_value(0x3200));              // check
+    x16_memwrite(machine, IVT_BASE + INT_TIMER, 0x3100);
+
+    pc = 0x3200;
+    x16_memwrite(machine, pc++, emit_br(false, false, false, 1));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, 1));
+    x16_memwrite(machine, pc++, emit_br(true, false, false, 1));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 1));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+}
+
+TEST_CASE("Interrupt.psr", "[interrupt]") {
+    // RTI restores a single flag, or Z for anything else
+    for (int cond : {0, (int) FL_NEG, (int) FL_POS, FL_NEG | FL_ZRO | FL_POS}) {
+        for (engine_t engine : engines) {
+            x16_t* machine = x16_create();
+            x16_set_console(machine, console_null_create());
+            load_psr(machine, PSR_USER | cond);
+            x16_set(machine, R_PC, 0x3000);
+            uint64_t executed;
+            INFO("cond " << cond << " engine " << engine_name(engine));
+            REQUIRE(engine_run(machine, engine, 1000, &executed) == -1);
+            REQUIRE(x16_stop_reason(machine) == X16_STOP_HALT);
+            REQUIRE(x16_reg(machine, R_R1) == 0);
+            REQUIRE(x16_reg(machine, R_R2) == (cond == FL_NEG ? 0 : 1));
+            x16_free(machine);
+        }
+    }
+}
+
+TEST_CASE("Interrupt.keyboard", "[interrupt]") {
+    for (engine_t engine : engines) {
+        x16_t* machine = x16_create();
+        console_t* console = console_memory_create("ab", 2);
+        x16_set_console(machine, console);
+        load_keyboard(machine);
+        x16_set(machine, R_PC, 0x3000);
+
+        // 'a' comes right after the store, 'b' at the next check and EOF
+        // at the one after
+        uint64_t executed;
+        REQUIRE(engine_run(machine, engine, KEYBOARD_CHECK + 5000,
+                           &executed) == 0);
+        REQUIRE(executed == KEYBOARD_CHECK + 5000);
+        x16_flush(machine);
+        size_t length;
+        const char* output = console_memory_output(console, &length);
+        REQUIRE(std::string(output, length) == "ab");
+
+        // The wait in between was skipped, not run
+        REQUIRE(machine->interrupts->taken == 2);
+        REQUIRE(machine->interrupts->skipped > KEYBOARD_CHECK / 2);
+        x16_free(machine);
+    }
+}
+
+TEST_CASE("Interrupt.priority", "[interrupt]") {
+    for (engine_t engine : engines) {
+        x16_t* machine = x16_create();
+        x16_set_console(machine, console_memory_create("a", 1));
+        load_nested(machine);
+        x16_set(machine, R_PC, 0x3000);
+
+        uint64_t executed;
+        REQUIRE(engine_run(machine, engine, 1000, &executed) == 0);
+        REQUIRE(x16_reg(machine, R_R0) == 'a');
+
+        // The timer ran inside the keyboard handler, and the keyboard
+        // handler's countdown survived it
+        REQUIRE(x16_reg(machine, R_R5) >= 7);
+        REQUIRE(x16_reg(machine, R_R4) == 0);
+        x16_free(machine);
+    }
+}
@@ -0,0 +1,164 @@
+#include "catch.hpp"
+
+extern "C" {
+#include "block.h"
+#include "control.h"
+#include "engine.h"
+#include "jit.h"
+#include "x16.h"
+#include "instruction.h"
+}
+
+// Beginning program counter
+static int CODESTART = 0x3000;
+
+// Data area used by the program
+static int DATA = 0x4000;
+
+// ----------------- Test a hot loop against the switch interpreter
+
+// This function initializes the machine with a loop that runs long
+// enough for its blocks to be compiled
+static x16_t* setup_test_machine_hot_loop() {
+    x16_t* machine = x16_create();
+    int pc = CODESTART;
+
+    x16_memwrite(machine, pc++, emit_and_imm(R_R0, R_R0, 0));
+    x16_memwrite(machine, pc++, emit_ld(R_R1, 16));               // COUNT
+    x16_memwrite(machine, pc++, emit_ld(R_R2, 16));               // DATA
+    // loop:
+    x16_memwrite(machine, pc++, emit_add_reg(R_R0, R_R0, R_R1));
+    x16_memwrite(machine, pc++, emit_not(R_R3, R_R0));
+    x16_memwrite(machine, pc++, emit_and_reg(R_R4, R_R3, R_R1));
+    x16_memwrite(machine, pc++, emit_and_imm(R_R5, R_R4, 7));
+    x16_memwrite(machine, pc++, emit_str(R_R0, R_R2, 3));
+    x16_memwrite(machine, pc++, emit_ldr(R_R6, R_R2, 3));
+    x16_memwrite(machine, pc++, emit_sti(R_R4, 10));              // PTR
+    x16_memwrite(machine, pc++, emit_ldi(R_R5, 9));               // PTR
+    x16_memwrite(machine, pc++, emit_jsr(4));                     // sub
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, -1));
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -11));
+    x16_memwrite(machine, pc++, emit_lea(R_R7, -1));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    // sub:
+    x16_memwrite(machine, pc++, emit_add_imm(R_R6, R_R6, 1));
+    x16_memwrite(machine, pc++, emit_jmp(R_R7));
+    x16_memwrite(machine, pc++, emit_value(500));                 // COUNT
+    x16_memwrite(machine, pc++, emit_value(DATA));                // DATA
+    x16_memwrite(machine, pc++, emit_value(DATA + 1));            // PTR
+
+    x16_set(machine, R_PC, CODESTART);
+    return machine;
+}
+
+TEST_CASE("Jit.hot_loop", "[jit]") {
+    engine_t jit;
+    if (engine_parse("jit", &jit) != 0) {
+        return;
+    }
+
+    x16_t* expected = setup_test_machine_hot_loop();
+    uint64_t expected_count = 0;
+    REQUIRE(engine_run(expected, ENGINE_SWITCH, 0, &expected_count) == -1);
+
+    x16_t* machine = setup_test_machine_hot_loop();
+    uint64_t count = 0;
+    REQUIRE(engine_run(machine, jit, 0, &count) == -1);
+
+    // Some blocks were compiled and the result is the same
+    block_cache_t* cache = x16_block_cache(machine);
+    REQUIRE(cache->jit != NULL);
+    REQUIRE(cache->jit->compiled > 0);
+    REQUIRE(count == expected_count);
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        REQUIRE(x16_reg(machine, (reg_t) i) == x16_reg(expected, (reg_t) i));
+    }
+    for (int i = DATA; i < DATA + 4; i++) {
+        REQUIRE(x16_memread(machine, i) == x16_memread(expected, i));
+    }
+
+    x16_free(expected);
+    x16_free(machine);
+}
+
+// ----------------- Test stores into compiled code
+
+// This function initializes the machine with a hot loop that patches an
+// instruction of another compiled block part way through
+static x16_t* setup_test_machine_patch_hot() {
+    x16_t* machine = x16_create();
+    int pc = CODESTART;
+
+    x16_memwrite(machine, pc++, emit_and_imm(R_R2, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_ld(R_R1, 9));                // COUNT
+    // loop:
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 1));     // patched
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, -1));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R4, R_R1, -10));
+    x16_memwrite(machine, pc++, emit_br(true, false, true, 2));
+    x16_memwrite(machine, pc++, emit_ld(R_R3, 5));                // NEW
+    x16_memwrite(machine, pc++, emit_st(R_R3, -6));               // patched
+    // skip:
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, 0));
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -8));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, emit_value(100));                 // COUNT
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 5));     // NEW
+
+    x16_set(machine, R_PC, CODESTART);
+    return machine;
+}
+
+TEST_CASE("Jit.smc", "[jit]") {
+    engine_t jit;
+    if (engine_parse("jit", &jit) != 0) {
+        return;
+    }
+
+    x16_t* machine = setup_test_machine_patch_hot();
+    REQUIRE(engine_run(machine, jit, 0, NULL) == -1);
+
+    // 90 iterations before the patch, 10 after
+    REQUIRE(x16_reg(machine, R_R2) == 90 * 1 + 10 * 5);
+
+    x16_free(machine);
+}
+
+// This function initializes the machine with a loop whose block patches
+// an instruction further down in itself on every iteration
+static x16_t* setup_test_machine_patch_self() {
+    x16_t* machine = x16_create();
+    int pc = CODESTART;
+
+    x16_memwrite(machine, pc++, emit_and_imm(R_R2, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_ld(R_R1, 8));                // COUNT
+    // loop:
+    x16_memwrite(machine, pc++, emit_and_imm(R_R4, R_R1, 1));
+    x16_memwrite(machine, pc++, emit_ld(R_R3, 7));                // BASE
+    x16_memwrite(machine, pc++, emit_add_reg(R_R3, R_R3, R_R4));
+    x16_memwrite(machine, pc++, emit_st(R_R3, 0));                // patch
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 1));     // patch
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, -1));
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -7));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, emit_value(100));                 // COUNT
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 1));     // BASE
+
+    x16_set(machine, R_PC, CODESTART);
+    return machine;
+}
+
+TEST_CASE("Jit.smc.self", "[jit]") {
+    engine_t jit;
+    if (engine_parse("jit", &jit) != 0) {
+        return;
+    }
+
+    x16_t* machine = setup_test_machine_patch_self();
+    REQUIRE(engine_run(machine, jit, 0, NULL) == -1);
+
+    // Odd counts add 2, even counts add 1
+    REQUIRE(x16_reg(machine, R_R2) == 150);
+
+    x16_free(machine);
+}
@@ -0,0 +1,213 @@
+#include <functional>
+#include <string>
+#include "catch.hpp"
+
+extern "C" {
+#include "console.h"
+#include "engine.h"
+#include "instruction.h"
+#include "lockstep.h"
+#include "machine.h"
+#include "x16.h"
+}
+
+// Load the program of one lane into a machine
+typedef std::function<void(x16_t* machine, int lane)> loader_t;
+
+// A machine with the program of a lane and a script console with keys
+static x16_t* create(const loader_t& load, int lane,
+                     const std::string& keys) {
+    x16_t* machine = x16_create();
+    x16_set_console(machine, console_script_create(keys.data(),
+                                                   keys.size()));
+    x16_set_input_wait(machine, true);
+    x16_set_idle_sleep(machine, false);
+    load(machine, lane);
+    x16_set(machine, R_PC, 0x3000);
+    return machine;
+}
+
+// Run count lanes in lockstep, and each lane again on its own with the
+// switch engine, over the budgets in turn. Every lane must end each run
+// exactly as its copy did.
+static lockstep_stats_t compare(const loader_t& load, int count,
+                                std::initializer_list<uint64_t> budgets,
+                                const std::string& keys = "") {
+    x16_t* machines[LOCKSTEP_LANES];
+    x16_t* copies[LOCKSTEP_LANES];
+    for (int lane = 0; lane < count; lane++) {
+        std::string lane_keys = keys + (char) ('a' + lane);
+        machines[lane] = create(load, lane, lane_keys);
+        copies[lane] = create(load, lane, lane_keys);
+    }
+    lockstep_t* group = lockstep_create(machines, count);
+    REQUIRE(group != NULL);
+
+    for (uint64_t budget : budgets) {
+        x16_stop_info_t info[LOCKSTEP_LANES];
+        lockstep_run(group, budget, info);
+        for (int lane = 0; lane < count; lane++) {
+            x16_t* machine = machines[lane];
+            x16_t* copy = copies[lane];
+            uint64_t executed = 0;
+            int rv = engine_run(copy, ENGINE_SWITCH, budget, &executed);
+            INFO("lane " << lane << " budget " << budget);
+            REQUIRE(info[lane].executed == executed);
+            REQUIRE(info[lane].reason == (rv == 0 ? X16_STOP_BUDGET :
+                                          x16_stop_reason(copy)));
+            REQUIRE(info[lane].pc == x16_pc(copy));
+            for (int reg = 0; reg < MAX_REGISTERS; reg++) {
+                REQUIRE(x16_reg(machine, (reg_t) reg) ==
+                        x16_reg(copy, (reg_t) reg));
+            }
+            REQUIRE(x16_executed(machine) == x16_executed(copy));
+            for (int address = 0; address < MAX_MEMORY; address++) {
+                if (!machine_is_io(machine, address) &&
+                    machine->memory[address] != copy->memory[address]) {
+                    FAIL("memory differs at " << address);
+                }
+            }
+        }
+    }
+
+    for (int lane = 0; lane < count; lane++) {
+        size_t length, copy_length;
+        x16_flush(machines[lane]);
+        x16_flush(copies[lane]);
+        const char* output = console_memory_output(
+            machine_console(machines[lane]), &length);
+        const char* copy_output = console_memory_output(
+            machine_console(copies[lane]), &copy_length);
+        REQUIRE(std::string(output, length) ==
+                std::string(copy_output, copy_length));
+        x16_free(machines[lane]);
+        x16_free(copies[lane]);
+    }
+    lockstep_stats_t stats;
+    lockstep_stats(group, &stats);
+    lockstep_free(group);
+    return stats;
+}
+
+// Add up lane * 3 + 1 .. 1 in R0 and keep each sum in a table, so the
+// lanes loop a different number of times
+static void load_sums(x16_t* machine, int lane) {
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_and_imm(R_R0, R_R0, 0));
+    x16_memwrite(machine, pc++, emit_ld(R_R1, 8));                // count
+    x16_memwrite(machine, pc++, emit_ld(R_R2, 8));                // table
+    // loop:
+    x16_memwrite(machine, pc++, emit_add_reg(R_R0, R_R0, R_R1));
+    x16_memwrite(machine, pc++, emit_str(R_R0, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 1));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, -1));
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -5));
+    x16_memwrite(machine, pc++, emit_st(R_R0, 3));                // total
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, emit_value(lane * 3 + 1));        // count
+    x16_memwrite(machine, pc++, emit_value(0x3100));              // table
+    x16_memwrite(machine, pc++, emit_value(0));                   // total
+}
+
+TEST_CASE("Lockstep.create", "[lockstep]") {
+    x16_t* machines[LOCKSTEP_LANES + 1] = {};
+    REQUIRE(lockstep_create(machines, 0) == NULL);
+    REQUIRE(lockstep_create(machines, LOCKSTEP_LANES + 1) == NULL);
+}
+
+TEST_CASE("Lockstep.diverge", "[lockstep]") {
+    for (int count : {1, 5, LOCKSTEP_LANES}) {
+        lockstep_stats_t stats = compare(load_sums, count, {0});
+        if (count > 1) {
+            REQUIRE(stats.diverged > 0);
+            REQUIRE(stats.steps < stats.executed);
+        }
+    }
+}
+
+// Read a key, print it and a string that depends on the lane, and go
+// again until the keys run out
+static void load_echo(x16_t* machine, int lane) {
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, pc++, emit_lea(R_R0, 4));               // text
+    x16_memwrite(machine, pc++, emit_trap(TRAP_PUTS));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, 1));
+    x16_memwrite(machine, pc++, emit_br(true, true, true, -6));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, emit_value(lane < 8 ? 'x' : 'y'));
+    x16_memwrite(machine, pc++, emit_value(0));
+}
+
+TEST_CASE("Lockstep.traps", "[lockstep]") {
+    // The lanes run out of keys together and stop for input
+    compare(load_echo, LOCKSTEP_LANES, {0}, "abc");
+    compare(load_echo, 3, {7, 2, 0}, "abc");
+}
+
+// Long loops over the chunk the lanes count in, with code and data that
+// are not the same in every lane
+static void load_long(x16_t* machine, int lane) {
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_ld(R_R1, 6));                // count
+    // loop:
+    x16_memwrite(machine, pc++, lane & 1 ? emit_add_imm(R_R0, R_R0, 1) :
+                 emit_add_imm(R_R0, R_R0, 2));
+    x16_memwrite(machine, pc++, emit_ldi(R_R3, 5));               // pointer
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 4));               // pointer
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, -1));
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -5));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, emit_value(20000 + lane * 100));  // count
+    x16_memwrite(machine, pc++, emit_value(0x4000 + (lane & 2))); // pointer
+}
+
+TEST_CASE("Lockstep.budget", "[lockstep]") {
+    compare(load_long, 7, {40000, 1, 33000, 0});
+    compare(load_long, LOCKSTEP_LANES, {100000, 100000});
+}
+
+// Start a timer in odd lanes, which then run on their own, and count in
+// R1 until the timer interrupt sets R2. Even lanes write the same words
+// to RAM and count forever.
+static void load_timer(x16_t* machine, int lane) {
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 7));                // interval
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 7));               // tmi
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 7));                // ie
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 7));               // tmr
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, 1));     // loop
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_br(false, true, false, -3));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, emit_value(50 + lane));           // interval
+    x16_memwrite(machine, pc++, emit_value(lane & 1 ? MR_TMI : 0x4000));
+    x16_memwrite(machine, pc++, emit_value(TMR_IE));              // ie
+    x16_memwrite(machine, pc++, emit_value(lane & 1 ? MR_TMR : 0x4001));
+
+    pc = 0x3100;
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 1));
+    x16_memwrite(machine, pc++, emit_rti());
+    x16_memwrite(machine, IVT_BASE + INT_TIMER, 0x3100);
+}
+
+TEST_CASE("Lockstep.interrupts", "[lockstep]") {
+    compare(load_timer, 6, {1000, 5000});
+
+    // A machine with a breakpoint runs on its own too
+    x16_t* machines[2];
+    for (int lane = 0; lane < 2; lane++) {
+        machines[lane] = create(load_sums, lane, "");
+    }
+    x16_set_breakpoint(machines[1], 0x3004, true);
+    lockstep_t* group = lockstep_create(machines, 2);
+    x16_stop_info_t info[2];
+    lockstep_run(group, 0, info);
+    REQUIRE(info[0].reason == X16_STOP_HALT);
+    REQUIRE(info[1].reason == X16_STOP_BREAKPOINT);
+    REQUIRE(info[1].pc == 0x3004);
+    lockstep_free(group);
+    x16_free(machines[0]);
+    x16_free(machines[1]);
+}
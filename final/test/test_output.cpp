@@ -0,0 +1,88 @@
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "catch.hpp"
+
+extern "C" {
+#include "output.h"
+}
+
+// Seconds on the monotonic clock
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+TEST_CASE("Output.flush", "[output]") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    output_t* output = output_create(fds[1]);
+    REQUIRE(output != NULL);
+
+    output_putc(output, 'a');
+    output_write(output, "bc", 2);
+    output_flush(output);
+    REQUIRE(output_writes(output) == 1);
+    char buffer[8] = {0};
+    REQUIRE(read(fds[0], buffer, sizeof(buffer)) == 3);
+    REQUIRE(strcmp(buffer, "abc") == 0);
+
+    // Nothing to write
+    output_flush(output);
+    REQUIRE(output_writes(output) == 1);
+
+    // What is left is written when the buffer is freed
+    output_putc(output, 'd');
+    output_free(output);
+    REQUIRE(read(fds[0], buffer, sizeof(buffer)) == 1);
+    REQUIRE(buffer[0] == 'd');
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_CASE("Output.timer", "[output]") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    output_t* output = output_create(fds[1]);
+
+    // The thread writes the byte once it has waited OUTPUT_DELAY_NS
+    double start = now();
+    output_putc(output, 'x');
+    char c = 0;
+    REQUIRE(read(fds[0], &c, 1) == 1);
+    REQUIRE(c == 'x');
+    REQUIRE(now() - start >= OUTPUT_DELAY_NS / 1e9 * 0.9);
+    REQUIRE(output_writes(output) == 1);
+
+    output_free(output);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_CASE("Output.full", "[output]") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    output_t* output = output_create(fds[1]);
+
+    // A full buffer is written before more is added
+    static char data[OUTPUT_SIZE * 2 + 100];
+    memset(data, '*', sizeof(data));
+    output_write(output, data, sizeof(data));
+    REQUIRE(output_writes(output) >= 2);
+    output_flush(output);
+    REQUIRE(output_writes(output) == 3);
+
+    static char got[sizeof(data)];
+    size_t total = 0;
+    while (total < sizeof(got)) {
+        ssize_t n = read(fds[0], got + total, sizeof(got) - total);
+        REQUIRE(n > 0);
+        total += n;
+    }
+    REQUIRE(memcmp(data, got, sizeof(data)) == 0);
+
+    output_free(output);
+    close(fds[0]);
+    close(fds[1]);
+}
@@ -0,0 +1,74 @@
+#include <atomic>
+#include <vector>
+#include "catch.hpp"
+
+extern "C" {
+#include "pool.h"
+}
+
+// A task that needs a number of slices
+struct counted {
+    int needed;
+    int ran;
+    std::atomic<int> running;
+};
+
+// Set if two workers ever held a task at once. Catch is not thread safe,
+// so the workers only set this.
+static std::atomic<bool> overlapped(false);
+
+// Run one slice
+static bool count_slice(void* task, int worker, void* context) {
+    counted* c = (counted*) task;
+    if (c->running.fetch_add(1) != 0) {
+        overlapped = true;
+    }
+    c->ran++;
+    std::atomic<int>* workers = (std::atomic<int>*) context;
+    workers[worker]++;
+    bool done = c->ran == c->needed;
+    c->running--;
+    return done;
+}
+
+TEST_CASE("Pool.run", "[pool]") {
+    for (int workers : {1, 4}) {
+        const int count = 1000;
+        std::vector<counted> tasks(count);
+        std::vector<void*> pointers;
+        for (int i = 0; i < count; i++) {
+            // A few long tasks among many short ones
+            tasks[i].needed = i % 100 == 0 ? 500 : 1 + i % 7;
+            tasks[i].ran = 0;
+            tasks[i].running = 0;
+            pointers.push_back(&tasks[i]);
+        }
+        std::atomic<int> per_worker[4] = {};
+
+        pool_stats_t stats;
+        pool_run(pointers.data(), count, workers, count_slice, per_worker,
+                 &stats);
+
+        REQUIRE(!overlapped);
+        uint64_t slices = 0;
+        for (int i = 0; i < count; i++) {
+            REQUIRE(tasks[i].ran == tasks[i].needed);
+            slices += tasks[i].needed;
+        }
+        REQUIRE(stats.slices == slices);
+        int total = 0;
+        for (int i = 0; i < workers; i++) {
+            total += per_worker[i];
+        }
+        REQUIRE(total == (int) slices);
+        if (workers == 1) {
+            REQUIRE(stats.steals == 0);
+        }
+    }
+}
+
+TEST_CASE("Pool.empty", "[pool]") {
+    pool_stats_t stats;
+    pool_run(NULL, 0, 3, count_slice, NULL, &stats);
+    REQUIRE(stats.slices == 0);
+}
@@ -0,0 +1,68 @@
+#include "catch.hpp"
+
+#include <cstring>
+
+extern "C" {
+#include "bits.h"
+#include "instruction.h"
+#include "predecode.h"
+}
+
+// ------------------------ Test the predecode table ----------------------
+
+TEST_CASE("Predecode.add", "[predecode]") {
+    predecode_init();
+
+    const decoded_t* d = predecoded(emit_add_imm(R_R4, R_R2, -8));
+    REQUIRE(d->opcode == OP_ADD);
+    REQUIRE(d->dst == R_R4);
+    REQUIRE(d->src1 == R_R2);
+    REQUIRE(d->imm == 1);
+    REQUIRE(d->value == (uint16_t) -8);
+
+    d = predecoded(emit_add_reg(R_R1, R_R2, R_R7));
+    REQUIRE(d->opcode == OP_ADD);
+    REQUIRE(d->dst == R_R1);
+    REQUIRE(d->src1 == R_R2);
+    REQUIRE(d->src2 == R_R7);
+    REQUIRE(d->imm == 0);
+}
+
+TEST_CASE("Predecode.br", "[predecode]") {
+    predecode_init();
+
+    const decoded_t* d = predecoded(emit_br(true, false, true, -25));
+    REQUIRE(d->opcode == OP_BR);
+    REQUIRE(d->nzp == (FL_NEG | FL_POS));
+    REQUIRE(d->value == (uint16_t) -25);
+
+    // An unconditional branch has every condition bit set
+    d = predecoded(emit_br(false, false, false, 42));
+    REQUIRE(d->nzp == (FL_NEG | FL_ZRO | FL_POS));
+    REQUIRE(d->value == 42);
+}
+
+TEST_CASE("Predecode.jsr", "[predecode]") {
+    predecode_init();
+
+    const decoded_t* d = predecoded(emit_jsr(-33));
+    REQUIRE(d->opcode == OP_JSR);
+    REQUIRE(d->nzp == 1);
+    REQUIRE(d->value == (uint16_t) -33);
+
+    d = predecoded(emit_jsrr(R_R6));
+    REQUIRE(d->opcode == OP_JSR);
+    REQUIRE(d->nzp == 0);
+    REQUIRE(d->src1 == R_R6);
+}
+
+TEST_CASE("Predecode.table", "[predecode]") {
+    predecode_init();
+
+    // Every entry of the table must match the decoder
+    for (int i = 0; i < 65536; i++) {
+        decoded_t d = predecode_instruction((uint16_t) i);
+        REQUIRE(memcmp(&d, predecoded((uint16_t) i), sizeof(d)) == 0);
+        REQUIRE(d.opcode == getopcode((uint16_t) i));
+    }
+}
@@ -0,0 +1,241 @@
+#include <unistd.h>
+#include <sys/mman.h>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include "catch.hpp"
+
+extern "C" {
+#include "console.h"
+#include "engine.h"
+#include "x16.h"
+#include "instruction.h"
+#include "machine.h"
+}
+
+// Beginning program counter
+static int CODESTART = 0x3000;
+
+// This function initializes the machine with a program that adds up
+// 5..1 in R0 and halts after 18 instructions
+static x16_t* setup_test_machine_loop() {
+    x16_t* machine = x16_create();
+    int pc = CODESTART;
+
+    x16_memwrite(machine, pc++, emit_and_imm(R_R0, R_R0, 0));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R0, 5));
+    // loop:
+    x16_memwrite(machine, pc++, emit_add_reg(R_R0, R_R0, R_R1));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, -1));
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -3));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+
+    x16_set(machine, R_PC, CODESTART);
+    return machine;
+}
+
+TEST_CASE("Run.halt", "[run]") {
+    x16_t* machine = setup_test_machine_loop();
+    x16_stop_info_t info;
+    REQUIRE(x16_run(machine, 0, &info) == X16_STOP_HALT);
+    REQUIRE(info.reason == X16_STOP_HALT);
+    REQUIRE(info.executed == 18);
+    REQUIRE(info.pc == CODESTART + 6);
+    REQUIRE(x16_reg(machine, R_R0) == 15);
+    REQUIRE(x16_executed(machine) == 18);
+    x16_free(machine);
+}
+
+TEST_CASE("Run.budget", "[run]") {
+    x16_t* machine = setup_test_machine_loop();
+    x16_stop_info_t info;
+    REQUIRE(x16_run(machine, 5, &info) == X16_STOP_BUDGET);
+    REQUIRE(info.executed == 5);
+    REQUIRE(info.pc == CODESTART + 2);
+    REQUIRE(x16_reg(machine, R_R0) == 5);
+
+    REQUIRE(x16_run(machine, 0, &info) == X16_STOP_HALT);
+    REQUIRE(info.executed == 13);
+    REQUIRE(x16_reg(machine, R_R0) == 15);
+    REQUIRE(x16_executed(machine) == 18);
+    x16_free(machine);
+}
+
+// Every engine stops before the breakpoint and resumes past it
+TEST_CASE("Run.breakpoint", "[run]") {
+    engine_t engines[] = {
+        ENGINE_SWITCH, engine_default(), ENGINE_BLOCK, ENGINE_JIT
+    };
+    for (engine_t engine : engines) {
+        x16_t* machine = setup_test_machine_loop();
+        x16_set_breakpoint(machine, CODESTART + 3, true);
+
+        uint64_t executed = 0;
+        REQUIRE(engine_run(machine, engine, 0, &executed) == -1);
+        REQUIRE(x16_stop_reason(machine) == X16_STOP_BREAKPOINT);
+        REQUIRE(executed == 3);
+        REQUIRE(x16_pc(machine) == CODESTART + 3);
+        REQUIRE(x16_reg(machine, R_R1) == 5);
+
+        REQUIRE(engine_run(machine, engine, 0, &executed) == -1);
+        REQUIRE(x16_stop_reason(machine) == X16_STOP_BREAKPOINT);
+        REQUIRE(executed == 3);
+        REQUIRE(x16_reg(machine, R_R1) == 4);
+
+        x16_set_breakpoint(machine, CODESTART + 3, false);
+        REQUIRE(x16_breakpoints(machine) == NULL);
+        REQUIRE(engine_run(machine, engine, 0, &executed) == -1);
+        REQUIRE(x16_stop_reason(machine) == X16_STOP_HALT);
+        REQUIRE(x16_reg(machine, R_R0) == 15);
+        x16_free(machine);
+    }
+}
+
+// Every engine stops on an illegal opcode instead of aborting
+TEST_CASE("Run.illegal", "[run]") {
+    engine_t engines[] = {
+        ENGINE_SWITCH, engine_default(), ENGINE_BLOCK, ENGINE_JIT
+    };
+    for (engine_t engine : engines) {
+        x16_t* machine = setup_test_machine_loop();
+        x16_memwrite(machine, CODESTART + 5, OP_RTI << 12);
+
+        uint64_t executed = 0;
+        REQUIRE(engine_run(machine, engine, 0, &executed) == -1);
+        REQUIRE(x16_stop_reason(machine) == X16_STOP_ILLEGAL);
+        REQUIRE(executed == 17);
+        REQUIRE(x16_pc(machine) == CODESTART + 5);
+        REQUIRE(x16_reg(machine, R_R0) == 15);
+        x16_free(machine);
+    }
+}
+
+TEST_CASE("Run.badtrap", "[run]") {
+    engine_t engines[] = {
+        ENGINE_SWITCH, engine_default(), ENGINE_BLOCK, ENGINE_JIT
+    };
+    for (engine_t engine : engines) {
+        x16_t* machine = setup_test_machine_loop();
+        x16_memwrite(machine, CODESTART + 5, emit_trap((trap_t) 0xff));
+
+        uint64_t executed = 0;
+        REQUIRE(engine_run(machine, engine, 0, &executed) == -1);
+        REQUIRE(x16_stop_reason(machine) == X16_STOP_ILLEGAL);
+        REQUIRE(executed == 17);
+        REQUIRE(x16_pc(machine) == CODESTART + 5);
+        x16_free(machine);
+    }
+}
+
+// GETC stops the run until input is ready
+TEST_CASE("Run.input", "[run]") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    int saved = dup(STDIN_FILENO);
+    dup2(fds[0], STDIN_FILENO);
+
+    x16_t* machine = x16_create();
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, CODESTART + 1, emit_trap(TRAP_HALT));
+    x16_set_input_wait(machine, true);
+
+    x16_stop_info_t info;
+    REQUIRE(x16_run(machine, 0, &info) == X16_STOP_INPUT);
+    REQUIRE(info.executed == 0);
+    REQUIRE(info.pc == CODESTART);
+
+    // The key reaches the machine through the keyboard thread
+    REQUIRE(write(fds[1], "x", 1) == 1);
+    for (int i = 0; i < 1000 && !x16_input_ready(machine); i++) {
+        usleep(1000);
+    }
+    REQUIRE(x16_run(machine, 0, &info) == X16_STOP_HALT);
+    REQUIRE(info.executed == 2);
+    REQUIRE(x16_reg(machine, R_R0) == 'x');
+    x16_free(machine);
+
+    dup2(saved, STDIN_FILENO);
+    close(saved);
+    close(fds[0]);
+    close(fds[1]);
+    clearerr(stdin);
+}
+
+TEST_CASE("Run.idle", "[run]") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    int saved = dup(STDIN_FILENO);
+    dup2(fds[0], STDIN_FILENO);
+
+    // Spin on MR_KBSR, then read the key into R1
+    x16_t* machine = x16_create();
+    int pc = CODESTART;
+    x16_memwrite(machine, pc++, emit_ldi(R_R0, 3));
+    x16_memwrite(machine, pc++, emit_br(false, true, true, -2));
+    x16_memwrite(machine, pc++, emit_ldi(R_R1, 2));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, MR_KBSR);
+    x16_memwrite(machine, pc++, MR_KBDR);
+
+    // The key comes after 200 ms, which the host should spend asleep
+    std::thread typist([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        REQUIRE(write(fds[1], "k", 1) == 1);
+    });
+    auto start = std::chrono::steady_clock::now();
+    clock_t cpu = clock();
+    x16_stop_info_t info;
+    REQUIRE(x16_run(machine, 0, &info) == X16_STOP_HALT);
+    double cpu_s = (double) (clock() - cpu) / CLOCKS_PER_SEC;
+    std::chrono::duration<double> wall =
+        std::chrono::steady_clock::now() - start;
+    typist.join();
+
+    REQUIRE(x16_reg(machine, R_R1) == 'k');
+    REQUIRE(wall.count() >= 0.15);
+    REQUIRE(cpu_s < wall.count() / 2);
+    x16_free(machine);
+
+    dup2(saved, STDIN_FILENO);
+    close(saved);
+    close(fds[0]);
+    close(fds[1]);
+    clearerr(stdin);
+}
+
+#ifdef __linux__
+// Bytes of the machine's guest memory held in host pages
+static long resident(x16_t* machine) {
+    long page = sysconf(_SC_PAGESIZE);
+    size_t bytes = MAX_MEMORY * sizeof(uint16_t);
+    unsigned char pages[MAX_MEMORY * sizeof(uint16_t) / 4096];
+    REQUIRE(bytes / page <= sizeof(pages));
+    REQUIRE(mincore(machine->memory, bytes, pages) == 0);
+    long held = 0;
+    for (size_t i = 0; i < bytes / page; i++) {
+        held += (pages[i] & 1) * page;
+    }
+    return held;
+}
+
+TEST_CASE("Run.sparse", "[run]") {
+    // Machines that touch a few words take a few host pages each. Only
+    // the guest memory counts: the JIT's code buffer and block cache
+    // are the engine's, not the machine's.
+    const int count = 256;
+    x16_t* machines[count];
+    long held = 0;
+    for (x16_t*& machine : machines) {
+        machine = setup_test_machine_loop();
+        x16_set_console(machine, console_null_create());
+        REQUIRE(x16_run(machine, 0, NULL) == X16_STOP_HALT);
+        REQUIRE(x16_memread(machine, 0x8000) == 0);
+        held += resident(machine);
+    }
+    INFO("held " << held / count << " bytes per machine");
+    REQUIRE(held < count * MAX_MEMORY * (long) sizeof(uint16_t) / 10);
+    for (x16_t* machine : machines) {
+        x16_free(machine);
+    }
+}
+#endif
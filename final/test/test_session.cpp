@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "catch.hpp"
+
+extern "C" {
+#include "console.h"
+#include "instruction.h"
+#include "session.h"
+#include "x16.h"
+}
+
+static const engine_t engines[] = {
+    ENGINE_SWITCH, ENGINE_THREADED, ENGINE_BLOCK, ENGINE_JIT,
+};
+
+// A file for a log, removed by the caller
+static std::string temp_log() {
+    char path[] = "/tmp/x16sessionXXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd != -1);
+    close(fd);
+    return path;
+}
+
+static std::string read_file(const std::string& path) {
+    std::string text;
+    FILE* fp = fopen(path.c_str(), "r");
+    REQUIRE(fp != NULL);
+    char buffer[256];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        text.append(buffer, n);
+    }
+    fclose(fp);
+    return text;
+}
+
+static void write_file(const std::string& path, const char* text) {
+    FILE* fp = fopen(path.c_str(), "w");
+    REQUIRE(fp != NULL);
+    fputs(text, fp);
+    fclose(fp);
+}
+
+// Echo two keys read with GETC
+static void load_getc(x16_t* machine) {
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+}
+
+// Count polls of MR_KBSR and print each key with the count, until EOF
+static void load_poll(x16_t* machine) {
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, 1));     // loop
+    x16_memwrite(machine, pc++, emit_ldi(R_R0, 10));              // kbsr
+    x16_memwrite(machine, pc++, emit_br(false, true, true, -3));  // loop
+    x16_memwrite(machine, pc++, emit_ldi(R_R0, 9));               // kbdr
+    x16_memwrite(machine, pc++, emit_br(true, false, false, 6));  // done
+    x16_memwrite(machine, pc++, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, pc++, emit_and_imm(R_R0, R_R1, 15));
+    x16_memwrite(machine, pc++, emit_ld(R_R2, 6));                // base
+    x16_memwrite(machine, pc++, emit_add_reg(R_R0, R_R0, R_R2));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, pc++, emit_br(true, true, true, -11));  // loop
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));            // done
+    x16_memwrite(machine, pc++, emit_value(MR_KBSR));             // kbsr
+    x16_memwrite(machine, pc++, emit_value(MR_KBDR));             // kbdr
+    x16_memwrite(machine, pc++, emit_value('A'));                 // base
+}
+
+// What a session run did
+struct session_result {
+    x16_stop_t reason;
+    std::string output;
+    uint64_t executed;
+    bool diverged;
+};
+
+// Run the program load puts in a new machine, recording the keys into
+// path, or replaying path when keys is NULL
+static session_result run_session(void (*load)(x16_t*), engine_t engine,
+                                  const std::string& path,
+                                  const char* keys) {
+    x16_t* machine = x16_create();
+    load(machine);
+    console_t* console = keys != NULL ?
+        console_memory_create(keys, strlen(keys)) :
+        console_memory_create("", 0);
+    session_t* session = keys != NULL ?
+        session_record(machine, console, path.c_str()) :
+        session_replay(machine, console, path.c_str());
+    REQUIRE(session != NULL);
+
+    session_result result;
+    result.reason = session_run(session, engine, NULL);
+    x16_flush(machine);
+    size_t length;
+    const char* output = console_memory_output(console, &length);
+    result.output.assign(output, length);
+    result.executed = x16_executed(machine);
+    result.diverged = session_diverged(session);
+    x16_free(machine);
+    return result;
+}
+
+TEST_CASE("Session.getc", "[session]") {
+    std::string path = temp_log();
+    session_result recorded = run_session(load_getc, ENGINE_SWITCH, path,
+                                          "ab");
+    REQUIRE(recorded.reason == X16_STOP_HALT);
+    REQUIRE(recorded.output == "abHALT\n\n");
+
+    // 'a' is there before the first instruction and 'b' comes when the
+    // second GETC waits
+    REQUIRE(read_file(path) == "x16 session 1\n0 97\n2 98\n5 end\n");
+
+    for (engine_t engine : engines) {
+        session_result replayed = run_session(load_getc, engine, path, NULL);
+        REQUIRE(replayed.reason == X16_STOP_HALT);
+        REQUIRE(replayed.output == recorded.output);
+        REQUIRE(replayed.executed == 5);
+        REQUIRE(!replayed.diverged);
+    }
+    unlink(path.c_str());
+}
+
+TEST_CASE("Session.poll", "[session]") {
+    // The guest sees each key after a whole number of slices, so its poll
+    // counts depend on the instruction counts the keys came at
+    std::string path = temp_log();
+    session_result recorded = run_session(load_poll, ENGINE_SWITCH, path,
+                                          "xyz");
+    REQUIRE(recorded.reason == X16_STOP_HALT);
+    REQUIRE(recorded.output.size() == 6 + 6);
+    REQUIRE(recorded.executed > 3 * SESSION_SLICE);
+
+    for (engine_t engine : engines) {
+        session_result replayed = run_session(load_poll, engine, path, NULL);
+        REQUIRE(replayed.reason == X16_STOP_HALT);
+        REQUIRE(replayed.output == recorded.output);
+        REQUIRE(replayed.executed == recorded.executed);
+        REQUIRE(!replayed.diverged);
+    }
+    unlink(path.c_str());
+}
+
+TEST_CASE("Session.diverged", "[session]") {
+    std::string path = temp_log();
+
+    // GETC waits at 2 with the next key due at 3
+    write_file(path, "x16 session 1\n0 97\n3 98\n5 end\n");
+    session_result replayed = run_session(load_getc, ENGINE_SWITCH, path,
+                                          NULL);
+    REQUIRE(replayed.reason == X16_STOP_INPUT);
+    REQUIRE(replayed.executed == 2);
+    REQUIRE(replayed.diverged);
+
+    // Halting short of the end
+    write_file(path, "x16 session 1\n0 97\n2 98\n9 end\n");
+    replayed = run_session(load_getc, ENGINE_SWITCH, path, NULL);
+    REQUIRE(replayed.reason == X16_STOP_HALT);
+    REQUIRE(replayed.diverged);
+
+    // Ending before the guest would wait
+    write_file(path, "x16 session 1\n0 97\n2 end\n");
+    replayed = run_session(load_getc, ENGINE_SWITCH, path, NULL);
+    REQUIRE(replayed.reason == X16_STOP_BUDGET);
+    REQUIRE(replayed.output == "a");
+    REQUIRE(replayed.executed == 2);
+    REQUIRE(!replayed.diverged);
+    unlink(path.c_str());
+}
+
+TEST_CASE("Session.bad", "[session]") {
+    std::string path = temp_log();
+    const char* logs[] = {
+        "",
+        "x16 session 2\n",
+        "x16 session 1\n5 97\n3 98\n",
+        "x16 session 1\n5 end\n6 97\n",
+        "x16 session 1\n5 key\n",
+        "x16 session 1\n5 70000\n",
+    };
+    for (const char* log : logs) {
+        write_file(path, log);
+        x16_t* machine = x16_create();
+        console_t* console = console_null_create();
+        REQUIRE(session_replay(machine, console, path.c_str()) == NULL);
+        console_free(console);
+        x16_free(machine);
+    }
+    unlink(path.c_str());
+}
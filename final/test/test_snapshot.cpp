@@ -0,0 +1,178 @@
+#include <cstring>
+#include "catch.hpp"
+
+extern "C" {
+#include "console.h"
+#include "engine.h"
+#include "instruction.h"
+#include "machine.h"
+#include "snapshot.h"
+#include "x16.h"
+}
+
+// Add up 1..count in R0, keeping the running sums in a table at 0x4000,
+// and halt
+static x16_t* setup_sums(uint16_t count) {
+    x16_t* machine = x16_create();
+    x16_set_console(machine, console_null_create());
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_and_imm(R_R0, R_R0, 0));
+    x16_memwrite(machine, pc++, emit_ld(R_R1, 7));                // count
+    x16_memwrite(machine, pc++, emit_ld(R_R2, 7));                // table
+    // loop:
+    x16_memwrite(machine, pc++, emit_add_reg(R_R0, R_R0, R_R1));
+    x16_memwrite(machine, pc++, emit_str(R_R0, R_R2, 0));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 1));
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, -1));
+    x16_memwrite(machine, pc++, emit_br(false, false, true, -5));
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, emit_value(count));               // count
+    x16_memwrite(machine, pc++, emit_value(0x4000));              // table
+    return machine;
+}
+
+// True when two machines have the same registers, count and memory
+static bool same(x16_t* a, x16_t* b) {
+    for (int reg = 0; reg < MAX_REGISTERS; reg++) {
+        if (x16_reg(a, (reg_t) reg) != x16_reg(b, (reg_t) reg)) {
+            return false;
+        }
+    }
+    return x16_executed(a) == x16_executed(b) &&
+        memcmp(a->memory, b->memory, MAX_MEMORY * sizeof(uint16_t)) == 0;
+}
+
+TEST_CASE("Snapshot.restore", "[snapshot]") {
+    x16_t* machine = setup_sums(600);
+    x16_t* copy = setup_sums(600);
+    REQUIRE(x16_run(machine, 1000, NULL) == X16_STOP_BUDGET);
+    REQUIRE(x16_run(copy, 1000, NULL) == X16_STOP_BUDGET);
+    x16_snapshot_t* snapshot = x16_snapshot(machine);
+
+    // Every restore runs the same again, on every engine
+    engine_t engines[] = {
+        ENGINE_SWITCH, engine_default(), ENGINE_BLOCK, ENGINE_JIT
+    };
+    REQUIRE(x16_run(copy, 0, NULL) == X16_STOP_HALT);
+    for (engine_t engine : engines) {
+        uint64_t executed;
+        REQUIRE(engine_run(machine, engine, 0, &executed) == -1);
+        REQUIRE(same(machine, copy));
+        x16_restore(machine, snapshot);
+        REQUIRE(x16_executed(machine) == 1000);
+        REQUIRE(x16_pc(machine) != x16_pc(copy));
+    }
+    x16_snapshot_free(snapshot);
+    x16_free(machine);
+    x16_free(copy);
+}
+
+TEST_CASE("Snapshot.share", "[snapshot]") {
+    x16_t* machine = setup_sums(600);
+    x16_snapshot_t* first = x16_snapshot(machine);
+    x16_snapshot_t* again = x16_snapshot(machine);
+    REQUIRE(snapshot_shared(first, again) == MEM_PAGES);
+
+    // Running without stores leaves every page clean
+    REQUIRE(x16_run(machine, 3, NULL) == X16_STOP_BUDGET);
+    for (int page = 0; page < MEM_PAGES; page++) {
+        REQUIRE(machine->dirty[page] == 0);
+    }
+
+    // 600 sums fill three pages
+    REQUIRE(x16_run(machine, 0, NULL) == X16_STOP_HALT);
+    x16_snapshot_t* done = x16_snapshot(machine);
+    REQUIRE(snapshot_shared(again, done) == MEM_PAGES - 3);
+
+    // A word written back is no change
+    uint16_t word = x16_memread(machine, 0x4000);
+    x16_memwrite(machine, 0x4000, word + 1);
+    x16_memwrite(machine, 0x4000, word);
+    x16_snapshot_t* after = x16_snapshot(machine);
+    REQUIRE(snapshot_shared(done, after) == MEM_PAGES);
+    x16_snapshot_free(after);
+    x16_snapshot_free(done);
+    x16_snapshot_free(first);
+    x16_snapshot_free(again);
+    x16_free(machine);
+}
+
+TEST_CASE("Snapshot.fork", "[snapshot]") {
+    x16_t* machine = setup_sums(100);
+    REQUIRE(x16_run(machine, 50, NULL) == X16_STOP_BUDGET);
+    x16_snapshot_t* snapshot = x16_snapshot(machine);
+    x16_t* forks[3];
+    for (x16_t*& fork : forks) {
+        fork = x16_fork(snapshot);
+        x16_set_console(fork, console_null_create());
+        REQUIRE(same(fork, machine));
+    }
+    // The snapshot outlives its handle while machines use it
+    x16_snapshot_free(snapshot);
+
+    // Each fork goes its own way
+    x16_memwrite(forks[1], 0x5000, 7);
+    x16_memwrite(forks[2], 0x3003, emit_trap(TRAP_HALT));
+    for (x16_t* m : {machine, forks[0], forks[1], forks[2]}) {
+        REQUIRE(x16_run(m, 0, NULL) == X16_STOP_HALT);
+    }
+    REQUIRE(x16_reg(machine, R_R0) == 5050);
+    REQUIRE(same(forks[0], machine));
+    REQUIRE(x16_memread(forks[1], 0x5000) == 7);
+    REQUIRE(x16_memread(machine, 0x5000) == 0);
+    REQUIRE(x16_reg(forks[2], R_R0) != 5050);
+
+    // Restoring a fork to a later snapshot of another machine
+    x16_snapshot_t* later = x16_snapshot(machine);
+    x16_restore(forks[2], later);
+    REQUIRE(same(forks[2], machine));
+    x16_snapshot_free(later);
+    for (x16_t* fork : forks) {
+        x16_free(fork);
+    }
+    x16_free(machine);
+}
+
+// Start a timer of 100 instructions and count in R1, taking the
+// interrupts in a handler that counts them in R2
+static x16_t* setup_timer() {
+    x16_t* machine = x16_create();
+    int pc = 0x3000;
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 6));                // interval
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 6));               // tmi
+    x16_memwrite(machine, pc++, emit_ld(R_R0, 6));                // ie
+    x16_memwrite(machine, pc++, emit_sti(R_R0, 6));               // tmr
+    x16_memwrite(machine, pc++, emit_add_imm(R_R1, R_R1, 1));     // loop
+    x16_memwrite(machine, pc++, emit_br(true, true, true, -2));   // loop
+    x16_memwrite(machine, pc++, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, pc++, emit_value(100));                 // interval
+    x16_memwrite(machine, pc++, emit_value(MR_TMI));              // tmi
+    x16_memwrite(machine, pc++, emit_value(TMR_IE));              // ie
+    x16_memwrite(machine, pc++, emit_value(MR_TMR));              // tmr
+
+    pc = 0x3100;
+    x16_memwrite(machine, pc++, emit_add_imm(R_R2, R_R2, 1));
+    x16_memwrite(machine, pc++, emit_rti());
+    x16_memwrite(machine, IVT_BASE + INT_TIMER, 0x3100);
+    return machine;
+}
+
+TEST_CASE("Snapshot.interrupts", "[snapshot]") {
+    x16_t* machine = setup_timer();
+    REQUIRE(x16_run(machine, 1050, NULL) == X16_STOP_BUDGET);
+    x16_snapshot_t* snapshot = x16_snapshot(machine);
+    REQUIRE(x16_run(machine, 1000, NULL) == X16_STOP_BUDGET);
+    uint16_t r1 = x16_reg(machine, R_R1);
+    uint16_t r2 = x16_reg(machine, R_R2);
+
+    x16_t* fork = x16_fork(snapshot);
+    x16_restore(machine, snapshot);
+    REQUIRE(x16_run(machine, 1000, NULL) == X16_STOP_BUDGET);
+    REQUIRE(x16_run(fork, 1000, NULL) == X16_STOP_BUDGET);
+    REQUIRE(x16_reg(machine, R_R1) == r1);
+    REQUIRE(x16_reg(machine, R_R2) == r2);
+    REQUIRE(same(fork, machine));
+    x16_snapshot_free(snapshot);
+    x16_free(fork);
+    x16_free(machine);
+}
@@ -101,6 +101,32 @@ TEST_CASE("Xas.all", "[xas]") {
     cout << "Passed" << endl;
 }
 
+// Test with the names of the device addresses
+TEST_CASE("Xas.device", "[xas]") {
+    cout << "Testing device constants in assembler... ";
+
+    int rv = system("./xas test/samples/device.x16s");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    rv = system("cmp a.obj test/samples/device.obj");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    cout << "Passed" << endl;
+}
+
+// Test with the interrupt registers, vectors and RTI
+TEST_CASE("Xas.interrupt", "[xas]") {
+    cout << "Testing interrupt constants in assembler... ";
+
+    int rv = system("./xas test/samples/interrupt.x16s");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    rv = system("cmp a.obj test/samples/interrupt.obj");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    cout << "Passed" << endl;
+}
+
 // Test with errors in assembler - missing label
 TEST_CASE("Xas.error.nolabel", "[xas]") {
     cout << "Testing error with no matching label in assembler... ";
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "control.h"
+#include "feature.h"
+#include "instruction.h"
+#include "machine.h"
+#include "predecode.h"
+#include "threaded.h"
+#include "trap.h"
+#include "x16.h"
+
+#if X16_HAVE_THREADED
+
+// Condition flag for a result
+#define COND_OF(result) \
+    ((result) == 0 ? FL_ZRO : (((result) & 0x8000) ? FL_NEG : FL_POS))
+
+// Memory read. Only device pages need the machine, which also gets the
+// PC so a device can tell where it is read from.
+#define MEMREAD(address)                                    \
+    (machine_is_io(machine, (address)) ?                    \
+        (machine->cpu.registers[R_PC] = reg[R_PC],          \
+         machine_io_read(machine, (address))) : mem[(address)])
+
+// Record the result that sets the condition codes. The flags are only
+// computed from it by BR and when the registers go back to the machine.
+#ifdef X16_EAGER_COND
+#define SET_RESULT(value)   (reg[R_COND] = COND_OF(value))
+#else
+#define SET_RESULT(value)   (last = (value), lazy = true)
+#endif
+
+// Current condition codes
+#define COND()  (lazy ? COND_OF(last) : reg[R_COND])
+
+// Copy the local register file back into the machine
+#define SYNC_OUT() do {                                     \
+        for (int i = 0; i < MAX_REGISTERS; i++) {           \
+            cpu_set(&machine->cpu, (reg_t) i, reg[i]);      \
+        }                                                   \
+        if (lazy) {                                         \
+            cpu_set_result(&machine->cpu, last);            \
+        }                                                   \
+    } while (0)
+
+// Reload the local register file from the machine
+#define SYNC_IN() do {                                      \
+        for (int i = 0; i < MAX_REGISTERS; i++) {           \
+            reg[i] = cpu_reg(&machine->cpu, (reg_t) i);     \
+        }                                                   \
+        lazy = false;                                       \
+    } while (0)
+
+// Fetch, decode and dispatch the next instruction. This is copied into
+// the tail of every handler so each has its own indirect jump. The first
+// instruction of a run never stops at a breakpoint.
+#define DISPATCH() do {                                     \
+        if (count == budget) {                              \
+            goto out_of_budget;                             \
+        }                                                   \
+        if ((FEATURES & FEATURE_BREAKPOINTS) && count != 0 && \
+            breakpoints[reg[R_PC]]) {                       \
+            goto breakpoint;                                \
+        }                                                   \
+        count++;                                            \
+        instruction = MEMREAD(reg[R_PC]);                   \
+        if (FEATURES & FEATURE_TRACE) {                     \
+            feature_trace(reg[R_PC], instruction);          \
+        }                                                   \
+        reg[R_PC]++;                                        \
+        d = predecoded(instruction);                        \
+        if (FEATURES & FEATURE_PROFILE) {                   \
+            PROFILE_COUNTS[d->opcode]++;                    \
+        }                                                   \
+        goto *handlers[d->opcode];                          \
+    } while (0)
+
+// Name of the interpreter built for a feature set
+#define THREADED_VARIANT(features)  THREADED_VARIANT_(features)
+#define THREADED_VARIANT_(features) execute_threaded_##features
+
+#define FEATURES 0
+#include "threaded_core.h"
+#undef FEATURES
+#define FEATURES 1
+#include "threaded_core.h"
+#undef FEATURES
+#define FEATURES 2
+#include "threaded_core.h"
+#undef FEATURES
+#define FEATURES 3
+#include "threaded_core.h"
+#undef FEATURES
+#define FEATURES 4
+#include "threaded_core.h"
+#undef FEATURES
+#define FEATURES 5
+#include "threaded_core.h"
+#undef FEATURES
+#define FEATURES 6
+#include "threaded_core.h"
+#undef FEATURES
+#define FEATURES 7
+#include "threaded_core.h"
+#undef FEATURES
+
+// The interpreters, indexed by feature set
+static int (*const variants[NUM_FEATURE_SETS])(x16_t*, uint64_t,
+                                                uint64_t*) = {
+    execute_threaded_0, execute_threaded_1, execute_threaded_2,
+    execute_threaded_3, execute_threaded_4, execute_threaded_5,
+    execute_threaded_6, execute_threaded_7,
+};
+
+// Run the machine with the interpreter for the features the run needs
+int execute_threaded(x16_t* machine, uint64_t max_instructions,
+                     uint64_t* executed) {
+    return variants[features_needed(machine)](machine, max_instructions,
+                                              executed);
+}
+
+#endif  // X16_HAVE_THREADED
@@ -0,0 +1,24 @@
+#ifndef THREADED_H_
+#define THREADED_H_
+
+#include <stdint.h>
+#include "x16.h"
+
+// The direct-threaded interpreter needs labels as values, a GCC/Clang
+// extension. Build with -DX16_NO_THREADED to leave it out.
+#if defined(__GNUC__) && !defined(X16_NO_THREADED)
+#define X16_HAVE_THREADED   1
+#else
+#define X16_HAVE_THREADED   0
+#endif
+
+#if X16_HAVE_THREADED
+// Execute instructions with the direct-threaded interpreter until HALT or
+// until max_instructions have been executed (0 means no limit). The
+// number of instructions executed is stored in executed if it is not NULL.
+// Return -1 for HALT or 0 when the budget ran out.
+int execute_threaded(x16_t* machine, uint64_t max_instructions,
+                     uint64_t* executed);
+#endif
+
+#endif  // THREADED_H_
@@ -0,0 +1,152 @@
+// The direct-threaded interpreter core. threaded.c includes this file once
+// for every feature set, with FEATURES defined to the feature mask (see
+// feature.h), so there is no include guard. Instrumentation is tested
+// against the constant FEATURES and compiles away when it is off.
+
+// Run the machine with the direct-threaded interpreter built for FEATURES
+static int THREADED_VARIANT(FEATURES)(x16_t* machine,
+                                      uint64_t max_instructions,
+                                      uint64_t* executed) {
+    // One handler per opcode, in opcode_t order
+    static void* handlers[16] = {
+        &&op_br, &&op_add, &&op_ld, &&op_st,
+        &&op_jsr, &&op_and, &&op_ldr, &&op_str,
+        &&op_rti, &&op_not, &&op_ldi, &&op_sti,
+        &&op_jmp, &&op_res, &&op_lea, &&op_trap
+    };
+
+    const uint8_t* breakpoints = x16_breakpoints(machine);
+    (void) breakpoints;
+    uint64_t budget = max_instructions ? max_instructions : UINT64_MAX;
+    uint64_t count = 0;
+    uint16_t* mem = machine->memory;
+    uint16_t reg[MAX_REGISTERS];
+    uint16_t instruction, address, result;
+    uint16_t last = 0;      // result the condition codes come from
+    bool lazy = false;      // reg[R_COND] is stale, use last
+    const decoded_t* d;
+    int rv = 0;
+
+    SYNC_IN();
+    DISPATCH();
+
+op_add:
+    result = reg[d->src1] + (d->imm ? d->value : reg[d->src2]);
+    reg[d->dst] = result;
+    SET_RESULT(result);
+    DISPATCH();
+
+op_and:
+    result = reg[d->src1] & (d->imm ? d->value : reg[d->src2]);
+    reg[d->dst] = result;
+    SET_RESULT(result);
+    DISPATCH();
+
+op_not:
+    result = ~reg[d->src1];
+    reg[d->dst] = result;
+    SET_RESULT(result);
+    DISPATCH();
+
+op_br:
+    if (d->nzp & COND()) {
+        reg[R_PC] += d->value;
+    }
+    DISPATCH();
+
+op_jmp:
+    reg[R_PC] = reg[d->src1];
+    DISPATCH();
+
+op_jsr:
+    // R7 is written first, so JSRR R7 jumps to the return address
+    reg[R_R7] = reg[R_PC];
+    reg[R_PC] = d->nzp ? reg[R_PC] + d->value : reg[d->src1];
+    DISPATCH();
+
+op_ld:
+    address = reg[R_PC] + d->value;
+    result = MEMREAD(address);
+    reg[d->dst] = result;
+    SET_RESULT(result);
+    DISPATCH();
+
+op_ldi:
+    address = reg[R_PC] + d->value;
+    address = MEMREAD(address);
+    result = MEMREAD(address);
+    reg[d->dst] = result;
+    SET_RESULT(result);
+    DISPATCH();
+
+op_ldr:
+    address = reg[d->src1] + d->value;
+    result = MEMREAD(address);
+    reg[d->dst] = result;
+    SET_RESULT(result);
+    DISPATCH();
+
+op_lea:
+    result = reg[R_PC] + d->value;
+    reg[d->dst] = result;
+    SET_RESULT(result);
+    DISPATCH();
+
+op_st:
+    address = reg[R_PC] + d->value;
+    x16_memwrite(machine, address, reg[d->dst]);
+    if (machine->yield) {
+        goto out_of_budget;
+    }
+    DISPATCH();
+
+op_sti:
+    address = reg[R_PC] + d->value;
+    address = MEMREAD(address);
+    x16_memwrite(machine, address, reg[d->dst]);
+    if (machine->yield) {
+        goto out_of_budget;
+    }
+    DISPATCH();
+
+op_str:
+    address = reg[d->src1] + d->value;
+    x16_memwrite(machine, address, reg[d->dst]);
+    if (machine->yield) {
+        goto out_of_budget;
+    }
+    DISPATCH();
+
+op_trap:
+    // Traps work on the machine, so hand it the current registers
+    SYNC_OUT();
+    rv = trap(machine, instruction);
+    SYNC_IN();
+    if (rv != 0) {
+        goto done;
+    }
+    DISPATCH();
+
+op_rti:
+op_res:
+    // RTI, which engine_run() executes, and the reserved opcode. Leave PC
+    // on the instruction.
+    reg[R_PC]--;
+    x16_stop(machine, X16_STOP_ILLEGAL);
+    rv = -1;
+    goto done;
+
+breakpoint:
+    x16_stop(machine, X16_STOP_BREAKPOINT);
+    rv = -1;
+    goto done;
+
+out_of_budget:
+    rv = 0;
+done:
+    SYNC_OUT();
+    if (executed != NULL) {
+        *executed = count;
+    }
+    return rv;
+}
@@ -6,14 +6,146 @@
 #include "instruction.h"
 #include "bits.h"
 #include "control.h"
+#include "machine.h"
 
+// The string traps search and narrow eight words at a time with SSE2.
+// Build with -DX16_NO_SIMD for the plain loops.
+#if defined(__SSE2__) && !defined(X16_NO_SIMD)
+#include <emmintrin.h>
+#define X16_HAVE_SIMD   1
+#else
+#define X16_HAVE_SIMD   0
+#endif
+
+// Words of a string handled at a time
+#define STRING_CHUNK    256
+
+// Number of words from address to the next device page or the end of
+// memory, at most STRING_CHUNK
+static size_t ram_words(x16_t* machine, uint16_t address) {
+    uint32_t end = address;
+    while (end < MAX_MEMORY && end - address < STRING_CHUNK &&
+           !machine_is_io(machine, (uint16_t) end)) {
+        end = ((end >> MEM_PAGE_SHIFT) + 1) << MEM_PAGE_SHIFT;
+    }
+    if (end > MAX_MEMORY) {
+        end = MAX_MEMORY;
+    }
+    return end - address < STRING_CHUNK ? end - address : STRING_CHUNK;
+}
+
+// Index of the first word that ends a string: a word whose low byte is 0
+// for PUTS, a 0 word for PUTSP. count if there is none.
+static size_t string_end(const uint16_t* words, size_t count, bool packed) {
+    size_t i = 0;
+#if X16_HAVE_SIMD
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi16(packed ? 0xffff : 0x00ff);
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (words + i));
+        int found = _mm_movemask_epi8(
+            _mm_cmpeq_epi16(_mm_and_si128(v, mask), zero));
+        if (found != 0) {
+            return i + __builtin_ctz(found) / 2;
+        }
+    }
+#endif
+    uint16_t mask16 = packed ? 0xffff : 0x00ff;
+    while (i < count && (words[i] & mask16) != 0) {
+        i++;
+    }
+    return i;
+}
+
+// Narrow count words to the characters they print into out: the low byte
+// of each word for PUTS, the low then the high byte for PUTSP, where a 0
+// high byte is not printed. Return the number of characters.
+static size_t narrow(const uint16_t* words, size_t count, bool packed,
+                     char* out) {
+    size_t i = 0;
+    size_t n = 0;
+#if X16_HAVE_SIMD
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    if (!packed) {
+        for (; i + 16 <= count; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (words + i));
+            __m128i b = _mm_loadu_si128((const __m128i*) (words + i + 8));
+            _mm_storeu_si128((__m128i*) (out + i),
+                _mm_packus_epi16(_mm_and_si128(a, low),
+                                 _mm_and_si128(b, low)));
+        }
+        n = i;
+    } else {
+        // Words are little endian, low byte first, which is the order
+        // they print in as long as no high byte is 0
+        for (; i + 8 <= count; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (words + i));
+            __m128i high = _mm_srli_epi16(v, 8);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0) {
+                break;
+            }
+            _mm_storeu_si128((__m128i*) (out + n), v);
+            n += 16;
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        out[n++] = (char) (words[i] & 0xff);
+        if (packed && (words[i] >> 8) != 0) {
+            out[n++] = (char) (words[i] >> 8);
+        }
+    }
+    return n;
+}
+
+// Print the string at address for PUTS, or PUTSP when packed. RAM is
+// searched and narrowed in place; words on device pages are read through
+// the device one at a time.
+static void put_string(x16_t* machine, uint16_t address, bool packed) {
+    console_t* console = machine_console(machine);
+    char chunk[2 * STRING_CHUNK];
+    for (;;) {
+        size_t count = ram_words(machine, address);
+        const uint16_t* words = &machine->memory[address];
+        uint16_t word;
+        if (count == 0) {
+            word = x16_memread(machine, address);
+            words = &word;
+            count = 1;
+        }
+        size_t length = string_end(words, count, packed);
+        size_t n = narrow(words, length, packed, chunk);
+#ifdef X16_TRAP_DEBUG
+        for (size_t i = 0; i < n; i++) {
+            fprintf(stderr, "Putting %c\n", chunk[i]);
+        }
+#endif
+        console_write(console, chunk, n);
+        if (length < count) {
+            return;
+        }
+        address += count;
+    }
+}
 
 int trap(x16_t* machine, uint16_t instruction) {
     uint16_t vec = getbits(instruction, 0, 8);
+    machine->activity++;
+
+    // Give the caller a chance to provide input rather than block. The
+    // trap runs again when the machine is resumed.
+    if ((vec == TRAP_GETC || vec == TRAP_IN) && x16_input_wait(machine) &&
+        !x16_input_ready(machine)) {
+        x16_flush(machine);
+        x16_set(machine, R_PC, x16_pc(machine) - 1);
+        x16_stop(machine, X16_STOP_INPUT);
+        return -1;
+    }
+
     uint16_t* ptr;
     uint16_t c;
     int key;
-    int base;
 
     switch (vec) {
     case TRAP_GETC:
@@ -22,7 +154,7 @@ int trap(x16_t* machine, uint16_t instruction) {
         // We do this by calling getchar, and setting the data to be
         // in the memory data register. It will get moved to R0 in the
         // WB stage.
-        key = getchar();
+        key = x16_getchar(machine);
         if (key == EOF) {
             perror("Getchar error");
             abort();
@@ -35,28 +167,20 @@ int trap(x16_t* machine, uint16_t instruction) {
         // TRAP OUT
         // Write a single char in R0 to output
         c = x16_reg(machine, R_R0);
-        putchar((char) c);
-        fflush(stdout);
+        console_putc(machine_console(machine), (char) c);
         break;
 
     case TRAP_PUTS:
         // TRAP PUTS
         // one char per word, with the word address stored in R0
-        base = x16_reg(machine, R_R0);
-        char c = (char) x16_memread(machine, base);
-        while (c != '\0') {
-            putc(c, stdout);
-            c = (char) x16_memread(machine, ++base);
-        }
-        fflush(stdout);
+        put_string(machine, x16_reg(machine, R_R0), false);
         break;
 
     case TRAP_IN:
         // Read and echo a character, put it in R0
-        printf("Enter a character: ");
-        c = getchar();
-        putc(c, stdout);
-        fflush(stdout);
+        console_write(machine_console(machine), "Enter a character: ", 19);
+        c = x16_getchar(machine);
+        console_putc(machine_console(machine), (char) c);
         // Setting the data to be in the memory data register.
         // It will get moved to R0 in the WB stage.
         x16_set(machine, R_R0, c);
@@ -64,33 +188,22 @@ int trap(x16_t* machine, uint16_t instruction) {
         break;
 
     case TRAP_PUTSP:
-        // one char per byte (two bytes per word)
-        //       here we need to swap back to
-        //       big endian format */
-        base = x16_reg(machine, R_R0);
-        for (int val = x16_memread(machine, base);
-            (val = x16_memread(machine, base)) != 0; base++) {
-            char char1 = (val) & 0xff;
-            putc(char1, stdout);
-            fprintf(stderr, "Putting %c\n", char1);
-            char char2 = (val) >> 8;
-            if (char2) {
-                putc(char2, stdout);
-                fprintf(stderr, "Putting %c\n", char2);
-            }
-        }
-        fflush(stdout);
+        // one char per byte (two bytes per word), low byte first
+        put_string(machine, x16_reg(machine, R_R0), true);
         break;
 
     case TRAP_HALT:
         // TRAP HALT
-        puts("HALT\n");
-        fflush(stdout);
+        console_write(machine_console(machine), "HALT\n\n", 6);
+        x16_flush(machine);
         return -1;
 
     default:
-        // Bad trap vector
-        abort();
+        // Bad trap vector. Stop with PC on the trap, as for an illegal
+        // opcode, rather than take down every machine in the process.
+        x16_set(machine, R_PC, x16_pc(machine) - 1);
+        x16_stop(machine, X16_STOP_ILLEGAL);
+        return -1;
     }
 
     return 0;
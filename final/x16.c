@@ -1,104 +1,283 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
-#include <sys/select.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include "x16.h"
 #include "instruction.h"
+#include "predecode.h"
+#include "block.h"
+#include "machine.h"
+#include "control.h"
+#include "engine.h"
+#include "console.h"
+#include "framebuffer.h"
 
 int LOG = 0;
 FILE* LOGFP = NULL;
+int PROFILE = 0;
+uint64_t PROFILE_COUNTS[16];
 
-// The X16 machine
-typedef struct x16 {
-    // The memory of the computer is emulated by this array, each slot of
-    // which stores a 16 bit value.
-    uint16_t memory[MAX_MEMORY];
+// Get the console of the machine, creating a TTY console on first use
+console_t* machine_console(x16_t* machine) {
+    if (machine->console == NULL) {
+        machine->console = console_tty_create(STDIN_FILENO, STDOUT_FILENO);
+    }
+    return machine->console;
+}
+
+// Empty polls of MR_KBSR in a row before the guest counts as idle
+#define IDLE_POLLS      1000
+
+// Polls from within this many words of each other are the same loop
+#define IDLE_RANGE      16
+
+// Longest the host sleeps on one idle poll, in nanoseconds. The guest
+// sees the poll come back empty, as it would have anyway.
+#define IDLE_SLEEP_NS   10000000
+
+// True when the guest has done nothing but poll an empty keyboard from
+// the same loop for IDLE_POLLS polls
+static bool keyboard_idle(x16_t* machine) {
+    uint16_t pc = machine->cpu.registers[R_PC];
+    if (machine->activity != machine->idle_activity ||
+        (uint16_t) (pc - machine->idle_pc + IDLE_RANGE) > 2 * IDLE_RANGE) {
+        machine->idle_activity = machine->activity;
+        machine->idle_pc = pc;
+        machine->idle_polls = 0;
+        return false;
+    }
+    return ++machine->idle_polls >= IDLE_POLLS;
+}
+
+// Look for a key on a read of MR_KBSR. A guest spinning on an empty
+// MR_KBSR puts the host to sleep until a key arrives or IDLE_SLEEP_NS
+// pass.
+static void keyboard_poll(x16_t* machine) {
+    // A guest looking for a key is done drawing for now
+    machine_flush(machine, false);
+    console_t* console = machine_console(machine);
+    int key = console->ops->poll(console);
+    if (key == CONSOLE_EMPTY && machine->idle_sleep &&
+        keyboard_idle(machine) &&
+        console->ops->sleep(console, IDLE_SLEEP_NS)) {
+        key = console->ops->poll(console);
+    }
+    if (key != CONSOLE_EMPTY) {
+        machine->idle_polls = 0;
+        machine->memory[MR_KBSR] = KBSR_READY;
+        machine->memory[MR_KBDR] = key;
+    } else {
+        machine->memory[MR_KBSR] = 0;
+    }
+}
+
+// Read the keyboard and timer registers
+static uint16_t keyboard_read(x16_t* machine, void* device,
+                              uint16_t address) {
+    switch (address) {
+    case MR_KBSR:
+        // A key the keyboard interrupt latched stays until MR_KBDR is read
+        if (!machine->key_latched) {
+            keyboard_poll(machine);
+        }
+        return machine->memory[MR_KBSR] | machine->kbsr_ie;
+
+    case MR_KBDR:
+        if (machine->key_latched) {
+            machine->key_latched = false;
+            machine->memory[MR_KBSR] = 0;
+        }
+        return machine->memory[MR_KBDR];
+
+    case MR_TMR:
+    case MR_TMI:
+        return interrupt_timer_read(machine, address);
+
+    default:
+        return machine->memory[address];
+    }
+}
 
-    // The register file contains R0-R7, PC and condition registers
-    uint16_t registers[MAX_REGISTERS];
-} x16_t;
+// Write the keyboard and timer registers. The rest of the page is RAM.
+static void keyboard_write(x16_t* machine, void* device, uint16_t address,
+                           uint16_t value) {
+    switch (address) {
+    case MR_KBSR:
+        if ((value & KBSR_IE) != machine->kbsr_ie) {
+            machine->kbsr_ie = value & KBSR_IE;
+            interrupt_keyboard_changed(machine);
+        }
+        break;
 
-// Special location in memory for memory mapped registers
-typedef enum {
-    MR_KBSR = 0xfe00,    // keyboard status
-    MR_KBDR = 0xfe02     // keyboard data
-} mmap_reg_t;
+    case MR_TMR:
+    case MR_TMI:
+        interrupt_timer_write(machine, address, value);
+        break;
 
+    default:
+        machine->memory[address] = value;
+        break;
+    }
+}
 
 
 // Initialize the x16 machine
 x16_t* x16_create() {
-    x16_t* machine = (x16_t*) malloc(sizeof(x16_t));
+    predecode_init();                                  // decode table
+    x16_t* machine = (x16_t*) aligned_alloc(CACHE_LINE, sizeof(x16_t));
+    if (machine == NULL) {
+        return NULL;
+    }
     memset(machine, 0, sizeof(x16_t));
+    // Memory is mapped rather than allocated, so the host only backs the
+    // pages the guest writes. Reads of the others come from the host's
+    // zero page.
+    void* memory = mmap(NULL, MAX_MEMORY * sizeof(uint16_t),
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    if (memory == MAP_FAILED) {
+        free(machine);
+        return NULL;
+    }
+    machine->memory = (uint16_t*) memory;
     x16_set(machine, R_PC, DEFAULT_CODESTART);         // default PC start
     x16_set(machine, R_COND, FL_ZRO);                  // default last code is 0
+    x16_map_device(machine, KEYBOARD_PAGE, keyboard_read, keyboard_write,
+                   NULL);
+    machine->idle_sleep = true;
+    machine->saved_ssp = SUPERVISOR_STACK;
     return machine;
 }
 
 // Free the memory consumed by the machine
 void x16_free(x16_t* machine) {
+    block_cache_free(machine->blocks);
+    if (machine->framebuffer != NULL) {
+        machine_flush(machine, true);
+        framebuffer_free(machine->framebuffer, machine->console);
+    }
+    console_free(machine->console);
+    interrupt_free(machine->interrupts);
+    x16_snapshot_free(machine->base);
+    free(machine->breakpoints);
+    munmap(machine->memory, MAX_MEMORY * sizeof(uint16_t));
     free(machine);
 }
 
 // Get the program counter
 uint16_t x16_pc(x16_t* machine) {
-    return x16_reg(machine, R_PC);
+    return machine->cpu.registers[R_PC];
 }
 
 // Get the condition register
 uint16_t x16_cond(x16_t* machine) {
-    return x16_reg(machine, R_COND);
+    return cpu_cond(&machine->cpu);
 }
 
 
 // Get the register
 uint16_t x16_reg(x16_t* machine, reg_t reg) {
-    return machine->registers[reg];
+    return cpu_reg(&machine->cpu, reg);
 }
 
 // Set the machine register
 void x16_set(x16_t* machine, reg_t reg, uint16_t value) {
-    machine->registers[reg] = value;
+    cpu_set(&machine->cpu, reg, value);
 }
 
+// Record the result that sets the condition codes
+void x16_set_result(x16_t* machine, uint16_t result) {
+    cpu_set_result(&machine->cpu, result);
+}
 
-// Check Key
-static uint16_t check_key() {
-    fd_set readfds;
-    FD_ZERO(&readfds);
-    FD_SET(STDIN_FILENO, &readfds);
+// Instructions executed so far
+uint64_t x16_executed(x16_t* machine) {
+    return machine->cpu.executed;
+}
 
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 0;
-    return select(1, &readfds, NULL, NULL, &timeout) != 0;
+// The processor status register
+uint16_t x16_psr(x16_t* machine) {
+    return (machine->supervisor ? 0 : PSR_USER) |
+        machine->priority << PSR_PRIORITY_SHIFT | cpu_cond(&machine->cpu);
+}
+
+// True when a key can be read without blocking
+bool x16_input_ready(x16_t* machine) {
+    console_t* console = machine_console(machine);
+    return console->ops->ready(console);
+}
+
+// Read a key, waiting for one
+int x16_getchar(x16_t* machine) {
+    x16_flush(machine);
+    console_t* console = machine_console(machine);
+    return console->ops->getc(console);
+}
+
+// Map a device at a page
+int x16_map_device(x16_t* machine, uint8_t page, x16_io_read_t read,
+                   x16_io_write_t write, void* device) {
+    // Entry 0 stands for RAM
+    if (machine->io_page[page] != 0 || machine->num_devices == MAX_DEVICES) {
+        return -1;
+    }
+    int index = ++machine->num_devices;
+    machine->devices[index - 1] = (x16_device_t) {read, write, device};
+    machine->io_page[page] = index;
+
+    // Translated code may read the page as RAM
+    if (machine->blocks != NULL) {
+        block_cache_flush(machine->blocks);
+    }
+    return 0;
+}
+
+// Read an address on a device page
+uint16_t machine_io_read(x16_t* machine, uint16_t address) {
+    x16_device_t* io =
+        &machine->devices[machine->io_page[address >> MEM_PAGE_SHIFT] - 1];
+    if (io->read == NULL) {
+        return machine->memory[address];
+    }
+    return io->read(machine, io->device, address);
+}
+
+// Write an address on a device page
+void machine_io_write(x16_t* machine, uint16_t address, uint16_t val) {
+    x16_device_t* io =
+        &machine->devices[machine->io_page[address >> MEM_PAGE_SHIFT] - 1];
+    if (io->write == NULL) {
+        machine_ram_write(machine, address, val);
+        return;
+    }
+    machine->activity++;
+    io->write(machine, io->device, address, val);
 }
 
 // Read memory. Handles memory mapped registers
 uint16_t x16_memread(x16_t* machine, uint16_t address) {
-    if (address == MR_KBSR) {
-        // LOG = 0;
-        if (check_key()) {
-            machine->memory[MR_KBSR] = (1 << 15);
-            machine->memory[MR_KBDR] = getchar();
-            // printf("check_key: got %d\n", (int) machine->memory[MR_KBDR]);
-            // LOG = 1;
-        } else {
-            machine->memory[MR_KBSR] = 0;
-        }
-    }
-    return machine->memory[address];
+    return machine_memread(machine, address);
 }
 
 // Memory write
 void x16_memwrite(x16_t* machine, uint16_t address, uint16_t val) {
-    machine->memory[address] = val;
+    machine_memwrite(machine, address, val);
 }
 
-// Get a pointer to the 16bit word in the given offset in memoty
+// Get the block cache, creating it on first use
+block_cache_t* x16_block_cache(x16_t* machine) {
+    if (machine->blocks == NULL) {
+        machine->blocks = block_cache_create();
+    }
+    return machine->blocks;
+}
+
+// Get a pointer to the 16bit word in the given offset in memoty. The
+// writes through it are not tracked, so every page counts as written.
 uint16_t* x16_memory(x16_t* machine, uint16_t offset) {
+    memset(machine->dirty, 1, sizeof(machine->dirty));
     return &machine->memory[offset];
 }
 
@@ -130,3 +309,101 @@ void x16_print(x16_t* machine) {
         printf("\tR%d(0x%x)\n", i, x16_reg(machine, (reg_t) i));
     }
 }
+
+// Execute one instruction
+int x16_exec(x16_t* machine) {
+    machine->stop = X16_STOP_HALT;
+    machine->cpu.executed++;
+    return execute_instruction(machine);
+}
+
+// Execute a batch of instructions
+x16_stop_t x16_run(x16_t* machine, uint64_t max_instructions,
+                   x16_stop_info_t* info) {
+    uint64_t executed = 0;
+    int rv = engine_run(machine, engine_default(), max_instructions,
+                        &executed);
+    x16_stop_t reason = rv == 0 ? X16_STOP_BUDGET : machine->stop;
+    if (info != NULL) {
+        info->reason = reason;
+        info->executed = executed;
+        info->pc = x16_pc(machine);
+    }
+    return reason;
+}
+
+// Record why the machine is stopping
+void x16_stop(x16_t* machine, x16_stop_t reason) {
+    machine->stop = reason;
+}
+
+// Why the machine last stopped
+x16_stop_t x16_stop_reason(x16_t* machine) {
+    return machine->stop;
+}
+
+// Set or clear a breakpoint
+void x16_set_breakpoint(x16_t* machine, uint16_t address, bool set) {
+    if (machine->breakpoints == NULL) {
+        if (!set) {
+            return;
+        }
+        machine->breakpoints = (uint8_t*) calloc(MAX_MEMORY, 1);
+    }
+    if (machine->breakpoints[address] != set) {
+        machine->breakpoints[address] = set;
+        machine->num_breakpoints += set ? 1 : -1;
+    }
+}
+
+// The breakpoint map, or NULL when no breakpoint is set
+const uint8_t* x16_breakpoints(x16_t* machine) {
+    return machine->num_breakpoints > 0 ? machine->breakpoints : NULL;
+}
+
+// Stop instead of blocking when a trap needs input
+void x16_set_input_wait(x16_t* machine, bool stop) {
+    machine->input_wait = stop;
+}
+
+// True when GETC and IN should stop rather than block
+bool x16_input_wait(x16_t* machine) {
+    return machine->input_wait;
+}
+
+// Draw the framebuffer if a frame is due and write out console output
+void machine_flush(x16_t* machine, bool frame) {
+    if (machine->framebuffer != NULL) {
+        framebuffer_render(machine->framebuffer, machine_console(machine),
+                           frame);
+    }
+    if (machine->console != NULL) {
+        machine->console->ops->flush(machine->console);
+    }
+}
+
+// Write out the console output the guest has buffered
+void x16_flush(x16_t* machine) {
+    machine_flush(machine, true);
+}
+
+// Use a console in place of stdin and stdout
+void x16_set_console(x16_t* machine, console_t* console) {
+    machine_flush(machine, true);
+    console_free(machine->console);
+    machine->console = console;
+}
+
+// Map the framebuffer device
+int x16_map_framebuffer(x16_t* machine) {
+    if (machine->framebuffer != NULL) {
+        return -1;
+    }
+    machine->framebuffer = framebuffer_create(machine);
+    return machine->framebuffer != NULL ? 0 : -1;
+}
+
+// Sleep the host while the guest waits for a key on MR_KBSR
+void x16_set_idle_sleep(x16_t* machine, bool sleep) {
+    machine->idle_sleep = sleep;
+}
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "console.h"
 
 // Total amount of memory for 16 bit address
 #define MAX_MEMORY                  65536
@@ -29,13 +30,97 @@ typedef enum {
 // There are 10 total registers
 #define MAX_REGISTERS   10
 
-// The X16 machine
+// Memory is divided into pages of 256 words. Each page holds either
+// plain RAM or the registers of a memory mapped device.
+#define MEM_PAGE_SHIFT  8
+#define MEM_PAGE_SIZE   (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGES       (MAX_MEMORY / MEM_PAGE_SIZE)
+
+// Special location in memory for memory mapped registers
+typedef enum {
+    MR_FB = 0xf000,      // framebuffer, see x16_map_framebuffer()
+    MR_KBSR = 0xfe00,    // keyboard status
+    MR_KBDR = 0xfe02,    // keyboard data
+    MR_TMR = 0xfe08,     // timer status
+    MR_TMI = 0xfe0a      // timer interval in instructions, 0 when stopped
+} mmap_reg_t;
+
+// Page of the keyboard and timer registers
+#define KEYBOARD_PAGE   (MR_KBSR >> MEM_PAGE_SHIFT)
+
+// Bits of MR_KBSR and MR_TMR
+#define KBSR_READY      0x8000  // a key is waiting in MR_KBDR
+#define KBSR_IE         0x4000  // interrupt when a key comes in
+#define TMR_FIRED       0x8000  // the interval passed since the last read
+#define TMR_IE          0x4000  // interrupt when the interval passes
+
+// Interrupts. The handler of vector v starts at the address in the word at
+// IVT_BASE + v. It runs in supervisor mode, on the supervisor stack, at
+// the priority of the interrupt, and returns with RTI. An interrupt is
+// only taken when its priority is above that of the running code, which
+// is 0 outside handlers.
+#define IVT_BASE            0x0100
+#define INT_KEYBOARD        0x80
+#define INT_TIMER           0x81
+#define PL_KEYBOARD         4
+#define PL_TIMER            5
+
+// The supervisor stack grows down from here
+#define SUPERVISOR_STACK    0x3000
+
+// Bits of the processor status register, see x16_psr(). The condition
+// codes are in the low three bits.
+#define PSR_USER            0x8000  // running in user mode
+#define PSR_PRIORITY_SHIFT  8       // priority in bits 10 to 8
+
+// The framebuffer is FB_ROWS rows of FB_COLS character cells. The low
+// byte of the word at MR_FB + row * FB_COLS + col is the character shown
+// in the cell; 0 shows as a space.
+#define FB_COLS         80
+#define FB_ROWS         25
+#define FB_PAGE         (MR_FB >> MEM_PAGE_SHIFT)
+#define FB_PAGES        ((FB_ROWS * FB_COLS + MEM_PAGE_SIZE - 1) / \
+                         MEM_PAGE_SIZE)
+
+// The X16 machine. Its layout is in machine.h.
 typedef struct x16 x16_t;
 
+// A saved state of a machine, see x16_snapshot()
+typedef struct x16_snapshot x16_snapshot_t;
+
+// Handlers of a memory mapped device. They get every access to the
+// device page, with the device pointer given to x16_map_device().
+typedef uint16_t (*x16_io_read_t)(x16_t* machine, void* device,
+                                  uint16_t address);
+typedef void (*x16_io_write_t)(x16_t* machine, void* device,
+                               uint16_t address, uint16_t value);
+
+// Most devices a machine can have, the keyboard included
+#define MAX_DEVICES     16
+
+// Why a run of the machine stopped
+typedef enum {
+    X16_STOP_HALT = 0,      // TRAP HALT
+    X16_STOP_BUDGET,        // max_instructions have been executed
+    X16_STOP_INPUT,         // GETC or IN with no input ready
+    X16_STOP_BREAKPOINT,    // PC reached a breakpoint
+    X16_STOP_ILLEGAL,       // RTI in user mode, RES or a bad trap vector
+} x16_stop_t;
+
+// What x16_run() did
+typedef struct {
+    x16_stop_t reason;
+    uint64_t executed;      // instructions executed
+    uint16_t pc;            // PC after the run. For anything but HALT and
+                            // BUDGET, the instruction that did not run.
+} x16_stop_info_t;
+
 
 // Initialize and return a new x16 machine. The program counter
 // is set to the default start location DEFAULT_CODESTART
-// All registers and memory are cleared to 0
+// All registers and memory are cleared to 0. Host memory is only taken
+// for the pages the guest writes. Returns NULL if the machine or its
+// memory cannot be allocated.
 x16_t* x16_create();
 
 // Free all resources consumed by a machine
@@ -44,7 +129,8 @@ void x16_free(x16_t* machine);
 // Get the program counter
 uint16_t x16_pc(x16_t* machine);
 
-// Get the condition register
+// Get the condition register. The flags are computed from the last result
+// on demand, see x16_set_result().
 uint16_t x16_cond(x16_t* machine);
 
 // Get the contents of the machine register
@@ -53,25 +139,142 @@ uint16_t x16_reg(x16_t* machine, reg_t reg);
 // Set the machine register
 void x16_set(x16_t* machine, reg_t reg, uint16_t value);
 
+// Record the result of an instruction that sets the condition codes.
+// R_COND is only computed when it is read, through x16_cond() or
+// x16_reg(). Build with -DX16_EAGER_COND to compute it right away.
+void x16_set_result(x16_t* machine, uint16_t result);
+
+// Number of instructions the machine has executed
+uint64_t x16_executed(x16_t* machine);
+
+// The processor status register: PSR_USER outside interrupt handlers,
+// the priority of the running code and the condition codes
+uint16_t x16_psr(x16_t* machine);
+
 // Read memory. Handles memory mapped registers
 uint16_t x16_memread(x16_t* machine, uint16_t address);
 
 // Memory write
 void x16_memwrite(x16_t* machine, uint16_t address, uint16_t val);
 
-// Get a pointer to the 16bit word in the given offset in memoty
+// Map a device at a page. read or write may be NULL, and those accesses
+// then go to RAM as on any other page. Return 0, or -1 if the page
+// already has a device or there are MAX_DEVICES devices. The keyboard is
+// mapped at KEYBOARD_PAGE when the machine is created.
+int x16_map_device(x16_t* machine, uint8_t page, x16_io_read_t read,
+                   x16_io_write_t write, void* device);
+
+// Get a pointer to the 16bit word in the given offset in memoty.
+// Writes through the pointer do not invalidate translated blocks, and
+// the next x16_snapshot() compares every page, as they are not tracked.
 uint16_t* x16_memory(x16_t* machine, uint16_t offset);
 
+// Get the translated blocks of the machine, creating the cache on first
+// use (see block.h)
+struct block_cache* x16_block_cache(x16_t* machine);
+
 // Dump X16
 void x16_print(x16_t* machine);
 
-// Execute one single instruction. Return 0 on success or -1 for HALT
+// Execute one single instruction. Return 0 on success or -1 when the
+// machine stopped, see x16_stop_reason().
 int x16_exec(x16_t* machine);
 
-// This variable is set to 1 to turn on logging at each instruction execution
+// Execute up to max_instructions (0 means no limit) with the default
+// engine, keeping the registers in locals for the whole batch. Return why
+// it stopped, and fill in info if it is not NULL. The machine can be run
+// again after any reason but HALT; a run never stops at a breakpoint
+// before its first instruction, so it resumes past the breakpoint.
+x16_stop_t x16_run(x16_t* machine, uint64_t max_instructions,
+                   x16_stop_info_t* info);
+
+// Record why the machine is stopping. Engines and traps call this before
+// returning -1; TRAP HALT needs no call.
+void x16_stop(x16_t* machine, x16_stop_t reason);
+
+// Why the machine last stopped
+x16_stop_t x16_stop_reason(x16_t* machine);
+
+// Set or clear a breakpoint. A run stops before executing the instruction
+// at a breakpoint.
+void x16_set_breakpoint(x16_t* machine, uint16_t address, bool set);
+
+// One byte per address, non zero at breakpoints, or NULL when no
+// breakpoint is set
+const uint8_t* x16_breakpoints(x16_t* machine);
+
+// When set, GETC and IN stop the run with X16_STOP_INPUT instead of
+// blocking if no input is ready. PC is left on the trap so it runs again.
+void x16_set_input_wait(x16_t* machine, bool stop);
+
+// True when GETC and IN should stop rather than block
+bool x16_input_wait(x16_t* machine);
+
+// When set, which is the default, a guest that does nothing but poll an
+// empty MR_KBSR from one loop puts the host thread to sleep until a key
+// arrives. The guest sees the same empty polls, only fewer of them per
+// second. Turn it off to measure raw speed.
+void x16_set_idle_sleep(x16_t* machine, bool sleep);
+
+// True when a key can be read without blocking. Keys are read from stdin
+// by a thread that is started on the first use of the keyboard, so a key
+// typed a moment ago may not be ready yet.
+bool x16_input_ready(x16_t* machine);
+
+// Read a key from stdin, waiting for one. Return EOF at the end of input.
+int x16_getchar(x16_t* machine);
+
+// Use console for the keyboard and console output in place of stdin and
+// stdout (see console.h). The machine frees it, and the console it had.
+// NULL goes back to stdin and stdout.
+void x16_set_console(x16_t* machine, console_t* console);
+
+// Save the state of the machine: registers, memory, the instruction
+// count, the mode and priority, and the keyboard and timer. Memory is kept
+// in pages of MEM_PAGE_SIZE words shared with the snapshot the machine
+// was last saved to or restored from, so only the pages written since
+// are copied. Free it with x16_snapshot_free(). Snapshots never change
+// and can be shared by machines on any thread.
+x16_snapshot_t* x16_snapshot(x16_t* machine);
+
+// Put the machine back in the state of a snapshot. Only the pages that
+// differ from the snapshot are copied: those written since the machine
+// was last saved or restored, and all of them the first time, though
+// pages that already match are left alone. The
+// console, devices, breakpoints and settings stay as they are.
+void x16_restore(x16_t* machine, x16_snapshot_t* snapshot);
+
+// Create a machine in the state of a snapshot, with the default console
+// and devices, as x16_create() gives
+x16_t* x16_fork(x16_snapshot_t* snapshot);
+
+// Let go of a snapshot. Its pages are freed once no machine or snapshot
+// uses them.
+void x16_snapshot_free(x16_snapshot_t* snapshot);
+
+// Map the framebuffer at MR_FB and draw it on the terminal with ANSI
+// escapes. Only cells that changed are drawn, at most FB_FPS times a
+// second, when the guest looks for input or every few hundred writes to
+// the framebuffer. Return 0, or -1 if the pages are taken.
+int x16_map_framebuffer(x16_t* machine);
+
+// Console output of the guest is buffered and written when the guest
+// looks for input, halts, fills the buffer, or a few milliseconds after
+// it was written. Write it out now.
+void x16_flush(x16_t* machine);
+
+// This variable is set to 1 to turn on logging at each instruction execution.
+// It is read when a run starts, see feature.h.
 extern int LOG;
 
 // The file to log to
 extern FILE* LOGFP;
 
+// This variable is set to 1 to count the instructions executed by opcode
+// in PROFILE_COUNTS
+extern int PROFILE;
+
+// Instructions executed, indexed by opcode
+extern uint64_t PROFILE_COUNTS[16];
+
 #endif   // X16_H_
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "instruction.h"
+#include "predecode.h"
+
+// x16aot translates an image to C ahead of time. Every basic block that
+// is reachable from the origin through direct control flow becomes a C
+// function; aot_runtime.c links them into a program that dispatches
+// through a PC to function table and interprets everything else.
+
+#define MEMORY_SIZE 65536
+
+static uint16_t memory[MEMORY_SIZE];
+static uint16_t origin;
+static uint32_t image_length;
+
+static bool reachable[MEMORY_SIZE];
+static bool leader[MEMORY_SIZE];
+
+void usage() {
+    fprintf(stderr, "Usage: ./x16aot image-file [output.c]\n");
+    exit(1);
+}
+
+// True when the address holds a word of the image
+static bool in_image(uint16_t address) {
+    return (uint16_t) (address - origin) < image_length;
+}
+
+// True for opcodes that stop the interpreter. Translated programs take
+// no interrupts, so RTI stops them too.
+static bool illegal(const decoded_t* d) {
+    return d->opcode == OP_RTI || d->opcode == OP_RES;
+}
+
+// True when the instruction ends a basic block
+static bool ends_block(const decoded_t* d) {
+    switch (d->opcode) {
+    case OP_BR:
+    case OP_JMP:
+    case OP_JSR:
+    case OP_TRAP:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Read the image, as read_image_file does
+static void read_image(const char* filename) {
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open %s\n", filename);
+        exit(2);
+    }
+
+    if (fread(&origin, sizeof(origin), 1, fp) != 1) {
+        fprintf(stderr, "Can't read origin\n");
+        exit(2);
+    }
+    origin = ntohs(origin);
+
+    uint16_t word;
+    while (image_length < MEMORY_SIZE - origin &&
+           fread(&word, sizeof(word), 1, fp) == 1) {
+        memory[origin + image_length++] = ntohs(word);
+    }
+    fclose(fp);
+}
+
+// Mark a direct jump target as the start of a block
+static void add_target(uint16_t* work, int* count, uint16_t address) {
+    if (!in_image(address)) {
+        return;
+    }
+    leader[address] = true;
+    if (!reachable[address]) {
+        reachable[address] = true;
+        work[(*count)++] = address;
+    }
+}
+
+// Follow direct control flow from the origin. Targets of JMP and JSRR are
+// unknown; the instructions after a JSR or JSRR are assumed to be
+// returned to.
+static void find_code() {
+    static uint16_t work[MEMORY_SIZE];
+    int count = 0;
+    add_target(work, &count, origin);
+
+    while (count > 0) {
+        uint16_t pc = work[--count];
+        while (in_image(pc)) {
+            uint16_t instruction = memory[pc];
+            decoded_t d = predecode_instruction(instruction);
+            uint16_t next = pc + 1;
+            if (illegal(&d)) {
+                break;
+            }
+            if (ends_block(&d)) {
+                bool falls_through = true;
+                if (d.opcode == OP_BR) {
+                    add_target(work, &count, next + d.value);
+                    falls_through = d.nzp != (FL_NEG | FL_ZRO | FL_POS);
+                } else if (d.opcode == OP_JMP) {
+                    falls_through = false;
+                } else if (d.opcode == OP_JSR && d.nzp) {
+                    add_target(work, &count, next + d.value);
+                } else if (d.opcode == OP_TRAP) {
+                    falls_through = d.value != TRAP_HALT;
+                }
+                if (falls_through) {
+                    add_target(work, &count, next);
+                }
+                break;
+            }
+            if (!in_image(next) || reachable[next]) {
+                break;
+            }
+            reachable[next] = true;
+            pc = next;
+        }
+    }
+}
+
+// True when a function is emitted for the block starting at the address
+static bool translated(uint16_t address) {
+    decoded_t d = predecode_instruction(memory[address]);
+    return leader[address] && reachable[address] && !illegal(&d);
+}
+
+// Emit the C statements for one instruction. n is the number of
+// instructions executed by the block including this one.
+static void emit_instruction(FILE* out, uint16_t pc, int n) {
+    uint16_t instruction = memory[pc];
+    decoded_t d = predecode_instruction(instruction);
+    uint16_t next = pc + 1;
+    uint16_t target = next + d.value;
+
+    fprintf(out, "    // 0x%04x: 0x%04x\n", pc, instruction);
+    switch (d.opcode) {
+    case OP_ADD:
+    case OP_AND:
+        if (d.imm) {
+            fprintf(out, "    r%d = r%d %s 0x%04x;\n", d.dst, d.src1,
+                    d.opcode == OP_ADD ? "+" : "&", d.value);
+        } else {
+            fprintf(out, "    r%d = r%d %s r%d;\n", d.dst, d.src1,
+                    d.opcode == OP_ADD ? "+" : "&", d.src2);
+        }
+        fprintf(out, "    cond = AOT_COND(r%d);\n", d.dst);
+        break;
+
+    case OP_NOT:
+        fprintf(out, "    r%d = ~r%d;\n", d.dst, d.src1);
+        fprintf(out, "    cond = AOT_COND(r%d);\n", d.dst);
+        break;
+
+    case OP_LD:
+        fprintf(out, "    r%d = aot_read(a, 0x%04x);\n", d.dst, target);
+        fprintf(out, "    cond = AOT_COND(r%d);\n", d.dst);
+        break;
+
+    case OP_LDI:
+        fprintf(out, "    r%d = aot_read(a, aot_read(a, 0x%04x));\n",
+                d.dst, target);
+        fprintf(out, "    cond = AOT_COND(r%d);\n", d.dst);
+        break;
+
+    case OP_LDR:
+        fprintf(out, "    r%d = aot_read(a, (uint16_t) (r%d + 0x%04x));\n",
+                d.dst, d.src1, d.value);
+        fprintf(out, "    cond = AOT_COND(r%d);\n", d.dst);
+        break;
+
+    case OP_LEA:
+        fprintf(out, "    r%d = 0x%04x;\n", d.dst, target);
+        fprintf(out, "    cond = AOT_COND(r%d);\n", d.dst);
+        break;
+
+    case OP_ST:
+        fprintf(out, "    AOT_WRITE(%d, 0x%04x, 0x%04x, r%d);\n",
+                n, next, target, d.dst);
+        break;
+
+    case OP_STI:
+        fprintf(out, "    AOT_WRITE(%d, 0x%04x, aot_read(a, 0x%04x), r%d);\n",
+                n, next, target, d.dst);
+        break;
+
+    case OP_STR:
+        fprintf(out,
+                "    AOT_WRITE(%d, 0x%04x, (uint16_t) (r%d + 0x%04x), r%d);\n",
+                n, next, d.src1, d.value, d.dst);
+        break;
+
+    case OP_BR:
+        if (d.nzp != (FL_NEG | FL_ZRO | FL_POS)) {
+            fprintf(out, "    if (cond & %d) {\n", d.nzp);
+            fprintf(out, "        AOT_EXIT(%d, 0x%04x);\n", n, target);
+            fprintf(out, "    }\n");
+            fprintf(out, "    AOT_EXIT(%d, 0x%04x);\n", n, next);
+        } else {
+            fprintf(out, "    AOT_EXIT(%d, 0x%04x);\n", n, target);
+        }
+        break;
+
+    case OP_JMP:
+        fprintf(out, "    AOT_EXIT(%d, r%d);\n", n, d.src1);
+        break;
+
+    case OP_JSR:
+        // R7 is written first, as in the interpreter, so JSRR R7 jumps to
+        // the return address
+        fprintf(out, "    r7 = 0x%04x;\n", next);
+        if (d.nzp) {
+            fprintf(out, "    AOT_EXIT(%d, 0x%04x);\n", n, target);
+        } else {
+            fprintf(out, "    AOT_EXIT(%d, r%d);\n", n, d.src1);
+        }
+        break;
+
+    case OP_TRAP:
+        fprintf(out, "    AOT_TRAP(%d, 0x%04x, 0x%04x);\n",
+                n, next, instruction);
+        break;
+    }
+}
+
+// Emit the function of the block starting at start. Return its length.
+static int emit_block(FILE* out, uint16_t start) {
+    fprintf(out, "static int32_t b_%04x(aot_t* a) {\n", start);
+    fprintf(out, "    AOT_ENTER();\n");
+
+    int n = 0;
+    uint16_t pc = start;
+    while (true) {
+        uint16_t instruction = memory[pc];
+        decoded_t d = predecode_instruction(instruction);
+        if (illegal(&d)) {
+            // Let the interpreter deal with it
+            fprintf(out, "    AOT_EXIT(%d, 0x%04x);\n", n, pc);
+            break;
+        }
+        n++;
+        emit_instruction(out, pc, n);
+        if (ends_block(&d)) {
+            break;
+        }
+        pc++;
+        if (!in_image(pc) || !reachable[pc] || leader[pc]) {
+            fprintf(out, "    AOT_EXIT(%d, 0x%04x);\n", n, pc);
+            break;
+        }
+    }
+
+    fprintf(out, "}\n\n");
+    return n;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        usage();
+    }
+
+    read_image(argv[1]);
+    FILE* out = stdout;
+    if (argc == 3) {
+        out = fopen(argv[2], "w");
+        if (out == NULL) {
+            fprintf(stderr, "Cannot open %s\n", argv[2]);
+            exit(2);
+        }
+    }
+
+    find_code();
+
+    fprintf(out, "// Generated by x16aot from %s. Do not edit.\n\n", argv[1]);
+    fprintf(out, "#include \"aot.h\"\n\n");
+
+    static uint16_t lengths[MEMORY_SIZE];
+    int num_blocks = 0;
+    for (uint32_t i = 0; i < image_length; i++) {
+        uint16_t address = origin + i;
+        if (translated(address)) {
+            lengths[address] = emit_block(out, address);
+            num_blocks++;
+        }
+    }
+
+    fprintf(out, "static const aot_block_t blocks[] = {\n");
+    for (uint32_t i = 0; i < image_length; i++) {
+        uint16_t address = origin + i;
+        if (translated(address)) {
+            fprintf(out, "    {0x%04x, %d, b_%04x},\n",
+                    address, lengths[address], address);
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const uint16_t image[] = {");
+    for (uint32_t i = 0; i < image_length; i++) {
+        fprintf(out, "%s0x%04x,", i % 8 == 0 ? "\n    " : " ",
+                memory[origin + i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "const aot_program_t aot_program = {\n");
+    fprintf(out, "    0x%04x, image, %u, blocks, %d\n",
+            origin, image_length, num_blocks);
+    fprintf(out, "};\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    fprintf(stderr, "%s: %d blocks\n", argv[1], num_blocks);
+    return 0;
+}
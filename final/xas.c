@@ -5,6 +5,7 @@
 #include <ctype.h>
 #include <arpa/inet.h>
 #include "instruction.h"
+#include "x16.h"
 
 #define MAX_LINE_LENGTH 256
 #define MAX_LABELS 100
@@ -19,6 +20,25 @@ int num_labels = 0;
 
 uint16_t current_address = DEFAULT_CODESTART;
 
+// Names that val accepts in place of a $ number, for the addresses of
+// the memory mapped devices
+typedef struct {
+    const char* name;
+    uint16_t value;
+} Constant;
+
+const Constant constants[] = {
+    {"KBSR", MR_KBSR},
+    {"KBDR", MR_KBDR},
+    {"TMR", MR_TMR},
+    {"TMI", MR_TMI},
+    {"IVT_KEYBOARD", IVT_BASE + INT_KEYBOARD},
+    {"IVT_TIMER", IVT_BASE + INT_TIMER},
+    {"FB", MR_FB},
+    {"FB_COLS", FB_COLS},
+    {"FB_ROWS", FB_ROWS},
+};
+
 void usage() {
     fprintf(stderr, "Usage: ./xas file\n");
     exit(1);
@@ -46,6 +66,17 @@ uint16_t find_addy(char label_name[]) {
     exit(2);
 }
 
+// Look up a device constant. Return true and set value if name is one.
+bool find_constant(const char* name, uint16_t* value) {
+    for (size_t i = 0; i < sizeof(constants) / sizeof(constants[0]); i++) {
+        if (strcmp(constants[i].name, name) == 0) {
+            *value = constants[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
 void error_val(char operand[], FILE* input, FILE* output) {
     if (operand[0] != '$') {
         fprintf(stderr, "Error: Operand should start with '$'\n");
@@ -258,11 +289,19 @@ int main(int argc, char** argv) {
             machine_code = emit_trap(TRAP_PUTSP);
         } else if (strcmp(instruction, "halt") == 0) {
             machine_code = emit_trap(TRAP_HALT);
+        } else if (strcmp(instruction, "rti") == 0) {
+            machine_code = emit_rti();
         } else if (strcmp(instruction, "val") == 0) {
-            error_val(operand, input_file, output_file);
-            operand[0] = '0';
-            value = atoi(operand);
-            machine_code = emit_value(value);
+            char name[MAX_LINE_LENGTH];
+            if (sscanf(operand, "%s", name) == 1 &&
+                find_constant(name, &value)) {
+                machine_code = emit_value(value);
+            } else {
+                error_val(operand, input_file, output_file);
+                operand[0] = '0';
+                value = atoi(operand);
+                machine_code = emit_value(value);
+            }
         }
         if (machine_code != 0) {
             current_address += 2;
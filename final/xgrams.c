@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "decode.h"
+#include "image.h"
+#include "x16.h"
+
+// xgrams counts which instructions follow each other in an execution and
+// prints the most frequent pairs and triples. These are the candidates for
+// fused micro-ops in the block engine. It reads traces written by x16 -l
+// (or the ones in trace/logs.zip), or runs an image itself.
+
+// Distinct instruction names seen. ADD and AND with an immediate operand
+// count as their own instruction, BR is split by condition.
+#define MAX_NAMES   64
+
+static char names[MAX_NAMES][16];
+static int num_names;
+
+static uint64_t bigrams[MAX_NAMES][MAX_NAMES];
+static uint64_t trigrams[MAX_NAMES][MAX_NAMES][MAX_NAMES];
+static uint64_t total;
+
+// The last two instructions, -1 before there are any
+static int prev1 = -1;
+static int prev2 = -1;
+
+static void usage() {
+    fprintf(stderr, "Usage: ./xgrams [-n top] [trace-file ...]\n"
+        "       ./xgrams [-n top] [-c instructions] -i image-file\n");
+    exit(1);
+}
+
+// Get the index of an instruction name
+static int intern(const char* name) {
+    for (int i = 0; i < num_names; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    if (num_names == MAX_NAMES) {
+        fprintf(stderr, "Too many instruction names\n");
+        exit(2);
+    }
+    snprintf(names[num_names], sizeof(names[0]), "%s", name);
+    return num_names++;
+}
+
+// Count one instruction in its decoded form, e.g. "add    %r1, %r1, $-1"
+static void count(const char* text) {
+    char name[16];
+    if (sscanf(text, "%11s", name) != 1) {
+        return;
+    }
+    if ((strcmp(name, "add") == 0 || strcmp(name, "and") == 0) &&
+        strrchr(text, '$') != NULL) {
+        strcat(name, " imm");
+    }
+
+    int current = intern(name);
+    if (prev1 >= 0) {
+        bigrams[prev1][current]++;
+        if (prev2 >= 0) {
+            trigrams[prev2][prev1][current]++;
+        }
+    }
+    prev2 = prev1;
+    prev1 = current;
+    total++;
+}
+
+// Count the instructions of a trace, one "0x3000: add ..." line each
+static void read_trace(FILE* fp) {
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char* text = strchr(line, ':');
+        if (text != NULL) {
+            count(text + 1);
+        }
+    }
+}
+
+// Run an image with the switch interpreter and count what it executes.
+// Guest input comes from stdin and guest output is discarded.
+static void run_image(const char* filename, uint64_t instructions) {
+    x16_t* machine = x16_create();
+    if (machine == NULL) {
+        fprintf(stderr, "Cannot create a machine\n");
+        exit(1);
+    }
+    if (read_image(machine, filename) != 0) {
+        fprintf(stderr, "Failed to read image: %s\n", filename);
+        exit(1);
+    }
+
+    for (uint64_t i = 0; instructions == 0 || i < instructions; i++) {
+        char* text = decode(x16_memread(machine, x16_pc(machine)));
+        count(text);
+        free(text);
+        if (x16_exec(machine) != 0) {
+            break;
+        }
+    }
+    x16_free(machine);
+}
+
+// An n-gram and how often it ran
+typedef struct {
+    int names[3];
+    uint64_t count;
+} gram_t;
+
+static int compare_grams(const void* a, const void* b) {
+    uint64_t ca = ((const gram_t*) a)->count;
+    uint64_t cb = ((const gram_t*) b)->count;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+// Print the top most frequent n-grams
+static void print_grams(FILE* out, gram_t* grams, int num, int n, int top) {
+    qsort(grams, num, sizeof(gram_t), compare_grams);
+    fprintf(out, "%s:\n", n == 2 ? "Bigrams" : "Trigrams");
+    for (int i = 0; i < num && i < top; i++) {
+        char sequence[64] = "";
+        for (int j = 0; j < n; j++) {
+            strcat(sequence, j > 0 ? " ; " : "");
+            strcat(sequence, names[grams[i].names[j]]);
+        }
+        fprintf(out, "%12llu %6.2f%%  %s\n",
+            (unsigned long long) grams[i].count,
+            100.0 * grams[i].count / total, sequence);
+    }
+}
+
+int main(int argc, char** argv) {
+    int ch;
+    int top = 20;
+    uint64_t instructions = 0;
+    const char* image = NULL;
+    while ((ch = getopt(argc, argv, "n:c:i:")) != -1) {
+        switch (ch) {
+        case 'n':
+            top = atoi(optarg);
+            break;
+
+        case 'c':
+            instructions = strtoull(optarg, NULL, 0);
+            break;
+
+        case 'i':
+            image = optarg;
+            break;
+
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    FILE* out = stdout;
+    if (image != NULL) {
+        if (argc != 0) {
+            usage();
+        }
+        // Keep stdout for the report
+        out = fdopen(dup(STDOUT_FILENO), "w");
+        if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+            perror("xgrams");
+            exit(2);
+        }
+        run_image(image, instructions);
+    } else if (argc == 0) {
+        read_trace(stdin);
+    } else {
+        for (int i = 0; i < argc; i++) {
+            FILE* fp = fopen(argv[i], "r");
+            if (fp == NULL) {
+                fprintf(stderr, "Cannot open %s\n", argv[i]);
+                exit(2);
+            }
+            // Sequences do not run across files
+            prev1 = prev2 = -1;
+            read_trace(fp);
+            fclose(fp);
+        }
+    }
+
+    fprintf(out, "%llu instructions\n", (unsigned long long) total);
+    if (total == 0) {
+        return 0;
+    }
+
+    gram_t* grams = (gram_t*) malloc(
+        MAX_NAMES * MAX_NAMES * MAX_NAMES * sizeof(gram_t));
+    int num = 0;
+    for (int a = 0; a < num_names; a++) {
+        for (int b = 0; b < num_names; b++) {
+            if (bigrams[a][b] != 0) {
+                grams[num++] = (gram_t) {{a, b, 0}, bigrams[a][b]};
+            }
+        }
+    }
+    print_grams(out, grams, num, 2, top);
+
+    num = 0;
+    for (int a = 0; a < num_names; a++) {
+        for (int b = 0; b < num_names; b++) {
+            for (int c = 0; c < num_names; c++) {
+                if (trigrams[a][b][c] != 0) {
+                    grams[num++] = (gram_t) {{a, b, c}, trigrams[a][b][c]};
+                }
+            }
+        }
+    }
+    print_grams(out, grams, num, 3, top);
+
+    free(grams);
+    fclose(out);
+    return 0;
+}